@@ -9,7 +9,23 @@
 #include "include/controlsProjeto.hpp"
 #include "include/stb_image.h"
 #include "Sphere.h"
+#include "BodyBatch.h"
+#include "BodyTable.h"
+#include "simulationThread.hpp"
+#include "jobSystem.hpp"
+#include "events.hpp"
+#include "porkchop.hpp"
+#include "frustum.hpp"
+#include "include/tools.hpp"
 #include <map>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
+#include <future>
 #include <glm/gtc/type_ptr.hpp>
 #include "include/ft2build.h"
 #include FT_FREETYPE_H
@@ -36,6 +52,10 @@ struct PlanetInfo {
 PlanetInfo Info;
 
 GLuint textVAO, textVBO;
+GLuint skyboxVAO, skyboxVBO;
+// Uniforms of the text and overlay programs, resolved once after LoadShaders
+Uniform<glm::vec3> textColorUniform;
+Uniform<float> overlayOpacityUniform;
 
 unsigned int loadTexture(char const* path);
 void RenderText(GLuint programID2, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color);
@@ -78,11 +98,14 @@ bool initializeOpenGL() {
 
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
+    // Filter across cube faces, so the skybox shows no seams
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
     return true;
 }
 
 void cleanup() {
+    Sphere::releaseCache();
     glfwDestroyWindow(window);
     glfwTerminate();
 }
@@ -124,33 +147,165 @@ unsigned int loadTexture(char const* path)
     return textureID;
 }
 
-void renderSphere(float r, int sectors, int stacks) {
-    Sphere sphere(r, sectors, stacks);
-    sphere.Draw();
-}
+// Loads every image into a layer of a GL_TEXTURE_2D_ARRAY. Layers must share one size,
+// so images that differ from the first one are resampled (nearest) to match it.
+unsigned int loadTextureArray(const std::vector<std::string>& paths)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+
+    int layerWidth = 0, layerHeight = 0;
+    std::vector<unsigned char> resampled;
+    for (size_t layer = 0; layer < paths.size(); layer++)
+    {
+        int width, height, nrComponents;
+        unsigned char* data = stbi_load(paths[layer].c_str(), &width, &height, &nrComponents, 3);
+        if (!data)
+        {
+            std::cout << "Texture failed to load at path: " << paths[layer] << std::endl;
+            continue;
+        }
 
+        if (layerWidth == 0)
+        {
+            layerWidth = width;
+            layerHeight = height;
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, layerWidth, layerHeight, (GLsizei)paths.size(), 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        }
 
-void setTexture(GLuint textureID, GLuint programID) {
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glUniform1i(glGetUniformLocation(programID, "myTextureSampler"), 0);
+        const unsigned char* pixels = data;
+        if (width != layerWidth || height != layerHeight)
+        {
+            resampled.resize((size_t)layerWidth * layerHeight * 3);
+            for (int y = 0; y < layerHeight; y++)
+                for (int x = 0; x < layerWidth; x++)
+                    for (int c = 0; c < 3; c++)
+                        resampled[((size_t)y * layerWidth + x) * 3 + c] = data[((size_t)(y * height / layerHeight) * width + x * width / layerWidth) * 3 + c];
+            pixels = resampled.data();
+        }
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)layer, layerWidth, layerHeight, 1, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+        stbi_image_free(data);
+    }
+
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    return textureID;
 }
 
+// Builds a GL_TEXTURE_CUBE_MAP from an equirectangular image (longitude across,
+// latitude down), sampled once per texel when it is loaded so the shader only does
+// one cube lookup. Returns 0 if the image does not load.
+unsigned int loadCubemapFromEquirect(char const* path, int faceSize)
+{
+    int width, height, nrComponents;
+    unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 3);
+    if (!data)
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return 0;
+    }
+
+    // Bilinear fetch; longitude wraps around, latitude stops at the poles
+    auto sample = [&](float u, float v, unsigned char* out) {
+        float fx = u * width - 0.5f, fy = glm::clamp(v * height - 0.5f, 0.0f, (float)(height - 1));
+        int x0 = (int)std::floor(fx), y0 = (int)fy;
+        float tx = fx - x0, ty = fy - y0;
+        int x1 = x0 + 1, y1 = std::min(y0 + 1, height - 1);
+        x0 = ((x0 % width) + width) % width;
+        x1 = x1 % width;
+        for (int c = 0; c < 3; c++)
+        {
+            float top = data[((size_t)y0 * width + x0) * 3 + c] * (1.0f - tx) + data[((size_t)y0 * width + x1) * 3 + c] * tx;
+            float bottom = data[((size_t)y1 * width + x0) * 3 + c] * (1.0f - tx) + data[((size_t)y1 * width + x1) * 3 + c] * tx;
+            out[c] = (unsigned char)(top * (1.0f - ty) + bottom * ty + 0.5f);
+        }
+    };
+
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+
+    const float pi = 3.14159265f;
+    std::vector<unsigned char> face((size_t)faceSize * faceSize * 3);
+    for (int f = 0; f < 6; f++)
+    {
+        for (int y = 0; y < faceSize; y++)
+            for (int x = 0; x < faceSize; x++)
+            {
+                // Direction through the texel centre, in the face order and orientation GL expects
+                float s = 2.0f * (x + 0.5f) / faceSize - 1.0f, t = 2.0f * (y + 0.5f) / faceSize - 1.0f;
+                glm::vec3 dir;
+                switch (f)
+                {
+                case 0: dir = glm::vec3(1.0f, -t, -s); break;   // +X
+                case 1: dir = glm::vec3(-1.0f, -t, s); break;   // -X
+                case 2: dir = glm::vec3(s, 1.0f, t); break;     // +Y
+                case 3: dir = glm::vec3(s, -1.0f, -t); break;   // -Y
+                case 4: dir = glm::vec3(s, -t, 1.0f); break;    // +Z
+                default: dir = glm::vec3(-s, -t, -1.0f); break; // -Z
+                }
+                dir = glm::normalize(dir);
+                float u = 0.5f + std::atan2(dir.z, dir.x) / (2.0f * pi);
+                float v = std::acos(glm::clamp(dir.y, -1.0f, 1.0f)) / pi;
+                sample(u, v, &face[((size_t)y * faceSize + x) * 3]);
+            }
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_RGB8, faceSize, faceSize, 0, GL_RGB, GL_UNSIGNED_BYTE, face.data());
+    }
+    stbi_image_free(data);
 
-void setShaderUniforms(GLuint programID, const glm::vec3& lightColor, const glm::vec3& lightPos, const glm::vec3& viewPos,
-    float ambientStrength, float specularStrength, float shininess,
-    const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model) {
-    glUniform3f(glGetUniformLocation(programID, "lightColor"), lightColor.r, lightColor.g, lightColor.b);
-    glUniform3f(glGetUniformLocation(programID, "lightPos"), lightPos.x, lightPos.y, lightPos.z);
-    glUniform3f(glGetUniformLocation(programID, "viewPos"), viewPos.x, viewPos.y, viewPos.z);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
-    glUniform1f(glGetUniformLocation(programID, "ambientStrength"), ambientStrength);
-    glUniform1f(glGetUniformLocation(programID, "specularStrength"), specularStrength);
-    glUniform1f(glGetUniformLocation(programID, "shininess"), shininess);
+    return textureID;
+}
 
-    glUniformMatrix4fv(glGetUniformLocation(programID, "projection"), 1, GL_FALSE, &projection[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(programID, "view"), 1, GL_FALSE, &view[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(programID, "model"), 1, GL_FALSE, &model[0][0]);
+// Translation, spin around Y and radius of a body, in that order
+glm::mat4 bodyModelMatrix(const glm::vec3& position, float spin, float radius)
+{
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    model = glm::rotate(model, spin, glm::vec3(0.0f, 1.0f, 0.0f));
+    return glm::scale(model, glm::vec3(radius));
+}
+
+// Unit cube around the camera for the skybox, 36 vertices, positions only
+void createSkyboxVAO()
+{
+    static const GLfloat corners[8][3] = {
+        { -1, -1, -1 }, { 1, -1, -1 }, { 1, 1, -1 }, { -1, 1, -1 },
+        { -1, -1, 1 }, { 1, -1, 1 }, { 1, 1, 1 }, { -1, 1, 1 },
+    };
+    // Seen from inside; back-face culling is off, so the winding does not matter
+    static const int faces[6][4] = {
+        { 1, 5, 6, 2 }, { 4, 0, 3, 7 }, { 3, 2, 6, 7 },
+        { 4, 5, 1, 0 }, { 5, 4, 7, 6 }, { 0, 1, 2, 3 },
+    };
+    GLfloat vertices[36 * 3];
+    int n = 0;
+    for (int f = 0; f < 6; f++)
+        for (int k : { 0, 1, 2, 0, 2, 3 })
+            for (int c = 0; c < 3; c++)
+                vertices[n++] = corners[faces[f][k]][c];
+
+    glGenVertexArrays(1, &skyboxVAO);
+    glGenBuffers(1, &skyboxVBO);
+    glBindVertexArray(skyboxVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
 }
 
 void RenderText(GLuint programID2, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color)
@@ -158,7 +313,7 @@ void RenderText(GLuint programID2, std::string text, GLfloat x, GLfloat y, GLflo
     //std::cout << text << std::endl;
     // Activate corresponding render state
     glUseProgram(programID2);
-    glUniform3f(glGetUniformLocation(programID2, "textColor"), color.x, color.y, color.z);
+    textColorUniform.set(color);
     glActiveTexture(GL_TEXTURE0);
     glBindVertexArray(textVAO);
 
@@ -199,6 +354,31 @@ void RenderText(GLuint programID2, std::string text, GLfloat x, GLfloat y, GLflo
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+// Image drawn over the scene in a screen rectangle, with the text quad buffer
+void RenderOverlay(GLuint overlayProgramID, GLuint textureID, GLfloat x, GLfloat y, GLfloat w, GLfloat h)
+{
+    glUseProgram(overlayProgramID);
+    overlayOpacityUniform.set(0.85f);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glBindVertexArray(textVAO);
+    GLfloat vertices[6][4] = {
+        { x,     y + h, 0.0, 1.0 },
+        { x,     y,     0.0, 0.0 },
+        { x + w, y,     1.0, 0.0 },
+
+        { x,     y + h, 0.0, 1.0 },
+        { x + w, y,     1.0, 0.0 },
+        { x + w, y + h, 1.0, 1.0 }
+    };
+    glBindBuffer(GL_ARRAY_BUFFER, textVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 void ShowInfo(GLuint programID2)
 {
     RenderText(programID2, "Planeta: " + Info.Name, 25.0f, SCREEN_HEIGHT - 30.0f, 0.35f, glm::vec3(1.0f, 1.0f, 1.0f));
@@ -208,7 +388,12 @@ void ShowInfo(GLuint programID2)
 }
 
 
-int main() {
+int main(int argc, char** argv) {
+    // Command line tools run headless, without opening a window
+    // Options starting with -- are headless tools, anything else is a scene file
+    if (argc > 1 && strncmp(argv[1], "--", 2) == 0) { return runTool(argc, argv); }
+    const char* scenePath = argc > 1 ? argv[1] : "scenes/solarSystem.scene";
+
     if (!initializeOpenGL()) { return -1; }
 
     glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
@@ -287,19 +472,20 @@ int main() {
     GLuint VertexArrayID;
     glGenVertexArrays(1, &VertexArrayID);
     glBindVertexArray(VertexArrayID);
-    GLuint programID = LoadShaders("shaders/TransformVertexShader.vertexshader", "shaders/TextureFragmentShader.fragmentshader");
-
-    // Get the uniform location for the MVP matrix
-    GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-    glm::mat4 MVP, Projection, View;
-
-    glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+    glm::mat4 Projection, View;
 
     GLuint programID2 = LoadShaders("shaders/TextShader.vertexshader", "shaders/TextShader.fragmentshader");
     // PROJECTION FOR TEXT RENDER
     glm::mat4 Text_projection = glm::ortho(0.0f, SCREEN_WIDTH, 0.0f, SCREEN_HEIGHT);
     glUseProgram(programID2);
-    glUniformMatrix4fv(glGetUniformLocation(programID2, "projection"), 1, GL_FALSE, glm::value_ptr(Text_projection));
+    Uniform<glm::mat4>(programID2, "projection").set(Text_projection);
+    Uniform<int>(programID2, "text").set(0);
+    textColorUniform = Uniform<glm::vec3>(programID2, "textColor");
+    GLuint overlayProgramID = LoadShaders("shaders/OverlayShader.vertexshader", "shaders/OverlayShader.fragmentshader");
+    glUseProgram(overlayProgramID);
+    Uniform<glm::mat4>(overlayProgramID, "projection").set(Text_projection);
+    Uniform<int>(overlayProgramID, "image").set(0);
+    overlayOpacityUniform = Uniform<float>(overlayProgramID, "opacity");
 
     /* TEXT RENDERING VAO-VBO*/
     glGenVertexArrays(1, &textVAO);
@@ -315,40 +501,94 @@ int main() {
     glUseProgram(0);
 
 
-    // Load textures for Earth, Mars, Sun, Moon, and Venus
-    GLuint earthTextureID = loadTexture("texturas/earth.jpg");
-    GLuint marsTextureID = loadTexture("texturas/mars.jpg");
-    GLuint sunTextureID = loadTexture("texturas/sun.jpg");
-    GLuint moonTextureID = loadTexture("texturas/moon.jpg");
-    GLuint venusTextureID = loadTexture("texturas/venus.jpg");
-    GLuint jupiterTextureID = loadTexture("texturas/jupiter.jpg");
-    GLuint uranusTextureID = loadTexture("texturas/uranus.jpg");
-    GLuint mercuryTextureID = loadTexture("texturas/mercury.jpg");
-    GLuint neptuneTextureID = loadTexture("texturas/neptune.jpg");
-    GLuint saturnTextureID = loadTexture("texturas/saturn.jpg");
-    GLuint celestialSkyID = loadTexture("texturas/sky2.png");
-
-    double angle[9] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 , 0.0 };
-    float pos_earth = 50.0;
-    double speed_factor = 10;
+    BodyTable bodies;
+    if (!loadBodyTable(scenePath, bodies)) {
+        cleanup();
+        return -1;
+    }
+
+    // Body textures go into one texture array, one layer per unique scene texture
+    GLuint bodyTextureArrayID = loadTextureArray(bodies.texturePaths);
+    // The only sky image shipped is square; it is read as longitude x latitude all the same.
+    // A face spans a quarter of the longitude, so 2048 texels across give 512 per face
+    GLuint skyboxTextureID = loadCubemapFromEquirect("texturas/skybox.png", 512);
+    createSkyboxVAO();
+
+    // Each draw picks the cheapest variant that shades it right (ShaderVariant in shader.hpp)
+    std::unique_ptr<ShaderPermutations> instancedPrograms(new ShaderPermutations("shaders/InstancedVertexShader.vertexshader", "shaders/InstancedFragmentShader.fragmentshader"));
+    GLuint skyboxProgramID = LoadShaders("shaders/skybox.vertexshader", "shaders/skybox.fragmentshader");
+    glUseProgram(skyboxProgramID);
+    Uniform<int>(skyboxProgramID, "skybox").set(0);
+    GLuint instancedProgramID = instancedPrograms->program(variantLit);
+    GLuint emissiveProgramID = instancedPrograms->program(variantEmissive);
+    GLuint bodyProgramIDs[2] = { instancedProgramID, emissiveProgramID };
+    for (GLuint id : bodyProgramIDs) {
+        glUseProgram(id);
+        Uniform<int>(id, "bodyTextures").set(0);
+    }
+    glUseProgram(0);
+    const ShaderLoadStats& shaderStats = shaderLoadStats();
+    std::cout << "Shaders: " << shaderStats.cached << " from the program cache, " << shaderStats.compiled << " compiled, "
+              << shaderStats.milliseconds << " ms (" << (shaderStats.compiled > 0 ? "cold" : "warm") << " start)" << std::endl;
+
+    // Bodies at full ambient (the Sun) are the light: they go in their own batch for the emissive variant.
+    // Both lists only hold the bodies inside the view frustum, refilled every frame
+    std::vector<size_t> litBodies, emissiveBodies;
+    VisibleSet visibleBodies, visibleParticles;
+    std::unique_ptr<BodyBatch> bodyBatch(new BodyBatch(36, 18));
+    std::unique_ptr<BodyBatch> emissiveBatch(new BodyBatch(36, 18));
+    // N-body belt particles: many and tiny, a coarse sphere is enough
+    std::unique_ptr<BodyBatch> particleBatch(new BodyBatch(6, 4));
+    // Camera and light for every program, written once per frame
+    std::unique_ptr<FrameUniformBuffer> frameUniformBuffer(new FrameUniformBuffer());
+    FrameUniforms frameUniforms;
 
-    auto orbitRadius = [pos_earth](double theta, double e, double rad) -> double { return pos_earth * rad * ((1.0 - e * e) / (1.0 + e * std::cos(theta)));};
-    auto delta_angle = [](double year_in_days, double seconds_on_day) -> double {return (2.0 * 3.14159 / (year_in_days * seconds_on_day)); };
-    auto angular_speed = [speed_factor](double orbit_in_days) -> double {return ((2 * 3.14159) / orbit_in_days) * speed_factor; };
+    double speed_factor = 10;
     bool rodar = true;
-    float velocidade[9] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 , 0.0 };
-    float x[9] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 , 0.0 };
-    float z[9] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 , 0.0 };
     float escala = 0.00005;
 
+    // Simulated days per step at warp 1: the same rate the per-frame angle increments used to give at 60 Hz
+    double days_per_step = 2 * 3.14159 * speed_factor / 360;
+
+    // The simulation runs on its own thread at a fixed rate; frames draw between its last two steps
+    // Worker threads shared by the simulation and the render loop
+    JobSystem jobs(JobSystem::defaultWorkerCount());
+    std::cout << "Job system: " << jobs.workerCount() << " workers" << std::endl;
+
+    SimulationThread simulation(bodies, &jobs, 60.0, days_per_step, escala / days_per_step, 0.0);
+    BodyState renderState = simulation.latest().current;
+    bool warpKeyHeld = false;
+    // Eclipses and oppositions to jump between, when the scene names an event file
+    EventIndex events;
+    if (!bodies.eventsPath.empty() && events.open(bodies.eventsPath.c_str()))
+        std::cout << "Events " << bodies.eventsPath << ": " << events.count() << " from day " << events.startDay()
+                  << " to " << events.endDay() << std::endl;
+    bool eventKeyHeld = false;
+    std::string eventText;
+    // Porkchop plot of the scene's transfer, recomputed from the current date every time it is shown.
+    // A million Lambert problems take most of a second, so the grid is filled on its own thread
+    // and the texture uploaded by the frame that finds it done.
+    int porkchopFrom = bodies.find(bodies.porkchopFrom), porkchopTo = bodies.find(bodies.porkchopTo);
+    GLuint porkchopTextureID = 0;
+    bool porkchopShown = false;
+    bool porkchopKeyHeld = false;
+    std::string porkchopText;
+    PorkchopGrid porkchopGrid;
+    std::future<bool> porkchopPending;
+    double porkchopStart = 0.0;
+    bool scrubbing = false;
+    double scrubTarget = 0.0;
+    double lastFrameTime = glfwGetTime();
+    simulation.start();
+
     glm::vec3 lightpos(0.0f, 0.0f, 0.0f);
     glm::vec3 lightcolor(1.0f, 1.0f, 1.0f);
     
     //Posio inicial da cmara
     glm::vec3 position = glm::vec3(-5.5, 35.5, 85.5);
 
-    int planetaSelecionado = 0;
-
+    // Index into the body table of the body followed by the camera, -1 = free camera
+    int planetaSelecionado = -1;
 
 
     do {
@@ -356,390 +596,203 @@ int main() {
 
         computeMatricesFromInputs(position);
 
-        double radius = orbitRadius(3.14159 * 2 * angle[2] / 360, 0.017, 1);
-
-        if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS or rodar == true) {
-
-            //Translao Terra
-            angle[2] += angular_speed(365.25);
-            x[2] = radius * sin(3.14159 * 2 * angle[2] / 360);
-            z[2] = radius * cos(3.14159 * 2 * angle[2] / 360);
-            //Rotao
-            velocidade[2] += 1574 * escala;
-
-
-            //Translao Marte
-            angle[3] += angular_speed(687);
-            radius = orbitRadius(3.14159 * 2 * angle[3] / 360, 0.093, 1.524);
-            x[3] = radius * sin(3.14159 * 2 * angle[3] / 360);
-            z[3] = radius * cos(3.14159 * 2 * angle[3] / 360);
-            //Rotao
-            velocidade[3] += 866 * escala;
-
-            //Translao Venus
-            angle[1] += angular_speed(224.70);
-            radius = orbitRadius(3.14159 * 2 * angle[1] / 360, 0.007, 0.723);
-            x[1] = radius * sin(3.14159 * 2 * angle[1] / 360);
-            z[1] = radius * cos(3.14159 * 2 * angle[1] / 360);
-            //Rotao
-            velocidade[1] += 1.52 * escala;
-
-
-            //Translao Jupiter
-            angle[4] += angular_speed(4328.9);
-            radius = orbitRadius(3.14159 * 2 * angle[4] / 360, 0.007, 5.204);
-            x[4] = radius * sin(3.14159 * 2 * angle[4] / 360);
-            z[4] = radius * cos(3.14159 * 2 * angle[4] / 360);
-            //Rotao
-            velocidade[4] += 45583 * escala;
-
-
-            //Translao Urano
-            angle[6] += angular_speed(84.01 * 365);
-
-            radius = orbitRadius(3.14159 * 2 * angle[6] / 360, 0.046, 19.22);
-
-            x[6] = radius * sin(3.14159 * 2 * angle[6] / 360);
-            z[6] = radius * cos(3.14159 * 2 * angle[6] / 360);
-            //Rotao
-            velocidade[6] += 14794 * escala;
-
-
-            //Translao Mercurio
-            angle[0] += angular_speed(87.97);
-
-            radius = orbitRadius(3.14159 * 2 * angle[0] / 360, 0.206, 0.387);
-
-            x[0] = radius * sin(3.14159 * 2 * angle[0] / 360);
-            z[0] = radius * cos(3.14159 * 2 * angle[0] / 360);
-            //Rotao
-            velocidade[0] += 10.83 * escala;
-
-
-            //Translao Neptuno
-            angle[7] += angular_speed(164.8 * 365);
-
-            radius = orbitRadius(3.14159 * 2 * angle[7] / 360, 0.01, 30.05);
-
-            x[7] = radius * sin(3.14159 * 2 * angle[7] / 360);
-            z[7] = radius * cos(3.14159 * 2 * angle[7] / 360);
-            //Rotao
-            velocidade[7] += 9719 * escala;
-
-
-            //Translao Saturno
-            angle[5] += angular_speed(29.46 * 365);
-
-            radius = orbitRadius(3.14159 * 2 * angle[5] / 360, 0.056, 9.582);
-
-            x[5] = radius * sin(3.14159 * 2 * angle[5] / 360);
-            z[5] = radius * cos(3.14159 * 2 * angle[5] / 360);
-            //Rotao
-            velocidade[5] += 36840 * escala;
-
-
-            //Rotao do Sol
-            velocidade[8] += 1574 / 30 * escala;
-
-            //Translao Lua
-            angle[8] += angular_speed(27.32);
-            radius = orbitRadius(3.14159 * 2 * angle[8] / 360, 0.055, 0.1);
-            x[8] = radius * sin(3.14159 * 2 * angle[8] / 360);
-            z[8] = radius * cos(3.14159 * 2 * angle[8] / 360);
-
+        if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
             rodar = true;
         }
         if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
             rodar = false;
         }
-
-
-        glUseProgram(programID);
-        // Render Earth
-        glm::mat4 earthModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x[2], 0.0f, z[2]));
-        earthModelMatrix = glm::rotate(earthModelMatrix, velocidade[2], glm::vec3(0.0f, 1.0f, 0.0f));
-
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * earthModelMatrix;
-        glm::vec3 viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, lightpos, viewPos, 0.5f, 0.1f, 0.4f * 128.0f, Projection, View, earthModelMatrix);
-
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(earthTextureID, programID);
-        renderSphere(1.0f, 36, 18);
-
-
-
-        // Render Moon
-        glm::mat4 moonModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x[2] + x[8], 0.0f, z[2] + z[8]));
-        moonModelMatrix = glm::rotate(moonModelMatrix, velocidade[2], glm::vec3(0.0f, 1.0f, 0.0f));
-
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * moonModelMatrix;
-        viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, lightpos, viewPos, 0.5f, 0.1f, 0.4f * 128.0f, Projection, View, moonModelMatrix);
-
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(moonTextureID, programID);
-        renderSphere(0.55f, 36, 18);
-
-
-
-        // Render Mars
-        glm::mat4 marsModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x[3], 0.0f, z[3]));
-        marsModelMatrix = glm::rotate(marsModelMatrix, velocidade[3], glm::vec3(0.0f, 1.0f, 0.0f));
-        
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * marsModelMatrix;
-        viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, lightpos, viewPos, 0.5f, 0.1f, 0.4f * 128.0f, Projection, View, marsModelMatrix);
-
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(marsTextureID, programID);
-        renderSphere(1.2f, 36, 18);
-
-
-
-        // Render Sun
-        glm::mat4 sunModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.0f));
-        sunModelMatrix = glm::rotate(sunModelMatrix, velocidade[8], glm::vec3(0.0f, 1.0f, 0.0f));
-       
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * sunModelMatrix;
-        viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, lightpos, viewPos, 1.f, 0.1f, 0.4f * 128.0f, Projection, View, sunModelMatrix);
-
-
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(sunTextureID, programID);
-        renderSphere(10.0f, 36, 18);
-
-
-
-        // Render Venus
-        glm::mat4 venusModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x[1], 0.0f, z[1]));
-        venusModelMatrix = glm::rotate(venusModelMatrix, velocidade[1], glm::vec3(0.0f, 1.0f, 0.0f));
-       
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * venusModelMatrix;
-        viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, lightpos, viewPos, 0.5f, 0.1f, 0.4f * 128.0f, Projection, View, venusModelMatrix);
-
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(venusTextureID, programID);
-        renderSphere(0.95f, 36, 18);
-
-
-
-        // Render Jupiter
-        glm::mat4 jupiterModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x[4], 0.0f, z[4]));
-        jupiterModelMatrix = glm::rotate(jupiterModelMatrix, velocidade[4], glm::vec3(0.0f, 1.0f, 0.0f));
-        
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * jupiterModelMatrix;
-        viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, lightpos, viewPos, 0.5f, 0.1f, 0.4f * 128.0f, Projection, View, jupiterModelMatrix);
-
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(jupiterTextureID, programID);
-        renderSphere(4.2f, 36, 18);
-
-
-
-        // Render Uranus
-        glm::mat4 uranusModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x[6], 0.0f, z[6]));
-        uranusModelMatrix = glm::rotate(uranusModelMatrix, velocidade[6], glm::vec3(0.0f, 1.0f, 0.0f));
-        
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * uranusModelMatrix;
-        viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, lightpos, viewPos, 0.5f, 0.1f, 0.4f * 128.0f, Projection, View, uranusModelMatrix);
-
-
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(uranusTextureID, programID);
-        renderSphere(2.9f, 36, 18);
-
-
-
-        // Render Mercury
-        glm::mat4 mercuryModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x[0], 0.0f, z[0]));
-        mercuryModelMatrix = glm::rotate(mercuryModelMatrix, velocidade[0], glm::vec3(0.0f, 1.0f, 0.0f));
-        
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * mercuryModelMatrix;
-        viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, lightpos, viewPos, 0.5f, 0.1f, 0.4f * 128.0f, Projection, View, mercuryModelMatrix);
-
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(mercuryTextureID, programID);
-        renderSphere(0.383f, 36, 18);
-
-
-
-        // Render Neptune
-        glm::mat4 neptuneModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x[7], 0.0f, z[7]));
-        neptuneModelMatrix = glm::rotate(neptuneModelMatrix, velocidade[7], glm::vec3(0.0f, 1.0f, 0.0f));
-        
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * neptuneModelMatrix;
-        viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, lightpos, viewPos, 0.5f, 0.1f, 0.4f * 128.0f, Projection, View, neptuneModelMatrix);
-
-
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(neptuneTextureID, programID);
-        renderSphere(0.78f, 36, 18);
-
-
-
-        // Render Saturn
-        glm::mat4 saturnModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x[5], 0.0f, z[5]));
-        saturnModelMatrix = glm::rotate(saturnModelMatrix, velocidade[5], glm::vec3(0.0f, 1.0f, 0.0f));
-        
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * saturnModelMatrix;
-        viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, lightpos, viewPos, 0.5f, 0.1f, 0.4f * 128.0f, Projection, View, saturnModelMatrix);
-
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(saturnTextureID, programID);
-        renderSphere(3.7f, 36, 18);
-
-
-
-        //render sky
-        glm::mat4 skyModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.0f));
-        Projection = getProjectionMatrix();
-        View = getViewMatrix();
-        MVP = Projection * View * skyModelMatrix;
-        viewPos = getCameraPosition();
-
-        setShaderUniforms(programID, lightcolor, glm::vec3(), viewPos, 1.0f, 0.f, 0.0f, Projection, View, skyModelMatrix);
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        setTexture(celestialSkyID, programID);
-        renderSphere(2000.0f, 36, 18);
-
-
-
-
-        if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS or planetaSelecionado == 1) {
-            position = glm::vec3(x[0], 1, z[0]+4.4);
-            planetaSelecionado = 1;
-            Info.Name = "Mercurio";
-            Info.OrbitSpeed = "47,87";
-            Info.Mass = "0.32868";
-            Info.Gravity = "0.38"; //Em Mercrio, a gravidade  cerca de 0,38 vezes a gravidade na Terra
-
-            ShowInfo(programID2);
-
-
-        }if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS or planetaSelecionado == 2) {
-            position = glm::vec3(x[1], 1.5, z[1] + 6.4);
-            planetaSelecionado = 2;
-
-            Info.Name = "Venus";
-            Info.OrbitSpeed = "35,02";
-            Info.Mass = "0.32868";
-            Info.Gravity = "0.90";
-
-            ShowInfo(programID2);
-
-        }if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS or planetaSelecionado == 3) {
-            position = glm::vec3(x[2], 1.6, z[2] + 6.4);
-            planetaSelecionado = 3;
-
-            Info.Name = "Terra";
-            Info.OrbitSpeed = "29,76";
-            Info.Mass = "5.97600";
-            Info.Gravity = "1";
-
-            ShowInfo(programID2);
-
+        simulation.setRunning(rodar);
+
+        // Time warp: + doubles, - halves, once per key press
+        bool fasterKey = glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_KP_ADD) == GLFW_PRESS;
+        bool slowerKey = glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_KP_SUBTRACT) == GLFW_PRESS;
+        if ((fasterKey || slowerKey) && !warpKeyHeld) {
+            simulation.setWarp(simulation.getWarp() * (fasterKey ? 2.0 : 0.5));
+            std::cout << "Time warp: x" << simulation.getWarp() << std::endl;
+        }
+        warpKeyHeld = fasterKey || slowerKey;
+
+        // Timeline: hold [ or ] to scrub back or forward ten simulated years per second, Home goes back to the start
+        double frameTime = glfwGetTime();
+        double frameSeconds = frameTime - lastFrameTime;
+        lastFrameTime = frameTime;
+        bool backKey = glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS;
+        bool forwardKey = glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS;
+        if (backKey != forwardKey) {
+            if (!scrubbing)
+                scrubTarget = renderState.time;
+            scrubTarget = std::max(0.0, scrubTarget + (forwardKey ? 1.0 : -1.0) * 3652.5 * frameSeconds);
+            simulation.seek(scrubTarget);
+        }
+        scrubbing = backKey != forwardKey;
+        if (glfwGetKey(window, GLFW_KEY_HOME) == GLFW_PRESS)
+            simulation.seek(0.0);
+
+        // Events: N jumps to the next one, B to the previous one, and pauses there
+        bool nextKey = glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS;
+        bool previousKey = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS;
+        if ((nextKey || previousKey) && !eventKeyHeld && events.isOpen()) {
+            // A little past the current time, so repeated presses step past the event just shown
+            size_t k = nextKey ? events.next(renderState.time + 1e-6) : events.previous(renderState.time - 1e-3);
+            if (k < events.count()) {
+                const EventRecord& event = events.at(k);
+                simulation.seek(event.time);
+                rodar = false;
+                char dayText[32];
+                snprintf(dayText, sizeof(dayText), " (dia %.2f)", event.time);
+                eventText = events.describe(k) + dayText;
+                std::cout << eventText << std::endl;
             }
-        if (glfwGetKey(window, GLFW_KEY_4) == GLFW_PRESS or planetaSelecionado == 4) {
-            position = glm::vec3(x[3], 2, z[3] + 6.4);
-            planetaSelecionado = 4;
-
-            Info.Name = "Marte";
-            Info.OrbitSpeed = "24,13";
-            Info.Mass = "0.63345";
-            Info.Gravity = "0.38";
-
-            ShowInfo(programID2);
-
+        }
+        eventKeyHeld = nextKey || previousKey;
+
+        // O shows or hides the porkchop plot
+        bool porkchopKey = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+        if (porkchopKey && !porkchopKeyHeld && porkchopFrom >= 0 && porkchopTo >= 0) {
+            porkchopShown = !porkchopShown;
+            if (porkchopShown && !porkchopPending.valid()) {
+                porkchopStart = glfwGetTime();
+                porkchopText = "A calcular as janelas de " + bodies.porkchopFrom + " para " + bodies.porkchopTo + "...";
+                PorkchopSearch search = porkchopWindow(bodies, porkchopFrom, porkchopTo, renderState.time, renderState.time + bodies.porkchopDays);
+                porkchopPending = std::async(std::launch::async, [&bodies, &jobs, &porkchopGrid, porkchopFrom, porkchopTo, search]() {
+                    return computePorkchop(bodies, porkchopFrom, porkchopTo, search, porkchopGrid, &jobs);
+                });
             }
-        if (glfwGetKey(window, GLFW_KEY_5) == GLFW_PRESS or planetaSelecionado == 5) {
-            position = glm::vec3(x[4], 5.6, z[4] + 20.4);
-            planetaSelecionado = 5;
-
-            Info.Name = "Jupiter";
-            Info.OrbitSpeed = "13,07";
-            Info.Mass = "1876.64328";
-            Info.Gravity = "2.55";
-
-            ShowInfo(programID2);
-
-        }if (glfwGetKey(window, GLFW_KEY_6) == GLFW_PRESS or planetaSelecionado == 6) {
-
-            position = glm::vec3(x[5], 5.3, z[5] + 20.4);
-            planetaSelecionado = 6;
-
-            Info.Name = "Saturno";
-            Info.OrbitSpeed = "9,67";
-            Info.Mass = "561.80376";
-            Info.Gravity = "1.12";
-
-            ShowInfo(programID2);
-
         }
-        if (glfwGetKey(window, GLFW_KEY_7) == GLFW_PRESS or planetaSelecionado == 7) {
+        // A plot hidden while it was computed is dropped when it is done
+        if (porkchopPending.valid() && porkchopPending.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            const PorkchopGrid& grid = porkchopGrid;
+            if (porkchopPending.get() && porkchopShown && grid.best() < grid.deltaV.size()) {
+                size_t best = grid.best();
+                std::vector<unsigned char> rgba;
+                porkchopImage(grid, grid.deltaV[best] + 10.0f, rgba);
+                if (porkchopTextureID == 0)
+                    glGenTextures(1, &porkchopTextureID);
+                glBindTexture(GL_TEXTURE_2D, porkchopTextureID);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, (GLsizei)grid.departureCount, (GLsizei)grid.arrivalCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glBindTexture(GL_TEXTURE_2D, 0);
+
+                size_t d = best / grid.arrivalCount, a = best % grid.arrivalCount;
+                char text[160];
+                snprintf(text, sizeof(text), "%s - %s: %.2f km/s, partida dia %.0f, chegada dia %.0f (%.0f dias)",
+                    bodies.porkchopFrom.c_str(), bodies.porkchopTo.c_str(), grid.deltaV[best], grid.departure[d], grid.arrival[a], grid.flightTime(d, a));
+                porkchopText = text;
+                std::cout << "Porkchop " << porkchopText << " in " << (glfwGetTime() - porkchopStart) * 1000.0 << " ms" << std::endl;
+            }
+            else
+                porkchopShown = false;
+        }
+        porkchopKeyHeld = porkchopKey;
 
-            position = glm::vec3(x[6], 4.3, z[6] + 15.4);
-            planetaSelecionado = 7;
+        // Never waits for the simulation: uses whatever pair of steps was published last
+        const SimulationFrame& frame = simulation.latest();
+        float alpha = (float)((SimulationThread::now() - frame.stepTime) / simulation.getStepSeconds());
+        interpolateBodyStates(frame.previous, frame.current, glm::clamp(alpha, 0.0f, 1.0f), renderState);
 
-            Info.Name = "Urano";
-            Info.OrbitSpeed = "6,84";
-            Info.Mass = "86.05440";
-            Info.Gravity = "0.97";
 
-            ShowInfo(programID2);
+        Projection = getProjectionMatrix();
+        View = getViewMatrix();
+        frameUniforms.projection = Projection;
+        frameUniforms.view = View;
+        frameUniforms.viewPos = glm::vec4(getCameraPosition(), 1.0f);
+        frameUniforms.lightPos = glm::vec4(lightpos, 1.0f);
+        frameUniforms.lightColor = glm::vec4(lightcolor, 1.0f);
+        frameUniformBuffer->update(frameUniforms);
+
+        // Only spheres the camera can see are handed to the GPU (frustum.hpp)
+        glm::mat4 projectionView = Projection * View;
+        Frustum frustum = frustumFromMatrix(glm::value_ptr(projectionView));
+        cullSpheres(frustum, renderState.x.data(), renderState.y.data(), renderState.z.data(), bodies.radius.data(), 0.0f,
+                    bodies.size(), visibleBodies, &jobs);
+        litBodies.clear();
+        emissiveBodies.clear();
+        for (size_t k = 0; k < visibleBodies.count; k++) {
+            size_t i = visibleBodies.index[k];
+            (bodies.ambient[i] >= 1.0f ? emissiveBodies : litBodies).push_back(i);
+        }
 
+        // Every visible body is one instance, drawn with one call per shader variant
+        auto fillBatch = [&](BodyBatch& batch, const std::vector<size_t>& members) {
+            batch.resize(members.size());
+            jobs.parallelFor(0, members.size(), 1024, [&](size_t first, size_t last) {
+                for (size_t k = first; k < last; k++) {
+                    size_t i = members[k];
+                    glm::mat4 model = bodyModelMatrix(glm::vec3(renderState.x[i], renderState.y[i], renderState.z[i]), renderState.spin[i], bodies.radius[i]);
+                    batch.set(k, model, bodies.ambient[i], bodies.specular[i], bodies.shininess[i], bodies.textureLayer[i]);
+                }
+            });
+        };
+        fillBatch(*bodyBatch, litBodies);
+        fillBatch(*emissiveBatch, emissiveBodies);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, bodyTextureArrayID);
+        glUseProgram(emissiveProgramID);
+        emissiveBatch->Draw();
+        glUseProgram(instancedProgramID);
+        bodyBatch->Draw();
+
+        size_t particles = renderState.x.size() - bodies.size();
+        cullSpheres(frustum, renderState.x.data() + bodies.size(), renderState.y.data() + bodies.size(), renderState.z.data() + bodies.size(),
+                    NULL, bodies.beltRadius, particles, visibleParticles, &jobs);
+        particleBatch->resize(visibleParticles.count);
+        jobs.parallelFor(0, visibleParticles.count, 4096, [&](size_t first, size_t last) {
+            for (size_t k = first; k < last; k++) {
+                size_t i = bodies.size() + visibleParticles.index[k];
+                glm::mat4 model = bodyModelMatrix(glm::vec3(renderState.x[i], renderState.y[i], renderState.z[i]), 0.0f, bodies.beltRadius);
+                particleBatch->set(k, model, 0.5f, 0.0f, 1.0f, bodies.beltLayer);
+            }
+        });
+        particleBatch->Draw();
+
+
+
+        // Sky last, at the far plane: early-Z rejects every pixel a body already covered
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+        glUseProgram(skyboxProgramID);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTextureID);
+        glBindVertexArray(skyboxVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+
+        for (size_t i = 0; i < bodies.size(); i++) {
+            if (bodies.hotkey[i] > 0 && glfwGetKey(window, GLFW_KEY_0 + bodies.hotkey[i]) == GLFW_PRESS)
+                planetaSelecionado = (int)i;
         }
-        if (glfwGetKey(window, GLFW_KEY_8) == GLFW_PRESS or planetaSelecionado == 8) {
-            position = glm::vec3(x[7], 1.3, z[7] + 4.4);
-            planetaSelecionado = 8;
+        if (planetaSelecionado >= 0) {
+            int i = planetaSelecionado;
+            position = glm::vec3(renderState.x[i], renderState.y[i] + bodies.cameraHeight[i], renderState.z[i] + bodies.cameraDistance[i]);
 
-            Info.Name = "Neptuno";
-            Info.OrbitSpeed = "5,48";
-            Info.Mass = "101.59200";
-            Info.Gravity = "1.17";
+            Info.Name = bodies.name[i];
+            Info.OrbitSpeed = bodies.orbitSpeed[i];
+            Info.Mass = bodies.mass[i];
+            Info.Gravity = bodies.gravity[i];
 
             ShowInfo(programID2);
-
         }
         if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
-            planetaSelecionado = 0;
+            planetaSelecionado = -1;
+        }
+
+        char timeText[64];
+        snprintf(timeText, sizeof(timeText), "Ano %.2f (dia %.0f), x%g", renderState.time / 365.25, renderState.time, simulation.getWarp());
+        RenderText(programID2, timeText, 25.0f, 25.0f, 0.35f, glm::vec3(1.0f, 1.0f, 1.0f));
+        if (!eventText.empty())
+            RenderText(programID2, eventText, 25.0f, 45.0f, 0.35f, glm::vec3(1.0f, 1.0f, 1.0f));
+        if (porkchopShown) {
+            // Departure across, arrival up; only the text until the grid is done
+            if (!porkchopPending.valid())
+                RenderOverlay(overlayProgramID, porkchopTextureID, SCREEN_WIDTH - 425.0f, 25.0f, 400.0f, 400.0f);
+            RenderText(programID2, porkchopText, SCREEN_WIDTH - 425.0f, 435.0f, 0.3f, glm::vec3(1.0f, 1.0f, 1.0f));
         }
 
 
@@ -749,6 +802,19 @@ int main() {
 
     } while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && !glfwWindowShouldClose(window));
 
+    simulation.stop();
+    if (porkchopPending.valid())
+        porkchopPending.wait();
+    if (porkchopTextureID != 0)
+        glDeleteTextures(1, &porkchopTextureID);
+    bodyBatch.reset();
+    emissiveBatch.reset();
+    particleBatch.reset();
+    glDeleteTextures(1, &skyboxTextureID);
+    glDeleteBuffers(1, &skyboxVBO);
+    glDeleteVertexArrays(1, &skyboxVAO);
+    instancedPrograms.reset();
+    frameUniformBuffer.reset();
     cleanup();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,555 @@
+#include <stdio.h>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <random>
+
+#include "BodyTable.h"
+#include "kepler.hpp"
+#include "hierarchy.hpp"
+#include "jobSystem.hpp"
+#include "nbody.hpp"
+#include "ephemeris.hpp"
+#include "planetTheory.hpp"
+
+int BodyTable::find(const std::string& bodyName) const
+{
+	for (size_t i = 0; i < name.size(); i++)
+		if (name[i] == bodyName)
+			return (int)i;
+	return -1;
+}
+
+// Appends a body with default values, returns its index
+static size_t addBody(BodyTable& bodies, const std::string& bodyName)
+{
+	bodies.parent.push_back(-1);
+	bodies.semiMajorAxis.push_back(0.0);
+	bodies.eccentricity.push_back(0.0);
+	bodies.period.push_back(0.0);
+	bodies.meanMotion.push_back(0.0);
+	bodies.meanAnomaly0.push_back(0.0);
+	bodies.theory.push_back(std::shared_ptr<const PlanetTheory>());
+	bodies.theoryScale.push_back(1.0);
+
+	bodies.radius.push_back(1.0f);
+	bodies.spinRate.push_back(0.0f);
+	bodies.massKg.push_back(0.0);
+	bodies.textureLayer.push_back(0);
+	bodies.ambient.push_back(0.5f);
+	bodies.specular.push_back(0.1f);
+	bodies.shininess.push_back(0.4f * 128.0f);
+
+	bodies.localX.push_back(0.0);
+	bodies.localY.push_back(0.0);
+	bodies.localZ.push_back(0.0);
+	bodies.spin.push_back(0.0f);
+	bodies.x.push_back(0.0f);
+	bodies.y.push_back(0.0f);
+	bodies.z.push_back(0.0f);
+
+	bodies.name.push_back(bodyName);
+	bodies.hotkey.push_back(0);
+	bodies.cameraHeight.push_back(1.0f);
+	bodies.cameraDistance.push_back(5.0f);
+	bodies.orbitSpeed.push_back("");
+	bodies.mass.push_back("");
+	bodies.gravity.push_back("");
+
+	return bodies.name.size() - 1;
+}
+
+static int textureLayerFor(BodyTable& bodies, const std::string& path)
+{
+	for (size_t i = 0; i < bodies.texturePaths.size(); i++)
+		if (bodies.texturePaths[i] == path)
+			return (int)i;
+	bodies.texturePaths.push_back(path);
+	return (int)bodies.texturePaths.size() - 1;
+}
+
+template <typename T>
+static void permute(std::vector<T>& values, const std::vector<int>& order)
+{
+	std::vector<T> sorted;
+	sorted.reserve(values.size());
+	for (size_t k = 0; k < order.size(); k++)
+		sorted.push_back(values[order[k]]);
+	values.swap(sorted);
+}
+
+// Moves body order[k] to index k in every array and remaps parent indices
+static void reorderBodies(BodyTable& bodies, const std::vector<int>& order)
+{
+	std::vector<int> newIndex(order.size());
+	for (size_t k = 0; k < order.size(); k++)
+		newIndex[order[k]] = (int)k;
+
+	permute(bodies.parent, order);
+	for (size_t k = 0; k < bodies.parent.size(); k++)
+		if (bodies.parent[k] >= 0)
+			bodies.parent[k] = newIndex[bodies.parent[k]];
+
+	permute(bodies.semiMajorAxis, order);
+	permute(bodies.eccentricity, order);
+	permute(bodies.period, order);
+	permute(bodies.meanMotion, order);
+	permute(bodies.meanAnomaly0, order);
+	permute(bodies.theory, order);
+	permute(bodies.theoryScale, order);
+	permute(bodies.radius, order);
+	permute(bodies.spinRate, order);
+	permute(bodies.massKg, order);
+	permute(bodies.textureLayer, order);
+	permute(bodies.ambient, order);
+	permute(bodies.specular, order);
+	permute(bodies.shininess, order);
+	permute(bodies.localX, order);
+	permute(bodies.localY, order);
+	permute(bodies.localZ, order);
+	permute(bodies.spin, order);
+	permute(bodies.x, order);
+	permute(bodies.y, order);
+	permute(bodies.z, order);
+	permute(bodies.name, order);
+	permute(bodies.hotkey, order);
+	permute(bodies.cameraHeight, order);
+	permute(bodies.cameraDistance, order);
+	permute(bodies.orbitSpeed, order);
+	permute(bodies.mass, order);
+	permute(bodies.gravity, order);
+}
+
+// Reads one scene file into bodies; include lines read other files in place
+static bool parseScene(const char* path, BodyTable& bodies, std::vector<std::string>& parentNames, int depth)
+{
+	std::ifstream sceneStream(path, std::ios::in);
+	if (!sceneStream.is_open()) {
+		printf("Impossible to open %s. Are you in the right directory ?\n", path);
+		return false;
+	}
+
+	std::string line;
+	int lineNumber = 0;
+	int current = -1;
+	while (std::getline(sceneStream, line))
+	{
+		lineNumber++;
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream fields(line);
+		std::string key;
+		if (!(fields >> key))
+			continue;
+
+		bool ok = true;
+		if (key == "scale" && current < 0) {
+			ok = (bool)(fields >> bodies.sceneScale);
+		}
+		else if (key == "include" && current < 0) {
+			std::string includePath;
+			ok = (bool)(fields >> includePath) && depth < 8;
+			if (ok && !parseScene(includePath.c_str(), bodies, parentNames, depth + 1))
+				return false;
+		}
+		else if (key == "nbody" && current < 0) {
+			ok = (bool)(fields >> bodies.nbodyTheta >> bodies.nbodySoftening);
+			ok = ok && bodies.nbodyTheta >= 0.0 && bodies.nbodySoftening >= nbodyMinimumSoftening;
+			std::string mode;
+			if (fields >> mode) {
+				ok = ok && mode == "deterministic";
+				bodies.nbodyDeterministic = true;
+			}
+			bodies.nbody = true;
+		}
+		else if (key == "epoch" && current < 0) {
+			ok = (bool)(fields >> bodies.epoch);
+		}
+		else if (key == "tolerance" && current < 0) {
+			ok = (bool)(fields >> bodies.theoryTolerance) && bodies.theoryTolerance >= 0.0;
+		}
+		else if (key == "snapshots" && current < 0) {
+			ok = (bool)(fields >> bodies.snapshotInterval >> bodies.snapshotMegabytes) && bodies.snapshotInterval >= 0.0;
+			fields >> bodies.snapshotPath;
+		}
+		else if (key == "ephemeris" && current < 0) {
+			ok = (bool)(fields >> bodies.ephemerisPath);
+		}
+		else if (key == "events" && current < 0) {
+			ok = (bool)(fields >> bodies.eventsPath);
+		}
+		else if (key == "porkchop" && current < 0) {
+			ok = (bool)(fields >> bodies.porkchopFrom >> bodies.porkchopTo);
+			fields >> bodies.porkchopDays;
+			ok = ok && bodies.porkchopDays > 0.0;
+		}
+		else if (key == "belt" && current < 0) {
+			std::string texturePath;
+			ok = (bool)(fields >> bodies.beltCount >> bodies.beltInner >> bodies.beltOuter >> bodies.beltRadius >> texturePath);
+			ok = ok && bodies.beltInner > 0.0 && bodies.beltOuter >= bodies.beltInner;
+			if (ok)
+				bodies.beltLayer = textureLayerFor(bodies, texturePath);
+		}
+		else if (key == "body" && current < 0) {
+			std::string bodyName;
+			ok = (bool)(fields >> bodyName) && bodies.find(bodyName) < 0;
+			if (ok) {
+				current = (int)addBody(bodies, bodyName);
+				parentNames.push_back("");
+			}
+		}
+		else if (current < 0) {
+			ok = false;
+		}
+		else if (key == "end") {
+			current = -1;
+		}
+		else if (key == "parent") {
+			// Resolved once the whole file is read, parents may come later
+			ok = (bool)(fields >> parentNames[current]);
+		}
+		else if (key == "orbit") {
+			ok = (bool)(fields >> bodies.semiMajorAxis[current] >> bodies.eccentricity[current] >> bodies.period[current]);
+			ok = ok && bodies.eccentricity[current] >= 0.0 && bodies.eccentricity[current] < 1.0 && bodies.period[current] >= 0.0;
+			if (ok && bodies.period[current] > 0.0)
+				bodies.meanMotion[current] = 2.0 * M_PI / bodies.period[current];
+		}
+		else if (key == "anomaly") {
+			double degrees;
+			ok = (bool)(fields >> degrees);
+			bodies.meanAnomaly0[current] = degrees * M_PI / 180.0;
+		}
+		else if (key == "theory") {
+			// A missing data file is not fatal, the body keeps its Kepler orbit
+			std::string kind, theoryPath;
+			ok = (bool)(fields >> kind >> theoryPath) && (kind == "vsop87" || kind == "elp");
+			if (ok && kind == "vsop87") {
+				std::shared_ptr<Vsop87Theory> vsop87(new Vsop87Theory());
+				if (vsop87->load(theoryPath.c_str()))
+					bodies.theory[current] = vsop87;
+			}
+			else if (ok) {
+				std::shared_ptr<Elp82Theory> elp(new Elp82Theory());
+				if (elp->load(theoryPath)) {
+					bodies.theory[current] = elp;
+					bodies.theoryScale[current] = -1.0;     // scaled to the orbit once it is read
+				}
+			}
+		}
+		else if (key == "radius") {
+			ok = (bool)(fields >> bodies.radius[current]);
+		}
+		else if (key == "spin") {
+			ok = (bool)(fields >> bodies.spinRate[current]);
+		}
+		else if (key == "mass") {
+			ok = (bool)(fields >> bodies.massKg[current]) && bodies.massKg[current] >= 0.0;
+		}
+		else if (key == "texture") {
+			std::string texturePath;
+			ok = (bool)(fields >> texturePath);
+			if (ok)
+				bodies.textureLayer[current] = textureLayerFor(bodies, texturePath);
+		}
+		else if (key == "material") {
+			ok = (bool)(fields >> bodies.ambient[current] >> bodies.specular[current] >> bodies.shininess[current]);
+		}
+		else if (key == "key") {
+			ok = (bool)(fields >> bodies.hotkey[current]);
+		}
+		else if (key == "camera") {
+			ok = (bool)(fields >> bodies.cameraHeight[current] >> bodies.cameraDistance[current]);
+		}
+		else if (key == "info") {
+			ok = (bool)(fields >> bodies.orbitSpeed[current] >> bodies.mass[current] >> bodies.gravity[current]);
+		}
+		else {
+			ok = false;
+		}
+
+		if (!ok) {
+			printf("%s:%d: invalid scene line: %s\n", path, lineNumber, line.c_str());
+			return false;
+		}
+	}
+
+	if (current >= 0) {
+		printf("%s: body %s is missing its \"end\"\n", path, bodies.name[current].c_str());
+		return false;
+	}
+	return true;
+}
+
+bool loadBodyTable(const char* path, BodyTable& bodies)
+{
+	bodies = BodyTable();
+	std::vector<std::string> parentNames;
+	if (!parseScene(path, bodies, parentNames, 0))
+		return false;
+
+	if (bodies.texturePaths.empty()) {
+		printf("%s: the scene has no textured bodies\n", path);
+		return false;
+	}
+
+	for (size_t i = 0; i < bodies.size(); i++)
+		if (bodies.theoryScale[i] < 0.0)
+			bodies.theoryScale[i] = bodies.semiMajorAxis[i] > 0.0 ? bodies.semiMajorAxis[i] / bodies.theory[i]->meanDistance() : 1.0;
+
+	for (size_t i = 0; i < bodies.size(); i++) {
+		if (parentNames[i].empty())
+			continue;
+		bodies.parent[i] = bodies.find(parentNames[i]);
+		if (bodies.parent[i] < 0) {
+			printf("%s: body %s has an unknown parent %s\n", path, bodies.name[i].c_str(), parentNames[i].c_str());
+			return false;
+		}
+	}
+
+	std::vector<int> order;
+	if (!depthFirstOrder(bodies.parent, order)) {
+		printf("%s: the parent hierarchy has a cycle\n", path);
+		return false;
+	}
+	reorderBodies(bodies, order);
+	computeSubtreeEnds(bodies.parent, bodies.subtreeEnd);
+	independentSubtrees(bodies.parent, bodies.subtreeEnd, bodies.roots, bodies.branches);
+	return true;
+}
+
+void theoryPosition(const BodyTable& bodies, size_t i, double t, double& x, double& y, double& z)
+{
+	// Series theories work in the ecliptic, whose x, y and z become the scene's
+	// Z, X and Y: the same right-handed frame, with orbits in the XZ plane
+	double eclipticX, eclipticY, eclipticZ, scale = bodies.theoryScale[i];
+	bodies.theory[i]->position(bodies.epoch + t, bodies.theoryTolerance, eclipticX, eclipticY, eclipticZ);
+	x = eclipticY * scale;
+	y = eclipticZ * scale;
+	z = eclipticX * scale;
+}
+
+static void updateBodyRange(BodyTable& bodies, size_t first, size_t last, double t, double spinPerDay)
+{
+	propagateKepler(last - first, bodies.semiMajorAxis.data() + first, bodies.eccentricity.data() + first,
+		bodies.meanMotion.data() + first, bodies.meanAnomaly0.data() + first, t,
+		bodies.localX.data() + first, bodies.localZ.data() + first);
+
+	for (size_t i = first; i < last; i++)
+		if (bodies.theory[i])
+			theoryPosition(bodies, i, t, bodies.localX[i], bodies.localY[i], bodies.localZ[i]);
+
+	// Wrapped in double precision, a float accumulates visible jitter after a few simulated years
+	for (size_t i = first; i < last; i++)
+		bodies.spin[i] = (float)std::fmod(bodies.spinRate[i] * spinPerDay * t, 2.0 * M_PI);
+}
+
+static void composeBranches(BodyTable& bodies, size_t first, size_t last)
+{
+	for (size_t k = first; k < last; k++)
+	{
+		int branch = bodies.branches[k];
+		composeTransforms(bodies.parent.data(), branch, bodies.subtreeEnd[branch], bodies.sceneScale,
+			bodies.localX.data(), bodies.localY.data(), bodies.localZ.data(),
+			bodies.x.data(), bodies.y.data(), bodies.z.data());
+	}
+}
+
+void updateBodyTable(BodyTable& bodies, double t, double spinPerDay, JobSystem* jobs, const NBodySystem* dynamics,
+	const Ephemeris* ephemeris)
+{
+	const size_t count = bodies.size();
+
+	if (jobs != NULL)
+		jobs->parallelFor(0, count, 4096, [&](size_t first, size_t last) {
+			updateBodyRange(bodies, first, last, t, spinPerDay);
+		});
+	else
+		updateBodyRange(bodies, 0, count, t, spinPerDay);
+
+	// Fitted trajectories replace the orbits they cover; outside the file's
+	// span the analytic orbit is the better guess
+	if (ephemeris != NULL && !bodies.ephemerisIndex.empty()) {
+		for (size_t i = 0; i < count; i++)
+		{
+			int k = bodies.ephemerisIndex[i];
+			if (k >= 0 && !ephemeris->position(k, t, bodies.localX[i], bodies.localY[i], bodies.localZ[i]) && !bodies.theory[i])
+				bodies.localY[i] = 0.0;     // Kepler orbits lie in the XZ plane
+		}
+	}
+
+	// Integrated bodies: position relative to the parent, which is integrated too
+	if (dynamics != NULL) {
+		for (size_t i = 0; i < count; i++)
+		{
+			int k = bodies.nbodyIndex[i];
+			if (k < 0)
+				continue;
+			int p = bodies.parent[i] >= 0 ? bodies.nbodyIndex[bodies.parent[i]] : -1;
+			bodies.localX[i] = dynamics->x[k] - (p >= 0 ? dynamics->x[p] : 0.0);
+			bodies.localY[i] = dynamics->y[k] - (p >= 0 ? dynamics->y[p] : 0.0);
+			bodies.localZ[i] = dynamics->z[k] - (p >= 0 ? dynamics->z[p] : 0.0);
+		}
+	}
+
+	// Depth-first order: roots first, then every branch in one forward pass
+	// that always sees a parent's final position before its children
+	for (size_t k = 0; k < bodies.roots.size(); k++)
+	{
+		int root = bodies.roots[k];
+		composeTransforms(bodies.parent.data(), root, root + 1, bodies.sceneScale,
+			bodies.localX.data(), bodies.localY.data(), bodies.localZ.data(),
+			bodies.x.data(), bodies.y.data(), bodies.z.data());
+	}
+	if (jobs != NULL)
+		jobs->parallelFor(0, bodies.branches.size(), 64, [&](size_t first, size_t last) {
+			composeBranches(bodies, first, last);
+		});
+	else
+		composeBranches(bodies, 0, bodies.branches.size());
+}
+
+size_t bindEphemeris(BodyTable& bodies, const Ephemeris& ephemeris)
+{
+	size_t bound = 0;
+	bodies.ephemerisIndex.assign(bodies.size(), -1);
+	for (size_t i = 0; i < bodies.size(); i++)
+	{
+		int k = ephemeris.find(bodies.name[i]);
+		if (k < 0)
+			continue;
+		int recordParent = ephemeris.record(k).parent;
+		int p = bodies.parent[i];
+		if (p >= 0 ? (recordParent >= 0 && bodies.name[p] == ephemeris.record(recordParent).name) : recordParent < 0) {
+			bodies.ephemerisIndex[i] = k;
+			bound++;
+		}
+		else
+			printf("Ephemeris: %s orbits a different parent, using its orbit instead\n", bodies.name[i].c_str());
+	}
+	return bound;
+}
+
+void initBodyDynamics(BodyTable& bodies, double t, NBodySystem& system)
+{
+	const size_t count = bodies.size();
+	const double kgPerSolarMass = 1.98847e30;
+	system = NBodySystem();
+	system.theta = bodies.nbodyTheta;
+	system.softening = bodies.nbodySoftening;
+	system.deterministic = bodies.nbodyDeterministic;
+
+	std::vector<double> vx(count), vz(count);
+	propagateKepler(count, bodies.semiMajorAxis.data(), bodies.eccentricity.data(), bodies.meanMotion.data(),
+		bodies.meanAnomaly0.data(), t, bodies.localX.data(), bodies.localZ.data(), vx.data(), vz.data());
+
+	// Roots and their children, parents first thanks to the depth-first order
+	bodies.nbodyIndex.assign(count, -1);
+	for (size_t i = 0; i < count; i++)
+	{
+		int p = bodies.parent[i];
+		if (p >= 0 && bodies.parent[p] >= 0)
+			continue;
+		int k = p >= 0 ? bodies.nbodyIndex[p] : -1;
+		bodies.nbodyIndex[i] = (int)system.size();
+		system.add(bodies.localX[i] + (k >= 0 ? system.x[k] : 0.0), bodies.localY[i] + (k >= 0 ? system.y[k] : 0.0),
+			bodies.localZ[i] + (k >= 0 ? system.z[k] : 0.0), vx[i] + (k >= 0 ? system.vx[k] : 0.0),
+			(k >= 0 ? system.vy[k] : 0.0), vz[i] + (k >= 0 ? system.vz[k] : 0.0), bodies.massKg[i] / kgPerSolarMass);
+	}
+	bodies.nbodyBodies = system.size();
+	// The body table points at these, only the belt gets re-sorted
+	system.pinned = system.size();
+
+	// Belt on circular orbits around the first root, spread evenly over the
+	// annulus with a small vertical scatter; a main belt weighs ~4e-10 Msun
+	double centralMass = bodies.nbodyBodies > 0 ? system.mass[0] : 0.0;
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::normal_distribution<double> normal(0.0, 1.0);
+	const double particleMass = bodies.beltCount > 0 ? 4e-10 / bodies.beltCount : 0.0;
+	for (size_t n = 0; n < bodies.beltCount; n++)
+	{
+		double inner2 = bodies.beltInner * bodies.beltInner, outer2 = bodies.beltOuter * bodies.beltOuter;
+		double r = std::sqrt(inner2 + (outer2 - inner2) * uniform(random));
+		double angle = 2.0 * M_PI * uniform(random);
+		double x = r * std::sin(angle), z = r * std::cos(angle), y = 0.03 * r * normal(random);
+		// Counterclockwise seen from +Y, like the planets
+		double speed = std::sqrt(system.G * centralMass / r) * (1.0 + 0.01 * normal(random));
+		double cx = bodies.nbodyBodies > 0 ? system.x[0] : 0.0, cz = bodies.nbodyBodies > 0 ? system.z[0] : 0.0;
+		system.add(cx + x, y, cz + z, speed * z / r, 0.0, -speed * x / r, particleMass);
+	}
+
+	// Zero total momentum so the whole system does not drift off screen
+	double px = 0.0, py = 0.0, pz = 0.0, totalMass = 0.0;
+	for (size_t k = 0; k < system.size(); k++)
+	{
+		px += system.mass[k] * system.vx[k];
+		py += system.mass[k] * system.vy[k];
+		pz += system.mass[k] * system.vz[k];
+		totalMass += system.mass[k];
+	}
+	if (totalMass > 0.0) {
+		for (size_t k = 0; k < system.size(); k++)
+		{
+			system.vx[k] -= px / totalMass;
+			system.vy[k] -= py / totalMass;
+			system.vz[k] -= pz / totalMass;
+		}
+	}
+}
+
+void captureBodyState(const BodyTable& bodies, double t, BodyState& state, const NBodySystem* dynamics)
+{
+	state.time = t;
+	state.x = bodies.x;
+	state.y = bodies.y;
+	state.z = bodies.z;
+	state.spin = bodies.spin;
+
+	if (dynamics != NULL && dynamics->size() > bodies.nbodyBodies) {
+		const size_t first = bodies.nbodyBodies, particles = dynamics->size() - first;
+		const float scale = bodies.sceneScale;
+		state.x.resize(bodies.size() + particles);
+		state.y.resize(bodies.size() + particles);
+		state.z.resize(bodies.size() + particles);
+		state.spin.resize(bodies.size() + particles, 0.0f);
+		// In the order the particles were added, so states stay comparable
+		// across re-sorts of the system
+		for (size_t k = 0; k < particles; k++)
+		{
+			size_t i = dynamics->slot[first + k];
+			state.x[bodies.size() + k] = (float)dynamics->x[i] * scale;
+			state.y[bodies.size() + k] = (float)dynamics->y[i] * scale;
+			state.z[bodies.size() + k] = (float)dynamics->z[i] * scale;
+		}
+	}
+}
+
+void interpolateBodyStates(const BodyState& previous, const BodyState& current, float alpha, BodyState& out)
+{
+	const size_t count = current.x.size();
+	out.time = previous.time + (current.time - previous.time) * alpha;
+	out.x.resize(count);
+	out.y.resize(count);
+	out.z.resize(count);
+	out.spin.resize(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		out.x[i] = previous.x[i] + (current.x[i] - previous.x[i]) * alpha;
+		out.y[i] = previous.y[i] + (current.y[i] - previous.y[i]) * alpha;
+		out.z[i] = previous.z[i] + (current.z[i] - previous.z[i]) * alpha;
+
+		// Spins are wrapped to [0, 2pi), so take the short way around
+		float delta = current.spin[i] - previous.spin[i];
+		if (delta > (float)M_PI)
+			delta -= (float)(2.0 * M_PI);
+		else if (delta < (float)-M_PI)
+			delta += (float)(2.0 * M_PI);
+		out.spin[i] = previous.spin[i] + delta * alpha;
+	}
+}
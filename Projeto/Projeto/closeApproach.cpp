@@ -0,0 +1,380 @@
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+
+#include "closeApproach.hpp"
+#include "BodyTable.h"
+#include "kepler.hpp"
+#include "jobSystem.hpp"
+
+// Intervals per job: the sweep order is sorted from scratch once per job and
+// only patched up between the intervals inside it
+static const size_t chunkIntervals = 64;
+
+// Bodies whose bound is over this many times the median one (planets and
+// moons among a catalog) are kept out of the slabs and looked up in them
+static const double wideBound = 2.0;
+
+// Samples of d/dt |r|^2 per shortest period in the pair's hierarchy, so
+// there is at most one minimum between two samples
+static const double samplesPerPeriod = 16.0;
+
+// Position and velocity of body i relative to the roots, AU and AU/day
+static void worldState(const BodyTable& bodies, int i, double t, double& x, double& z, double& vx, double& vz)
+{
+	x = z = vx = vz = 0.0;
+	for (; i >= 0; i = bodies.parent[i])
+	{
+		double bx, bz, bvx, bvz;
+		propagateKepler(1, &bodies.semiMajorAxis[i], &bodies.eccentricity[i], &bodies.meanMotion[i],
+			&bodies.meanAnomaly0[i], t, &bx, &bz, &bvx, &bvz);
+		x += bx;
+		z += bz;
+		vx += bvx;
+		vz += bvz;
+	}
+}
+
+// Half the derivative of the squared distance: negative while closing in
+static double closingRate(const BodyTable& bodies, int i, int j, double t)
+{
+	double xi, zi, vxi, vzi, xj, zj, vxj, vzj;
+	worldState(bodies, i, t, xi, zi, vxi, vzi);
+	worldState(bodies, j, t, xj, zj, vxj, vzj);
+	return (xi - xj) * (vxi - vxj) + (zi - zj) * (vzi - vzj);
+}
+
+// World positions and velocities of every body at one date
+struct Frame
+{
+	std::vector<double> x, z, vx, vz;
+	std::vector<double> localX, localZ, localVX, localVZ;
+
+	void evaluate(const BodyTable& bodies, double t)
+	{
+		const size_t n = bodies.size();
+		x.resize(n);
+		z.resize(n);
+		vx.resize(n);
+		vz.resize(n);
+		localX.resize(n);
+		localZ.resize(n);
+		localVX.resize(n);
+		localVZ.resize(n);
+		propagateKepler(n, bodies.semiMajorAxis.data(), bodies.eccentricity.data(), bodies.meanMotion.data(),
+			bodies.meanAnomaly0.data(), t, localX.data(), localZ.data(), localVX.data(), localVZ.data());
+		for (size_t i = 0; i < n; i++)
+		{
+			int p = bodies.parent[i];
+			x[i] = localX[i] + (p >= 0 ? x[p] : 0.0);
+			z[i] = localZ[i] + (p >= 0 ? z[p] : 0.0);
+			vx[i] = localVX[i] + (p >= 0 ? vx[p] : 0.0);
+			vz[i] = localVZ[i] + (p >= 0 ? vz[p] : 0.0);
+		}
+	}
+};
+
+// Width of the middle 80% of values, which leaves out the outer planets
+static double middleRange(std::vector<double> values)
+{
+	size_t low = values.size() / 10, high = values.size() - 1 - values.size() / 10;
+	std::nth_element(values.begin(), values.begin() + low, values.end());
+	double first = values[low];
+	std::nth_element(values.begin(), values.begin() + high, values.end());
+	return values[high] - first;
+}
+
+// A body in the sweep: its interval along X and what the pair tests need
+struct Slot
+{
+	double lo, hi, x, z, vx, vz, bound, strongest;
+	int body;
+};
+
+// Minima of the distance between i and j in (begin, end]
+static void refinePair(const BodyTable& bodies, int i, int j, double begin, double end, double shortestPeriod,
+	double distance, std::vector<CloseApproach>& found)
+{
+	int samples = std::max(1, (int)std::ceil((end - begin) * samplesPerPeriod / shortestPeriod));
+	double a = begin, ga = closingRate(bodies, i, j, a);
+	for (int s = 1; s <= samples; s++)
+	{
+		double b = s == samples ? end : begin + (end - begin) * s / samples;
+		double gb = closingRate(bodies, i, j, b);
+		if (ga < 0.0 && gb >= 0.0) {
+			// Illinois false position: keeps the bracket, converges like the secant
+			double lo = a, glo = ga, hi = b, ghi = gb, t = b;
+			int side = 0;
+			for (int iteration = 0; iteration < 60 && hi - lo > 1e-9; iteration++)
+			{
+				t = (lo * ghi - hi * glo) / (ghi - glo);
+				double g = closingRate(bodies, i, j, t);
+				if (g < 0.0) {
+					lo = t;
+					glo = g;
+					if (side == -1)
+						ghi *= 0.5;
+					side = -1;
+				}
+				else {
+					hi = t;
+					ghi = g;
+					if (side == 1)
+						glo *= 0.5;
+					side = 1;
+				}
+			}
+
+			double xi, zi, vxi, vzi, xj, zj, vxj, vzj;
+			worldState(bodies, i, t, xi, zi, vxi, vzi);
+			worldState(bodies, j, t, xj, zj, vxj, vzj);
+			double d = std::sqrt((xi - xj) * (xi - xj) + (zi - zj) * (zi - zj));
+			if (d <= distance) {
+				CloseApproach approach;
+				approach.first = std::min(i, j);
+				approach.second = std::max(i, j);
+				approach.time = t;
+				approach.distance = d;
+				approach.speed = std::sqrt((vxi - vxj) * (vxi - vxj) + (vzi - vzj) * (vzi - vzj));
+				found.push_back(approach);
+			}
+		}
+		a = b;
+		ga = gb;
+	}
+}
+
+// Fastest speed and strongest acceleration on each orbit (both at periapsis,
+// GM = n^2 a^3, plus the parents') and shortest period up its hierarchy, the
+// time scale on which a pair's distance can turn around. Returns the median
+// of the speeds.
+static double orbitBounds(const BodyTable& bodies, std::vector<double>& fastest, std::vector<double>& strongest,
+	std::vector<double>& shortestPeriod)
+{
+	const size_t n = bodies.size();
+	fastest.resize(n);
+	strongest.resize(n);
+	shortestPeriod.resize(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		double a = bodies.semiMajorAxis[i], e = bodies.eccentricity[i], motion = bodies.meanMotion[i];
+		int p = bodies.parent[i];
+		fastest[i] = motion * a * std::sqrt((1.0 + e) / (1.0 - e)) + (p >= 0 ? fastest[p] : 0.0);
+		strongest[i] = (a > 0.0 ? motion * motion * a / ((1.0 - e) * (1.0 - e)) : 0.0) + (p >= 0 ? strongest[p] : 0.0);
+		shortestPeriod[i] = p >= 0 ? shortestPeriod[p] : HUGE_VAL;
+		if (bodies.period[i] > 0.0)
+			shortestPeriod[i] = std::min(shortestPeriod[i], bodies.period[i]);
+	}
+	std::vector<double> speeds(fastest);
+	std::nth_element(speeds.begin(), speeds.begin() + n / 2, speeds.end());
+	return speeds[n / 2];
+}
+
+// Narrower bounds than the spacing would only add intervals, the broadphase
+// passes few pairs either way
+double approachInterval(const BodyTable& bodies, const ApproachSearch& search)
+{
+	const size_t n = bodies.size();
+	if (n == 0)
+		return search.end - search.begin;
+	std::vector<double> fastest, strongest, shortestPeriod;
+	double medianSpeed = orbitBounds(bodies, fastest, strongest, shortestPeriod);
+	Frame start;
+	start.evaluate(bodies, search.begin);
+	double spacing = std::sqrt(middleRange(start.x) * middleRange(start.z) / n);
+	return medianSpeed > 0.0 ? 2.0 * std::max(search.distance, 0.5 * spacing) / medianSpeed : search.end - search.begin;
+}
+
+size_t findCloseApproaches(const BodyTable& bodies, const ApproachSearch& search, std::vector<CloseApproach>& out,
+	JobSystem* jobs)
+{
+	out.clear();
+	const size_t n = bodies.size();
+	const double span = search.end - search.begin;
+	if (n < 2 || span <= 0.0)
+		return 0;
+
+	std::vector<double> fastest, strongest, shortestPeriod;
+	const double medianSpeed = orbitBounds(bodies, fastest, strongest, shortestPeriod);
+	double interval = search.interval > 0.0 ? search.interval : approachInterval(bodies, search);
+	interval = std::min(interval, span);
+	const size_t intervals = (size_t)std::ceil(span / interval);
+
+	// Bound of each body over an interval: a circle around its position at the
+	// middle. Slabs along Z are tall enough that two narrow bodies close enough
+	// to matter are in the same slab or in neighbouring ones.
+	std::vector<double> bound(n);
+	std::vector<int> narrow, wide;
+	double widest = 0.0;
+	for (size_t i = 0; i < n; i++)
+	{
+		bound[i] = fastest[i] * interval * 0.5;
+		if (bound[i] > wideBound * medianSpeed * interval * 0.5) {
+			wide.push_back((int)i);
+			continue;
+		}
+		narrow.push_back((int)i);
+		widest = std::max(widest, bound[i]);
+	}
+	const double slabHeight = 2.0 * widest + search.distance;
+
+	std::mutex outMutex;
+	size_t candidates = 0;
+	auto run = [&](size_t firstInterval, size_t lastInterval) {
+		Frame frame;
+		std::vector<int> order(narrow), slab(n);
+		std::vector<size_t> slabStart, next;
+		// Bodies in sweep order, the narrow ones slab by slab then the wide ones
+		std::vector<Slot> slots(n);
+		std::vector<CloseApproach> found;
+		size_t tested = 0;
+
+		for (size_t s = firstInterval; s < lastInterval; s++)
+		{
+			double begin = search.begin + span * s / intervals;
+			double end = s + 1 == intervals ? search.end : search.begin + span * (s + 1) / intervals;
+			double half = 0.5 * (end - begin);
+			frame.evaluate(bodies, begin + half);
+			auto place = [&](Slot& slot, int i) {
+				slot.lo = frame.x[i] - bound[i];
+				slot.hi = frame.x[i] + bound[i] + search.distance;
+				slot.x = frame.x[i];
+				slot.z = frame.z[i];
+				slot.vx = frame.vx[i];
+				slot.vz = frame.vz[i];
+				slot.bound = bound[i];
+				slot.strongest = strongest[i];
+				slot.body = i;
+			};
+
+			// Circles in reach, then the closest point of the straight relative
+			// motion over the interval; the orbits bend away from it by at most
+			// a t^2 / 2. Pairs left are handed to the root finder.
+			auto test = [&](const Slot& p, const Slot& q) {
+				double dx = p.x - q.x, dz = p.z - q.z;
+				double reach = p.bound + q.bound + search.distance;
+				if (std::fabs(dz) > reach || dx * dx + dz * dz > reach * reach)
+					return;
+				double dvx = p.vx - q.vx, dvz = p.vz - q.vz;
+				double v2 = dvx * dvx + dvz * dvz;
+				double tau = v2 > 0.0 ? std::max(-half, std::min(half, -(dx * dvx + dz * dvz) / v2)) : 0.0;
+				double bend = 0.5 * (p.strongest + q.strongest) * half * half;
+				double lx = dx + dvx * tau, lz = dz + dvz * tau;
+				if (lx * lx + lz * lz > (search.distance + bend) * (search.distance + bend))
+					return;
+				int i = std::min(p.body, q.body), j = std::max(p.body, q.body);
+				// j inside i's subtree: a moon and one of its parents
+				if (j < bodies.subtreeEnd[i])
+					return;
+				tested++;
+				refinePair(bodies, i, j, begin, end, std::min(shortestPeriod[i], shortestPeriod[j]), search.distance,
+					found);
+			};
+
+			// Counting sort into slabs, taking the bodies in the last interval's
+			// order: within a slab they stay nearly sorted along X
+			double zMin = HUGE_VAL, zMax = -HUGE_VAL;
+			for (size_t k = 0; k < narrow.size(); k++)
+			{
+				zMin = std::min(zMin, frame.z[narrow[k]]);
+				zMax = std::max(zMax, frame.z[narrow[k]]);
+			}
+			// Taller when a few far bodies would make most slabs empty
+			double height = std::max(slabHeight, (zMax - zMin) / std::max<size_t>(narrow.size(), 1));
+			size_t slabs = narrow.empty() ? 0 : (size_t)((zMax - zMin) / height) + 1;
+			slabStart.assign(slabs + 1, 0);
+			for (size_t k = 0; k < order.size(); k++)
+			{
+				slab[k] = (int)((frame.z[order[k]] - zMin) / height);
+				slabStart[slab[k] + 1]++;
+			}
+			for (size_t b = 0; b < slabs; b++)
+				slabStart[b + 1] += slabStart[b];
+			next.assign(slabStart.begin(), slabStart.end() - 1);
+			for (size_t k = 0; k < order.size(); k++)
+				place(slots[next[slab[k]]++], order[k]);
+			for (size_t k = order.size(); k < n; k++)
+				place(slots[k], wide[k - order.size()]);
+
+			// Sweep and prune along X in each slab. The first interval of the
+			// job is sorted, later ones only move a few bodies each.
+			for (size_t b = 0; b < slabs; b++)
+			{
+				Slot* first = slots.data() + slabStart[b];
+				Slot* last = slots.data() + slabStart[b + 1];
+				if (s == firstInterval)
+					std::sort(first, last, [](const Slot& p, const Slot& q) { return p.lo < q.lo; });
+				else
+					for (Slot* k = first + 1; k < last; k++)
+					{
+						if (k[-1].lo <= k->lo)
+							continue;
+						Slot moving = *k;
+						Slot* m = k;
+						for (; m > first && m[-1].lo > moving.lo; m--)
+							*m = m[-1];
+						*m = moving;
+					}
+			}
+			for (size_t k = 0; k < order.size(); k++)
+				order[k] = slots[k].body;
+
+			for (size_t b = 0; b < slabs; b++)
+			{
+				size_t end0 = slabStart[b + 1];
+				for (size_t k = slabStart[b]; k < end0; k++)
+					for (size_t m = k + 1; m < end0 && slots[m].lo <= slots[k].hi; m++)
+						test(slots[k], slots[m]);
+				if (b + 1 == slabs)
+					continue;
+				// Against the slab above: merge the two sorted runs, each
+				// body meets those of the other run that start inside it
+				size_t k = slabStart[b], m = slabStart[b + 1], end1 = slabStart[b + 2];
+				while (k < end0 && m < end1)
+				{
+					if (slots[k].lo <= slots[m].lo) {
+						for (size_t j = m; j < end1 && slots[j].lo <= slots[k].hi; j++)
+							test(slots[k], slots[j]);
+						k++;
+					}
+					else {
+						for (size_t j = k; j < end0 && slots[j].lo <= slots[m].hi; j++)
+							test(slots[m], slots[j]);
+						m++;
+					}
+				}
+			}
+
+			// The few wide bodies against the slabs they reach, and each other
+			for (size_t w = order.size(); w < n; w++)
+			{
+				const Slot& p = slots[w];
+				double reach = p.bound + widest + search.distance;
+				size_t firstSlab = (size_t)std::max(0.0, std::floor((p.z - reach - zMin) / height));
+				size_t lastSlab = (size_t)std::max(0.0, std::floor((p.z + reach - zMin) / height));
+				for (size_t b = firstSlab; b < std::min(lastSlab + 1, slabs); b++)
+				{
+					const Slot* k = std::lower_bound(slots.data() + slabStart[b], slots.data() + slabStart[b + 1],
+						p.x - reach - widest, [](const Slot& q, double lo) { return q.lo < lo; });
+					for (; k < slots.data() + slabStart[b + 1] && k->lo <= p.hi; k++)
+						test(p, *k);
+				}
+				for (size_t v = w + 1; v < n; v++)
+					test(p, slots[v]);
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(outMutex);
+		out.insert(out.end(), found.begin(), found.end());
+		candidates += tested;
+	};
+	if (jobs != NULL)
+		jobs->parallelFor(0, intervals, chunkIntervals, run);
+	else
+		run(0, intervals);
+
+	std::sort(out.begin(), out.end(), [](const CloseApproach& a, const CloseApproach& b) {
+		return a.time != b.time ? a.time < b.time : a.first != b.first ? a.first < b.first : a.second < b.second;
+	});
+	return candidates;
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ephemeris.hpp"
+
+static const char ephemerisMagic[8] = { 'P', 'R', 'J', 'E', 'P', 'H', '0', '1' };
+
+Ephemeris::Ephemeris() : header(NULL), records(NULL) {}
+
+Ephemeris::~Ephemeris()
+{
+	close();
+}
+
+bool Ephemeris::open(const char* path)
+{
+	close();
+	if (!file.open(path, sizeof(EphemerisHeader)))
+		return false;
+
+	// Check every record against the file size once, lookups trust them afterwards
+	const unsigned char* data = file.data();
+	size_t bytes = file.size();
+	header = (const EphemerisHeader*)data;
+	records = (const EphemerisRecord*)(data + sizeof(EphemerisHeader));
+	bool ok = memcmp(header->magic, ephemerisMagic, sizeof(ephemerisMagic)) == 0 && header->endDay > header->startDay &&
+		sizeof(EphemerisHeader) + (uint64_t)header->bodyCount * sizeof(EphemerisRecord) <= bytes;
+	for (uint32_t i = 0; ok && i < header->bodyCount; i++)
+	{
+		const EphemerisRecord& body = records[i];
+		uint64_t blockBytes = 3ull * body.coefficients * sizeof(double);
+		ok = body.coefficients > 0 && body.intervalCount > 0 && body.intervalDays > 0.0 && body.parent < (int32_t)i &&
+			body.name[sizeof(body.name) - 1] == '\0' && body.offset % sizeof(double) == 0 &&
+			body.offset <= bytes && blockBytes * body.intervalCount <= bytes - body.offset;
+	}
+	if (!ok) {
+		printf("%s: not a valid ephemeris file\n", path);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void Ephemeris::close()
+{
+	file.close();
+	header = NULL;
+	records = NULL;
+}
+
+int Ephemeris::find(const std::string& bodyName) const
+{
+	for (size_t i = 0; i < bodyCount(); i++)
+		if (bodyName == records[i].name)
+			return (int)i;
+	return -1;
+}
+
+// Clenshaw recurrence for sum(c[j] * T_j(u)), j = 0..n-1
+static double chebyshev(const double* c, unsigned n, double u)
+{
+	double b1 = 0.0, b2 = 0.0, twoU = 2.0 * u;
+	for (unsigned j = n - 1; j > 0; j--)
+	{
+		double b0 = twoU * b1 - b2 + c[j];
+		b2 = b1;
+		b1 = b0;
+	}
+	return c[0] + u * b1 - b2;
+}
+
+bool Ephemeris::position(size_t body, double t, double& x, double& y, double& z) const
+{
+	if (t < header->startDay || t > header->endDay)
+		return false;
+
+	const EphemerisRecord& record = records[body];
+	double intervals = (t - header->startDay) / record.intervalDays;
+	uint32_t k = (uint32_t)intervals;
+	if (k >= record.intervalCount)
+		k = record.intervalCount - 1;
+
+	// Interval time mapped to [-1, 1], the domain of the series
+	double u = 2.0 * (intervals - k) - 1.0;
+	const unsigned n = record.coefficients;
+	const double* block = (const double*)(file.data() + record.offset) + (size_t)k * 3 * n;
+	x = chebyshev(block, n, u);
+	y = chebyshev(block + n, n, u);
+	z = chebyshev(block + 2 * n, n, u);
+	return true;
+}
+
+// One sampling date: which body, and where its sample goes
+struct SampleRequest
+{
+	double t;
+	uint32_t body;
+	uint32_t slot;                  // interval * coefficients + node
+};
+
+bool writeEphemeris(const char* path, const std::vector<EphemerisBody>& bodies, double startDay, double endDay,
+	EphemerisSource& source)
+{
+	const size_t count = bodies.size();
+	if (endDay <= startDay)
+		return false;
+
+	std::vector<EphemerisRecord> records(count);
+	uint64_t offset = sizeof(EphemerisHeader) + count * sizeof(EphemerisRecord);
+	for (size_t i = 0; i < count; i++)
+	{
+		EphemerisRecord& record = records[i];
+		memset(&record, 0, sizeof(record));
+		memcpy(record.name, bodies[i].name.c_str(), std::min(bodies[i].name.size(), sizeof(record.name) - 1));
+		record.parent = bodies[i].parent;
+		record.coefficients = std::max(bodies[i].coefficients, 1u);
+		// Whole intervals, the last one may run past endDay
+		record.intervalDays = std::min(bodies[i].intervalDays, endDay - startDay);
+		record.intervalCount = (uint32_t)std::ceil((endDay - startDay) / record.intervalDays - 1e-9);
+		record.offset = offset;
+		offset += (uint64_t)record.intervalCount * 3 * record.coefficients * sizeof(double);
+	}
+
+	// The Chebyshev nodes of every interval of every body, in time order, so
+	// the source is only ever asked to move forward
+	std::vector<SampleRequest> requests;
+	std::vector<std::vector<double> > samples(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const EphemerisRecord& record = records[i];
+		const unsigned n = record.coefficients;
+		samples[i].resize((size_t)record.intervalCount * 3 * n);
+		for (uint32_t k = 0; k < record.intervalCount; k++)
+		{
+			double middle = startDay + (k + 0.5) * record.intervalDays;
+			for (unsigned node = 0; node < n; node++)
+			{
+				SampleRequest request;
+				request.t = middle + 0.5 * record.intervalDays * std::cos(M_PI * (node + 0.5) / n);
+				request.body = (uint32_t)i;
+				request.slot = k * n + node;
+				requests.push_back(request);
+			}
+		}
+	}
+	std::sort(requests.begin(), requests.end(), [](const SampleRequest& a, const SampleRequest& b) { return a.t < b.t; });
+
+	std::vector<double> x(count), y(count), z(count);
+	double sampledAt = 0.0;
+	for (size_t r = 0; r < requests.size(); r++)
+	{
+		const SampleRequest& request = requests[r];
+		if (r == 0 || request.t != sampledAt) {
+			source.sample(request.t, x.data(), y.data(), z.data());
+			sampledAt = request.t;
+		}
+		// Samples are kept per interval as x nodes, y nodes, z nodes, the
+		// coefficient layout of the file
+		const unsigned n = records[request.body].coefficients;
+		double* block = samples[request.body].data() + (size_t)(request.slot / n) * 3 * n;
+		block[request.slot % n] = x[request.body];
+		block[n + request.slot % n] = y[request.body];
+		block[2 * n + request.slot % n] = z[request.body];
+	}
+
+	FILE* out = fopen(path, "wb");
+	if (out == NULL) {
+		printf("Impossible to write %s\n", path);
+		return false;
+	}
+
+	EphemerisHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ephemerisMagic, sizeof(ephemerisMagic));
+	header.bodyCount = (uint32_t)count;
+	header.startDay = startDay;
+	header.endDay = endDay;
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	if (count > 0)
+		ok = ok && fwrite(records.data(), sizeof(EphemerisRecord), count, out) == count;
+
+	// Discrete cosine transform of the node samples:
+	// c_j = 2/n * sum f_k cos(pi j (k + 1/2) / n), with c_0 halved
+	std::vector<double> coefficients;
+	for (size_t i = 0; ok && i < count; i++)
+	{
+		const unsigned n = records[i].coefficients;
+		coefficients.resize(samples[i].size());
+		for (size_t block = 0; block < samples[i].size(); block += n)
+		{
+			const double* f = samples[i].data() + block;
+			for (unsigned j = 0; j < n; j++)
+			{
+				double sum = 0.0;
+				for (unsigned node = 0; node < n; node++)
+					sum += f[node] * std::cos(M_PI * j * (node + 0.5) / n);
+				coefficients[block + j] = (j == 0 ? 1.0 : 2.0) * sum / n;
+			}
+		}
+		ok = fwrite(coefficients.data(), sizeof(double), coefficients.size(), out) == coefficients.size();
+	}
+
+	ok = fclose(out) == 0 && ok;
+	if (!ok)
+		printf("Impossible to write %s\n", path);
+	return ok;
+}
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "events.hpp"
+#include "BodyTable.h"
+#include "orbits.hpp"
+#include "jobSystem.hpp"
+
+static const char eventMagic[8] = { 'P', 'R', 'J', 'E', 'V', 'T', '0', '1' };
+
+// Samples per job
+static const size_t blockSamples = 4096;
+
+// Contacts are looked for at most this many steps away from the greatest phase
+static const int maxContactSteps = 100000;
+
+const char* eventKindName(uint32_t kind)
+{
+	// The HUD font only has ASCII
+	static const char* names[] = { "Eclipse solar", "Eclipse lunar", "Transito", "Ocultacao", "Oposicao" };
+	return kind <= eventOpposition ? names[kind] : "Evento";
+}
+
+// One thing to look for: kind as seen from observer, front over back
+struct Watch
+{
+	uint32_t kind;
+	int observer, front, back;
+};
+
+static int rootOf(const BodyTable& bodies, int i)
+{
+	while (bodies.parent[i] >= 0)
+		i = bodies.parent[i];
+	return i;
+}
+
+static std::vector<Watch> watchList(const BodyTable& bodies, int observer)
+{
+	std::vector<Watch> watches;
+	for (int i = 0; i < (int)bodies.size(); i++)
+	{
+		int p = bodies.parent[i];
+		if (p < 0 || bodies.parent[p] < 0)
+			continue;
+		int sun = rootOf(bodies, p);
+		watches.push_back({ eventSolarEclipse, p, i, sun });
+		watches.push_back({ eventLunarEclipse, i, p, sun });
+	}
+	if (observer < 0)
+		return watches;
+
+	int sun = rootOf(bodies, observer);
+	for (int j = 0; j < (int)bodies.size(); j++)
+	{
+		if (bodies.parent[j] != sun || j == observer)
+			continue;
+		watches.push_back({ eventTransit, observer, j, sun });
+		watches.push_back({ eventOpposition, observer, j, sun });
+		// The observer's moons and the other planets in front of this one
+		for (int f = 0; f < (int)bodies.size(); f++)
+			if (f != j && f != observer && (bodies.parent[f] == sun || bodies.parent[f] == observer))
+				watches.push_back({ eventOccultation, observer, f, j });
+	}
+	return watches;
+}
+
+// Geometry of a watch at one date. gap is the angular separation of the
+// centres minus both angular radii: negative while the discs overlap. For
+// oppositions it is the sine of the difference in longitude (in the XZ
+// plane) from exactly opposite, with opposite telling which side it is on.
+struct Sky
+{
+	double gap, separation, frontRadius, backRadius, frontDistance, backDistance;
+	bool opposite;
+};
+
+static double length(const double* v)
+{
+	return std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+static Sky look(const BodyTable& bodies, const Watch& watch, const double* o, const double* f, const double* b)
+{
+	double toFront[3] = { f[0] - o[0], f[1] - o[1], f[2] - o[2] };
+	double toBack[3] = { b[0] - o[0], b[1] - o[1], b[2] - o[2] };
+	Sky sky;
+	sky.frontDistance = length(toFront);
+	sky.backDistance = length(toBack);
+	double cross[3] = { toFront[1] * toBack[2] - toFront[2] * toBack[1], toFront[2] * toBack[0] - toFront[0] * toBack[2],
+		toFront[0] * toBack[1] - toFront[1] * toBack[0] };
+	double dot = toFront[0] * toBack[0] + toFront[1] * toBack[1] + toFront[2] * toBack[2];
+	sky.separation = std::atan2(length(cross), dot);
+
+	if (watch.kind == eventOpposition) {
+		double planar = std::sqrt(toFront[0] * toFront[0] + toFront[2] * toFront[2]) *
+			std::sqrt(toBack[0] * toBack[0] + toBack[2] * toBack[2]);
+		sky.gap = planar > 0.0 ? cross[1] / planar : 0.0;
+		sky.opposite = toFront[0] * toBack[0] + toFront[2] * toBack[2] < 0.0;
+		sky.frontRadius = sky.backRadius = 0.0;
+		return sky;
+	}
+	double scale = 1.0 / bodies.sceneScale;
+	sky.frontRadius = std::asin(std::min(1.0, bodies.radius[watch.front] * scale / sky.frontDistance));
+	sky.backRadius = std::asin(std::min(1.0, bodies.radius[watch.back] * scale / sky.backDistance));
+	sky.gap = sky.separation - sky.frontRadius - sky.backRadius;
+	sky.opposite = false;
+	return sky;
+}
+
+static Sky lookAt(const BodyTable& bodies, const Watch& watch, double t, const Ephemeris* ephemeris)
+{
+	double o[3], f[3], b[3];
+	bodyPosition(bodies, watch.observer, t, o[0], o[1], o[2], ephemeris);
+	bodyPosition(bodies, watch.front, t, f[0], f[1], f[2], ephemeris);
+	bodyPosition(bodies, watch.back, t, b[0], b[1], b[2], ephemeris);
+	return look(bodies, watch, o, f, b);
+}
+
+// Date in [inside, outside] (either order) where the gap crosses zero
+static double contact(const BodyTable& bodies, const Watch& watch, double inside, double outside,
+	const Ephemeris* ephemeris)
+{
+	for (int iteration = 0; iteration < 48; iteration++)
+	{
+		double middle = 0.5 * (inside + outside);
+		if (lookAt(bodies, watch, middle, ephemeris).gap < 0.0)
+			inside = middle;
+		else
+			outside = middle;
+	}
+	return 0.5 * (inside + outside);
+}
+
+// The minimum of the gap in [a, b], and the event if the discs overlap there
+// with the front body nearer
+static bool refineDisc(const BodyTable& bodies, const Watch& watch, double a, double b, double step,
+	const Ephemeris* ephemeris, EventRecord& event)
+{
+	const double golden = 0.5 * (std::sqrt(5.0) - 1.0);
+	double c = b - golden * (b - a), d = a + golden * (b - a);
+	double gc = lookAt(bodies, watch, c, ephemeris).gap, gd = lookAt(bodies, watch, d, ephemeris).gap;
+	for (int iteration = 0; iteration < 48; iteration++)
+	{
+		if (gc < gd) {
+			b = d;
+			d = c;
+			gd = gc;
+			c = b - golden * (b - a);
+			gc = lookAt(bodies, watch, c, ephemeris).gap;
+		}
+		else {
+			a = c;
+			c = d;
+			gc = gd;
+			d = a + golden * (b - a);
+			gd = lookAt(bodies, watch, d, ephemeris).gap;
+		}
+	}
+	double t = 0.5 * (a + b);
+	Sky sky = lookAt(bodies, watch, t, ephemeris);
+	if (sky.gap >= 0.0 || sky.frontDistance >= sky.backDistance)
+		return false;
+
+	// Step out until the discs are apart, then bisect
+	double before = t - step, after = t + step;
+	for (int k = 0; k < maxContactSteps && lookAt(bodies, watch, before, ephemeris).gap < 0.0; k++)
+		before -= step;
+	for (int k = 0; k < maxContactSteps && lookAt(bodies, watch, after, ephemeris).gap < 0.0; k++)
+		after += step;
+
+	event.time = t;
+	event.begin = contact(bodies, watch, before + step, before, ephemeris);
+	event.end = contact(bodies, watch, after - step, after, ephemeris);
+	event.separation = (float)sky.separation;
+	event.magnitude = (float)((sky.frontRadius + sky.backRadius - sky.separation) / (2.0 * sky.backRadius));
+	return true;
+}
+
+void findEvents(const BodyTable& bodies, const EventSearch& search, std::vector<EventRecord>& out, JobSystem* jobs,
+	const Ephemeris* ephemeris)
+{
+	out.clear();
+	const double span = search.end - search.begin;
+	if (bodies.size() == 0 || span <= 0.0 || search.step <= 0.0)
+		return;
+	const std::vector<Watch> watches = watchList(bodies, search.observer);
+	const size_t samples = (size_t)std::ceil(span / search.step) + 1;
+	const size_t blocks = (samples + blockSamples - 1) / blockSamples;
+	auto sampleTime = [&](size_t g) { return std::min(search.end, search.begin + search.step * g); };
+
+	std::mutex outMutex;
+	auto run = [&](size_t firstBlock, size_t lastBlock) {
+		std::vector<double> times;
+		std::vector<Sky> skies;
+		std::vector<EventRecord> found;
+		PositionGrid grid;
+		for (size_t block = firstBlock; block < lastBlock; block++)
+		{
+			// Samples [first, last) are this block's, with a neighbour on each side
+			size_t first = block * blockSamples, last = std::min(samples, first + blockSamples);
+			size_t from = first > 0 ? first - 1 : 0, to = std::min(samples, last + 1);
+			times.resize(to - from);
+			for (size_t g = from; g < to; g++)
+				times[g - from] = sampleTime(g);
+			positions(bodies, times.data(), times.size(), grid, NULL, ephemeris);
+
+			for (size_t w = 0; w < watches.size(); w++)
+			{
+				const Watch& watch = watches[w];
+				skies.resize(times.size());
+				for (size_t k = 0; k < times.size(); k++)
+				{
+					size_t io = grid.index(watch.observer, k), jf = grid.index(watch.front, k), jb = grid.index(watch.back, k);
+					double o[3] = { grid.x[io], grid.y[io], grid.z[io] };
+					double f[3] = { grid.x[jf], grid.y[jf], grid.z[jf] };
+					double b[3] = { grid.x[jb], grid.y[jb], grid.z[jb] };
+					skies[k] = look(bodies, watch, o, f, b);
+				}
+
+				for (size_t g = first; g < last && g + 1 < samples; g++)
+				{
+					size_t k = g - from;
+					EventRecord event;
+					event.kind = watch.kind;
+					event.observer = watch.observer;
+					event.front = watch.front;
+					event.back = watch.back;
+					if (watch.kind == eventOpposition) {
+						// Longitude crossing exactly opposite between samples g and g + 1
+						// (one exactly at begin, as when the scene starts lined up, is left out)
+						if (!skies[k].opposite || !skies[k + 1].opposite || (skies[k].gap < 0.0) == (skies[k + 1].gap < 0.0) ||
+							(g == 0 && skies[k].gap == 0.0))
+							continue;
+						double a = times[k], b = times[k + 1];
+						bool negative = skies[k].gap < 0.0;
+						for (int iteration = 0; iteration < 48; iteration++)
+						{
+							double middle = 0.5 * (a + b);
+							if ((lookAt(bodies, watch, middle, ephemeris).gap < 0.0) == negative)
+								a = middle;
+							else
+								b = middle;
+						}
+						event.time = event.begin = event.end = 0.5 * (a + b);
+						event.separation = (float)lookAt(bodies, watch, event.time, ephemeris).separation;
+						event.magnitude = 0.0f;
+						found.push_back(event);
+						continue;
+					}
+
+					// A minimum at sample g, deep enough that between the samples
+					// around it the gap could reach zero at the slope seen there
+					if (g == 0)
+						continue;
+					double dip = std::max(skies[k - 1].gap - skies[k].gap, skies[k + 1].gap - skies[k].gap);
+					if (skies[k - 1].gap <= skies[k].gap || skies[k + 1].gap < skies[k].gap || skies[k].gap > dip)
+						continue;
+					if (refineDisc(bodies, watch, times[k - 1], times[k + 1], search.step, ephemeris, event) &&
+						event.time > search.begin && event.time <= search.end)
+						found.push_back(event);
+				}
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(outMutex);
+		out.insert(out.end(), found.begin(), found.end());
+	};
+	if (jobs != NULL)
+		jobs->parallelFor(0, blocks, 1, run);
+	else
+		run(0, blocks);
+
+	std::sort(out.begin(), out.end(), [](const EventRecord& a, const EventRecord& b) {
+		return a.time != b.time ? a.time < b.time : a.kind != b.kind ? a.kind < b.kind : a.front < b.front;
+	});
+}
+
+bool writeEventIndex(const char* path, const BodyTable& bodies, const EventSearch& search,
+	const std::vector<EventRecord>& events)
+{
+	FILE* out = fopen(path, "wb");
+	if (out == NULL) {
+		printf("Impossible to create %s\n", path);
+		return false;
+	}
+	EventIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, eventMagic, sizeof(eventMagic));
+	header.eventCount = (uint32_t)events.size();
+	header.bodyCount = (uint32_t)bodies.size();
+	header.startDay = search.begin;
+	header.endDay = search.end;
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	for (size_t i = 0; ok && i < bodies.size(); i++)
+	{
+		char name[32] = {};
+		strncpy(name, bodies.name[i].c_str(), sizeof(name) - 1);
+		ok = fwrite(name, sizeof(name), 1, out) == 1;
+	}
+	ok = ok && (events.empty() || fwrite(events.data(), sizeof(EventRecord), events.size(), out) == events.size());
+	ok = fclose(out) == 0 && ok;
+	if (!ok)
+		printf("Could not write %s\n", path);
+	return ok;
+}
+
+EventIndex::EventIndex() : header(NULL), names(NULL), records(NULL) {}
+
+EventIndex::~EventIndex()
+{
+	close();
+}
+
+bool EventIndex::open(const char* path)
+{
+	close();
+	if (!file.open(path, sizeof(EventIndexHeader)))
+		return false;
+
+	// Sizes and body indices are checked once, lookups trust them afterwards
+	const unsigned char* data = file.data();
+	size_t bytes = file.size();
+	header = (const EventIndexHeader*)data;
+	names = (const char (*)[32])(data + sizeof(EventIndexHeader));
+	records = (const EventRecord*)(data + sizeof(EventIndexHeader) + 32ull * header->bodyCount);
+	bool ok = memcmp(header->magic, eventMagic, sizeof(eventMagic)) == 0 &&
+		sizeof(EventIndexHeader) + 32ull * header->bodyCount + (uint64_t)header->eventCount * sizeof(EventRecord) == bytes;
+	for (uint32_t i = 0; ok && i < header->bodyCount; i++)
+		ok = names[i][31] == '\0';
+	for (uint32_t k = 0; ok && k < header->eventCount; k++)
+	{
+		const EventRecord& event = records[k];
+		ok = event.observer >= 0 && (uint32_t)event.observer < header->bodyCount && event.front >= 0 &&
+			(uint32_t)event.front < header->bodyCount && event.back >= 0 && (uint32_t)event.back < header->bodyCount &&
+			(k == 0 || records[k - 1].time <= event.time);
+	}
+	if (!ok) {
+		printf("%s: not a valid event file\n", path);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void EventIndex::close()
+{
+	file.close();
+	header = NULL;
+	names = NULL;
+	records = NULL;
+}
+
+const char* EventIndex::bodyName(int32_t body) const
+{
+	return names[body];
+}
+
+size_t EventIndex::next(double t) const
+{
+	const EventRecord* end = records + count();
+	return std::upper_bound(records, end, t, [](double t, const EventRecord& event) { return t < event.time; }) - records;
+}
+
+size_t EventIndex::previous(double t) const
+{
+	size_t k = std::lower_bound(records, records + count(), t,
+		[](const EventRecord& event, double t) { return event.time < t; }) - records;
+	return k > 0 ? k - 1 : count();
+}
+
+std::string EventIndex::describe(size_t k) const
+{
+	// Eclipses name the moon and its planet, the others what was seen from where
+	const EventRecord& event = records[k];
+	char text[128];
+	if (event.kind == eventSolarEclipse)
+		snprintf(text, sizeof(text), "%s: %s - %s", eventKindName(event.kind), names[event.front], names[event.observer]);
+	else if (event.kind == eventLunarEclipse)
+		snprintf(text, sizeof(text), "%s: %s - %s", eventKindName(event.kind), names[event.observer], names[event.front]);
+	else if (event.kind == eventOpposition)
+		snprintf(text, sizeof(text), "%s: %s, de %s", eventKindName(event.kind), names[event.front], names[event.observer]);
+	else
+		snprintf(text, sizeof(text), "%s: %s - %s, de %s", eventKindName(event.kind), names[event.front],
+			names[event.back], names[event.observer]);
+	return text;
+}
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cmath>
+
+#include "frustum.hpp"
+#include "jobSystem.hpp"
+#include "simdMath.hpp"
+
+using simd::vfloat;
+using simd::vfmask;
+
+// Spheres per job; a multiple of every vector width
+static const size_t cullGrain = 16384;
+
+Frustum frustumFromMatrix(const float* projectionView)
+{
+	// Column-major: row r of the matrix is m[r], m[4 + r], m[8 + r], m[12 + r]
+	const float* m = projectionView;
+	Frustum frustum;
+	for (int c = 0; c < 4; c++)
+	{
+		float w = m[4 * c + 3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float row = m[4 * c + axis];
+			frustum.planes[2 * axis][c] = w + row;
+			frustum.planes[2 * axis + 1][c] = w - row;
+		}
+	}
+	for (int p = 0; p < 6; p++)
+	{
+		float* plane = frustum.planes[p];
+		float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		for (int c = 0; c < 4; c++)
+			plane[c] /= length;
+	}
+	return frustum;
+}
+
+// Writes the visible spheres of [first, last) to visible[first...], in order,
+// and returns how many there are. Every lane's index is written and only the
+// visible ones advance the cursor, so there is no branch per sphere.
+static size_t cullBlock(const Frustum& frustum, const float* x, const float* y, const float* z,
+	const float* radius, float commonRadius, size_t first, size_t last, uint32_t* visible)
+{
+	const int w = simd::floatWidth;
+	vfloat a[6], b[6], c[6], d[6];
+	for (int p = 0; p < 6; p++)
+	{
+		a[p] = vfloat(frustum.planes[p][0]);
+		b[p] = vfloat(frustum.planes[p][1]);
+		c[p] = vfloat(frustum.planes[p][2]);
+		d[p] = vfloat(frustum.planes[p][3]);
+	}
+
+	size_t n = 0;
+	size_t i = first;
+	for (; i + w <= last; i += w)
+	{
+		vfloat px = vfloat::load(x + i), py = vfloat::load(y + i), pz = vfloat::load(z + i);
+		vfloat negativeRadius = -(radius != NULL ? vfloat::load(radius + i) : vfloat(commonRadius));
+		vfmask inside = a[0] * px + b[0] * py + c[0] * pz + d[0] >= negativeRadius;
+		for (int p = 1; p < 6; p++)
+			inside = inside & (a[p] * px + b[p] * py + c[p] * pz + d[p] >= negativeRadius);
+
+		int mask = simd::bits(inside);
+		for (int l = 0; l < w; l++)
+		{
+			visible[first + n] = (uint32_t)(i + l);
+			n += (mask >> l) & 1;
+		}
+	}
+	for (; i < last; i++)
+	{
+		float r = radius != NULL ? radius[i] : commonRadius;
+		bool inside = true;
+		for (int p = 0; p < 6; p++)
+		{
+			const float* plane = frustum.planes[p];
+			inside = inside && plane[0] * x[i] + plane[1] * y[i] + plane[2] * z[i] + plane[3] >= -r;
+		}
+		visible[first + n] = (uint32_t)i;
+		n += inside ? 1 : 0;
+	}
+	return n;
+}
+
+void cullSpheres(const Frustum& frustum, const float* x, const float* y, const float* z,
+	const float* radius, float commonRadius, size_t count, VisibleSet& out, JobSystem* jobs)
+{
+	// Each block compacts into its own slice of index, then the slices are
+	// moved down next to each other
+	if (out.index.size() < count)
+		out.index.resize(count);
+	size_t blocks = (count + cullGrain - 1) / cullGrain;
+	if (out.blockCounts.size() < blocks)
+		out.blockCounts.resize(blocks);
+
+	uint32_t* visible = out.index.data();
+	auto cull = [&](size_t firstBlock, size_t lastBlock) {
+		for (size_t k = firstBlock; k < lastBlock; k++)
+			out.blockCounts[k] = cullBlock(frustum, x, y, z, radius, commonRadius, k * cullGrain,
+				std::min(count, (k + 1) * cullGrain), visible);
+	};
+	if (jobs != NULL && blocks > 1)
+		jobs->parallelFor(0, blocks, 1, cull);
+	else
+		cull(0, blocks);
+
+	size_t total = 0;
+	for (size_t k = 0; k < blocks; k++)
+	{
+		const uint32_t* slice = visible + k * cullGrain;
+		if (slice != visible + total)
+			std::copy(slice, slice + out.blockCounts[k], visible + total);
+		total += out.blockCounts[k];
+	}
+	out.count = total;
+}
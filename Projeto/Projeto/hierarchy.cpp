@@ -0,0 +1,84 @@
+#include <vector>
+
+#include "hierarchy.hpp"
+
+bool depthFirstOrder(const std::vector<int>& parent, std::vector<int>& order)
+{
+	const int count = (int)parent.size();
+
+	// Children lists in compressed form. Counting sort by parent + 1; filling
+	// advances each start to the next list's start, which leaves the children
+	// of node p in child[first[p] .. first[p + 1]) and the roots in child[0 .. first[0])
+	std::vector<int> first(count + 2, 0), child(count);
+	for (int i = 0; i < count; i++)
+		first[parent[i] + 2]++;
+	for (int i = 0; i <= count; i++)
+		first[i + 1] += first[i];
+	for (int i = 0; i < count; i++)
+		child[first[parent[i] + 1]++] = i;
+
+	order.clear();
+	order.reserve(count);
+	std::vector<int> stack;
+	for (int k = first[0] - 1; k >= 0; k--)
+		stack.push_back(child[k]);
+	while (!stack.empty())
+	{
+		int node = stack.back();
+		stack.pop_back();
+		order.push_back(node);
+		// Pushed in reverse so siblings come out in their original order
+		for (int k = first[node + 1] - 1; k >= first[node]; k--)
+			stack.push_back(child[k]);
+	}
+
+	// Nodes on a cycle are never reached from a root
+	return (int)order.size() == count;
+}
+
+void computeSubtreeEnds(const std::vector<int>& parent, std::vector<int>& subtreeEnd)
+{
+	const int count = (int)parent.size();
+	subtreeEnd.resize(count);
+	for (int i = 0; i < count; i++)
+		subtreeEnd[i] = i + 1;
+	// Children come after their parent, so walking backwards extends each
+	// parent's range with subtrees that are already complete
+	for (int i = count - 1; i >= 0; i--)
+		if (parent[i] >= 0 && subtreeEnd[parent[i]] < subtreeEnd[i])
+			subtreeEnd[parent[i]] = subtreeEnd[i];
+}
+
+void independentSubtrees(const std::vector<int>& parent, const std::vector<int>& subtreeEnd,
+	std::vector<int>& roots, std::vector<int>& branches)
+{
+	roots.clear();
+	branches.clear();
+	for (int i = 0; i < (int)parent.size(); i = subtreeEnd[i])
+	{
+		// Children of a root follow it one subtree after another
+		roots.push_back(i);
+		for (int child = i + 1; child < subtreeEnd[i]; child = subtreeEnd[child])
+			branches.push_back(child);
+	}
+}
+
+void composeTransforms(const int* parent, size_t begin, size_t end, double scale,
+	const double* localX, const double* localY, const double* localZ,
+	float* worldX, float* worldY, float* worldZ)
+{
+	for (size_t i = begin; i < end; i++)
+	{
+		int p = parent[i];
+		float px = 0.0f, py = 0.0f, pz = 0.0f;
+		if (p >= 0)
+		{
+			px = worldX[p];
+			py = worldY[p];
+			pz = worldZ[p];
+		}
+		worldX[i] = (float)(localX[i] * scale) + px;
+		worldY[i] = (float)(localY[i] * scale) + py;
+		worldZ[i] = (float)(localZ[i] * scale) + pz;
+	}
+}
@@ -0,0 +1,104 @@
+#ifndef BODYBATCH_H
+#define BODYBATCH_H
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Sphere.h"
+
+// Per-instance data read by InstancedVertexShader (attribute locations 2-6)
+struct BodyInstance
+{
+	glm::mat4 model;
+	glm::vec4 material;     // ambient, specular, shininess, texture layer
+};
+
+// Draws every instance set this frame with one glDrawElementsInstanced call.
+// The batch owns its own VAO: the sphere mesh buffers are shared with the cache,
+// the instance buffer only grows, so steady-state frames never allocate.
+class BodyBatch
+{
+private:
+	GLuint VAO, instanceVBO;
+	GLsizei indexCount;
+	GLsizeiptr capacity = 0;
+	std::vector<BodyInstance> instances;
+
+	BodyBatch(const BodyBatch&) = delete;
+	BodyBatch& operator=(const BodyBatch&) = delete;
+
+public:
+	BodyBatch(int sectors, int stacks)
+	{
+		Sphere& mesh = Sphere::get(sectors, stacks);
+		indexCount = mesh.getIndexCount();
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &instanceVBO);
+		glBindVertexArray(VAO);
+
+		mesh.bindVertexAttributes();
+
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		// mat4 takes four consecutive attribute slots, one per column
+		for (int column = 0; column < 4; ++column)
+		{
+			glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (GLvoid*)(sizeof(glm::vec4) * column));
+			glEnableVertexAttribArray(2 + column);
+			glVertexAttribDivisor(2 + column, 1);
+		}
+		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (GLvoid*)offsetof(BodyInstance, material));
+		glEnableVertexAttribArray(6);
+		glVertexAttribDivisor(6, 1);
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+
+	~BodyBatch()
+	{
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &instanceVBO);
+	}
+
+	// Filled from several threads: resize to this frame's count once, then
+	// set() each index from whichever thread owns it
+	void resize(size_t count)
+	{
+		instances.resize(count);
+	}
+
+	void set(size_t i, const glm::mat4& model, float ambientStrength, float specularStrength, float shininess, int layer)
+	{
+		instances[i].model = model;
+		instances[i].material = glm::vec4(ambientStrength, specularStrength, shininess, (float)layer);
+	}
+
+	size_t size() const
+	{
+		return instances.size();
+	}
+
+	// Uploads this frame's instances and issues the single draw call
+	void Draw()
+	{
+		if (instances.empty())
+			return;
+
+		GLsizeiptr bytes = (GLsizeiptr)(instances.size() * sizeof(BodyInstance));
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		if (bytes > capacity)
+		{
+			capacity = bytes * 2;
+			glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+		}
+		glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glBindVertexArray(VAO);
+		glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, (void*)0, (GLsizei)instances.size());
+		glBindVertexArray(0);
+	}
+};
+
+#endif
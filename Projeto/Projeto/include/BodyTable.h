@@ -0,0 +1,138 @@
+#ifndef BODYTABLE_H
+#define BODYTABLE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class JobSystem;
+struct NBodySystem;
+class Ephemeris;
+class PlanetTheory;
+
+// Every body of the scene in structure-of-arrays form: index i of each array
+// describes body i. The hot per-frame data (elements and state) is kept in its
+// own arrays so the update loop only touches what it needs; names, HUD text and
+// camera offsets are cold data used when a body is selected.
+// Bodies are stored in depth-first order of the parent hierarchy (see
+// hierarchy.hpp), so moons can be added in any order through the scene file.
+struct BodyTable
+{
+	float sceneScale = 50.0f;               // scene units per AU
+
+	// Hierarchy: parent index (-1 for roots) and end of each body's subtree.
+	// roots and branches split the update into independent pieces
+	std::vector<int> parent;
+	std::vector<int> subtreeEnd;
+	std::vector<int> roots, branches;
+
+	// Orbital elements, relative to the parent body
+	std::vector<double> semiMajorAxis;      // AU
+	std::vector<double> eccentricity;
+	std::vector<double> period;             // days, 0 = fixed at the parent position
+	std::vector<double> meanMotion;         // radians per day, derived from period
+	std::vector<double> meanAnomaly0;       // radians at t = 0
+
+	// Series theories (body key "theory", see planetTheory.hpp) replace the
+	// Kepler orbit of the bodies that have one. Scene distances of moons are
+	// exaggerated, so their theory is scaled to the orbit's semi-major axis.
+	double epoch = 2451545.0;               // Julian day at t = 0, J2000 by default
+	double theoryTolerance = 1e-6;          // radians, terms below it are skipped; 0 = full series
+	std::vector<std::shared_ptr<const PlanetTheory> > theory;
+	std::vector<double> theoryScale;
+
+	// Physical and render properties
+	std::vector<float> radius;
+	std::vector<float> spinRate;
+	std::vector<double> massKg;             // only used by the N-body mode, 0 = massless
+	std::vector<int> textureLayer;          // index into texturePaths
+	std::vector<float> ambient, specular, shininess;
+
+	// Simulation state
+	std::vector<double> localX, localY, localZ;     // position relative to the parent, AU
+	std::vector<float> spin;                // radians around Y
+	std::vector<float> x, y, z;             // world position, scene units
+
+	// Cold data
+	std::vector<std::string> name;
+	std::vector<int> hotkey;                // 0 = not selectable
+	std::vector<float> cameraHeight, cameraDistance;
+	std::vector<std::string> orbitSpeed, mass, gravity;
+
+	std::vector<std::string> texturePaths;  // unique textures, one texture array layer each
+
+	// N-body mode (scene keys "nbody" and "belt"): the roots and the bodies
+	// orbiting them are integrated together with the belt particles, deeper
+	// bodies (moons) keep their analytic orbit around their moving parent
+	bool nbody = false;
+	double nbodyTheta = 0.5, nbodySoftening = 1e-4;
+	bool nbodyDeterministic = false;        // see NBodySystem::deterministic
+	size_t beltCount = 0;
+	double beltInner = 0.0, beltOuter = 0.0;    // AU
+	float beltRadius = 0.1f;
+	int beltLayer = 0;
+	std::vector<int> nbodyIndex;            // per body: index in the N-body system, -1 = analytic
+	size_t nbodyBodies = 0;                 // particles follow the bodies in the system
+
+	// Timeline snapshots of the N-body state (scene key "snapshots", see snapshotRing.hpp)
+	double snapshotInterval = 30.0;         // days, 0 = seeking back re-simulates from the start
+	size_t snapshotMegabytes = 256;
+	std::string snapshotPath = "snapshots.ring";
+
+	// Precomputed trajectories (scene key "ephemeris", see ephemeris.hpp)
+	std::string ephemerisPath;
+	std::vector<int> ephemerisIndex;        // per body: record in the ephemeris, -1 = not covered
+
+	// Event file the viewer jumps through (scene key "events", see events.hpp)
+	std::string eventsPath;
+
+	// Transfer windows the viewer plots (scene key "porkchop", see porkchop.hpp)
+	std::string porkchopFrom, porkchopTo;
+	double porkchopDays = 730.0;            // departures from the current date to this many days after
+
+	size_t size() const { return name.size(); }
+	int find(const std::string& bodyName) const;
+};
+
+// Positions and spins of every body at one simulation instant, what the
+// renderer needs from the simulation
+struct BodyState
+{
+	double time = 0.0;                      // days
+	std::vector<float> x, y, z, spin;       // bodies, then N-body particles if any
+};
+
+// Reads a .scene file (see scenes/solarSystem.scene). Returns false and prints
+// the offending line when the file cannot be parsed.
+bool loadBodyTable(const char* path, BodyTable& bodies);
+
+// Places every body at simulation time t (days). Positions are evaluated
+// directly from the orbital elements, so t can jump anywhere.
+// spinPerDay converts the scene's spin rates to radians per day. With a job
+// system the orbits, spins and subtrees are spread over its workers. In
+// N-body mode dynamics holds the integrated bodies, which override their
+// analytic positions. Bodies bound to an ephemeris take their position from
+// it while t is inside its span.
+void updateBodyTable(BodyTable& bodies, double t, double spinPerDay, JobSystem* jobs = NULL,
+	const NBodySystem* dynamics = NULL, const Ephemeris* ephemeris = NULL);
+
+// Position of body i relative to its parent at time t from its series
+// theory, in scene axes and AU. The body must have a theory.
+void theoryPosition(const BodyTable& bodies, size_t i, double t, double& x, double& y, double& z);
+
+// Matches the bodies of the table to the records of ephemeris by name. A body
+// is only bound when the record has the same parent. Returns how many were bound.
+size_t bindEphemeris(BodyTable& bodies, const Ephemeris& ephemeris);
+
+// Fills system with the integrated bodies, placed and moving as their orbits
+// give at time t, followed by the belt particles
+void initBodyDynamics(BodyTable& bodies, double t, NBodySystem& system);
+
+// Copies the current positions and spins of the table into state, followed
+// by the N-body particles when dynamics is given
+void captureBodyState(const BodyTable& bodies, double t, BodyState& state, const NBodySystem* dynamics = NULL);
+
+// out = previous + (current - previous) * alpha, spins along the shorter arc
+void interpolateBodyStates(const BodyState& previous, const BodyState& current, float alpha, BodyState& out);
+
+#endif
@@ -6,20 +6,36 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <map>
+#include <memory>
+#include <utility>
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+// Unit-radius sphere mesh. The radius of each body is applied through the
+// model matrix, so one mesh per (sectors, stacks) pair is enough for the
+// whole scene: use Sphere::get() instead of building a Sphere per draw.
 class Sphere
 {
 private:
 	std::vector<float> sphere_vertices;
-	std::vector<float> sphere_texcoord;
 	std::vector<int> sphere_indices;
 	GLuint VBO, VAO, EBO;
-	float radius = 1.0f;
+	GLsizei indexCount = 0;
 	int sectorCount = 36;
 	int stackCount = 18;
 
+	typedef std::map<std::pair<int, int>, std::unique_ptr<Sphere> > Cache;
+
+	static Cache& cache()
+	{
+		static Cache meshes;
+		return meshes;
+	}
+
+	Sphere(const Sphere&) = delete;
+	Sphere& operator=(const Sphere&) = delete;
+
 public:
 
 	~Sphere()
@@ -28,22 +44,22 @@ public:
 		glDeleteBuffers(1, &VBO);
 		glDeleteBuffers(1, &EBO);
 	}
-	Sphere(float r, int sectors, int stacks)
+	Sphere(int sectors, int stacks)
 	{
-		radius = r;
+		const float radius = 1.0f;
 		sectorCount = sectors;
 		stackCount = stacks;
 
 
 		/* GENERATE VERTEX ARRAY */
 		float x, y, z, xy;                              // vertex position
-		float lengthInv = 1.0f / radius;    // vertex normal
 		float s, t;                                     // vertex texCoord
 
 		float sectorStep = (float)(2 * M_PI / sectorCount);
 		float stackStep = (float)(M_PI / stackCount);
 		float sectorAngle, stackAngle;
 
+		sphere_vertices.reserve((stackCount + 1) * (sectorCount + 1) * 5);
 		for (int i = 0; i <= stackCount; ++i)
 		{
 			stackAngle = (float)(M_PI / 2 - i * stackStep);        // starting from pi/2 to -pi/2
@@ -77,6 +93,7 @@ public:
 
 		/* GENERATE INDEX ARRAY */
 		int k1, k2;
+		sphere_indices.reserve(stackCount * sectorCount * 6);
 		for (int i = 0; i < stackCount; ++i)
 		{
 			k1 = i * (sectorCount + 1);     // beginning of current stack
@@ -102,39 +119,73 @@ public:
 				}
 			}
 		}
+		indexCount = (GLsizei)sphere_indices.size();
 		/* GENERATE INDEX ARRAY */
 
 
 		/* GENERATE VAO-EBO */
-		//GLuint VBO, VAO, EBO;
 		glGenVertexArrays(1, &VAO);
 		glGenBuffers(1, &VBO);
 		glGenBuffers(1, &EBO);
 		// Bind the Vertex Array Object first, then bind and set vertex buffer(s) and attribute pointer(s).
 		glBindVertexArray(VAO);
 
+		// The mesh never changes after this point, so let the driver keep it in video memory
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, (unsigned int)sphere_vertices.size() * sizeof(float), sphere_vertices.data(), GL_DYNAMIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, (unsigned int)sphere_vertices.size() * sizeof(float), sphere_vertices.data(), GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (unsigned int)sphere_indices.size() * sizeof(unsigned int), sphere_indices.data(), GL_STATIC_DRAW);
+
+		bindVertexAttributes();
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+		/* GENERATE VAO-EBO */
+
+		// The data lives on the GPU now, no need to keep a copy around
+		std::vector<float>().swap(sphere_vertices);
+		std::vector<int>().swap(sphere_indices);
+	}
+
+	// Returns the cached mesh for (sectors, stacks), building it on first use
+	static Sphere& get(int sectors, int stacks)
+	{
+		std::unique_ptr<Sphere>& mesh = cache()[std::make_pair(sectors, stacks)];
+		if (!mesh)
+			mesh.reset(new Sphere(sectors, stacks));
+		return *mesh;
+	}
 
+	// Must be called while the GL context is still current
+	static void releaseCache()
+	{
+		cache().clear();
+	}
+
+	// Points attributes 0 (position) and 1 (uv) and the index buffer of the
+	// currently bound VAO at this mesh, so other VAOs can share its buffers
+	void bindVertexAttributes()
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (unsigned int)sphere_indices.size() * sizeof(unsigned int), sphere_indices.data(), GL_DYNAMIC_DRAW);
 
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
 		glEnableVertexAttribArray(0);
 
 		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
 		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindVertexArray(0);
-		/* GENERATE VAO-EBO */
-
+	}
 
+	GLsizei getIndexCount() const
+	{
+		return indexCount;
 	}
+
 	void Draw()
 	{
 		glBindVertexArray(VAO);
 		glDrawElements(GL_TRIANGLES,
-			(unsigned int)sphere_indices.size(),
+			indexCount,
 			GL_UNSIGNED_INT,
 			(void*)0);
 		glBindVertexArray(0);
@@ -0,0 +1,49 @@
+#ifndef CLOSEAPPROACH_HPP
+#define CLOSEAPPROACH_HPP
+
+#include <cstddef>
+#include <vector>
+
+struct BodyTable;
+class JobSystem;
+
+// Close approach (conjunction) search over the Kepler orbits of a body table:
+// the same elements updateBodyTable propagates, without series theories or
+// ephemerides, so large synthetic catalogs can be scanned.
+//
+// The span is cut into coarse intervals. For each interval every body is
+// evaluated once at the middle and bounded by a circle its orbit cannot leave
+// (fastest speed on the orbit times half the interval, plus its parents').
+// Bodies are binned into slabs along Z and swept and pruned along X inside
+// each slab and its neighbour, kept sorted from one interval to the next; the
+// pairs whose circles come within the distance have the minima of their
+// distance found by root finding on d/dt |r|^2. Runs of consecutive
+// intervals are spread over the job system.
+
+struct CloseApproach
+{
+	int first, second;                  // body indices, first < second
+	double time;                        // days, at the minimum
+	double distance;                    // AU
+	double speed;                       // relative speed, AU/day
+};
+
+struct ApproachSearch
+{
+	double distance = 0.01;             // AU, pairs passing closer are reported
+	double begin = 0.0, end = 36525.0;  // days
+	// Length of the coarse intervals in days; 0 uses approachInterval
+	double interval = 0.0;
+};
+
+// Interval for a search: the typical bound about as wide as the distance, or
+// as half the spacing between bodies when that is wider
+double approachInterval(const BodyTable& bodies, const ApproachSearch& search);
+
+// Every minimum of the distance between two bodies in (begin, end] that is
+// below the search distance, sorted by time. Bodies and their own moons are
+// not paired. Returns the number of pairs the broadphase passed on.
+size_t findCloseApproaches(const BodyTable& bodies, const ApproachSearch& search, std::vector<CloseApproach>& out,
+	JobSystem* jobs = NULL);
+
+#endif
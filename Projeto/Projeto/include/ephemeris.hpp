@@ -0,0 +1,98 @@
+#ifndef EPHEMERIS_HPP
+#define EPHEMERIS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mappedFile.hpp"
+
+// Precomputed trajectories in the style of the JPL DE files: the span of each
+// body is cut into equal intervals and every interval stores one Chebyshev
+// series per axis. Any date is one division to find the interval and one
+// Clenshaw recurrence to evaluate it, no matter how far it is from the start.
+//
+// File layout (native byte order, every offset 8-byte aligned):
+//   EphemerisHeader
+//   EphemerisRecord[bodyCount]
+//   per body: intervalCount blocks of 3 * coefficients doubles (x, then y, then z)
+// Positions are relative to the parent body, in AU, like BodyTable::localX.
+struct EphemerisHeader
+{
+	char magic[8];                  // "PRJEPH01"
+	uint32_t bodyCount;
+	uint32_t reserved;
+	double startDay, endDay;        // covered span, simulation days
+};
+
+struct EphemerisRecord
+{
+	char name[32];                  // body name, zero padded
+	int32_t parent;                 // record index, -1 for roots
+	uint32_t coefficients;          // per axis and interval
+	uint32_t intervalCount;
+	uint32_t reserved;
+	double intervalDays;
+	uint64_t offset;                // bytes from the start of the file to the first block
+};
+
+// Read-only view of an ephemeris file. The file is memory mapped, so opening
+// it costs nothing until dates are looked up, several processes share the same
+// pages and lookups never allocate.
+class Ephemeris
+{
+public:
+	Ephemeris();
+	~Ephemeris();
+
+	// Maps path; false (and a message) when it is missing or not an ephemeris
+	bool open(const char* path);
+	void close();
+	bool isOpen() const { return file.isOpen(); }
+
+	size_t bodyCount() const { return header != NULL ? header->bodyCount : 0; }
+	const EphemerisRecord& record(size_t body) const { return records[body]; }
+	int find(const std::string& bodyName) const;
+	double startDay() const { return header->startDay; }
+	double endDay() const { return header->endDay; }
+
+	// Position of body relative to its parent at day t, AU. Returns false when
+	// t is outside the covered span.
+	bool position(size_t body, double t, double& x, double& y, double& z) const;
+
+private:
+	MappedFile file;
+	const EphemerisHeader* header;
+	const EphemerisRecord* records;
+
+	Ephemeris(const Ephemeris&) = delete;
+	Ephemeris& operator=(const Ephemeris&) = delete;
+};
+
+// One body to fit: how finely its trajectory is cut. Short intervals and more
+// coefficients follow faster orbits more closely at the cost of file size.
+struct EphemerisBody
+{
+	std::string name;
+	int parent;                     // index in the body list, -1 for roots
+	double intervalDays;
+	unsigned coefficients;
+};
+
+// Where the fitted trajectories come from. sample() is called with
+// non-decreasing times, so integrators can simply step forward to each one.
+class EphemerisSource
+{
+public:
+	virtual ~EphemerisSource() {}
+	// Writes the position of every body relative to its parent at day t, AU
+	virtual void sample(double t, double* x, double* y, double* z) = 0;
+};
+
+// Samples every body at the Chebyshev nodes of each of its intervals over
+// [startDay, endDay] and writes the fitted series to path
+bool writeEphemeris(const char* path, const std::vector<EphemerisBody>& bodies, double startDay, double endDay,
+	EphemerisSource& source);
+
+#endif
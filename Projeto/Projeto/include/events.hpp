@@ -0,0 +1,120 @@
+#ifndef EVENTS_HPP
+#define EVENTS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mappedFile.hpp"
+
+struct BodyTable;
+class JobSystem;
+class Ephemeris;
+
+// Eclipses, transits, occultations and oppositions between the bodies of a
+// scene, found ahead of time and kept in a file sorted by date, so the viewer
+// can jump straight to the next one.
+//
+// Disc events are seen from an observer body: the front body's disc passes
+// over the back body's (sizes are the scene radii, as drawn). The search
+// samples the angular separation minus both angular radii at a fixed step,
+// refines every minimum that can dip below zero by golden section search and
+// the first and last contacts by bisection. Dates are cut into blocks spread
+// over the job system.
+//   solar eclipse   from a planet, one of its moons in front of the Sun
+//   lunar eclipse   from a moon, its planet in front of the Sun (the moon is
+//                   in the planet's shadow)
+//   transit         from the observer, a planet in front of the Sun
+//   occultation     from the observer, a planet or one of its own moons in
+//                   front of another planet
+//   opposition      from the observer, a planet opposite the Sun in longitude
+// Eclipses are searched for every moon in the scene; the other events need
+// an observer.
+
+enum EventKind
+{
+	eventSolarEclipse = 0,
+	eventLunarEclipse = 1,
+	eventTransit = 2,
+	eventOccultation = 3,
+	eventOpposition = 4
+};
+
+// Name shown by the viewer
+const char* eventKindName(uint32_t kind);
+
+struct EventRecord
+{
+	double time;                    // days, greatest phase or opposition
+	double begin, end;              // first and last contact, days; time for oppositions
+	float separation;               // radians between the centres at time
+	float magnitude;                // part of the back body's diameter covered at time
+	uint32_t kind;                  // EventKind
+	int32_t observer, front, back;  // body indices; oppositions: the planet in front, the Sun at the back
+};
+
+struct EventSearch
+{
+	double begin = 0.0, end = 36525.0;     // days
+	double step = 1.0 / 24.0;               // days between samples
+	int observer = -1;                      // body the other events are seen from, -1 = eclipses only
+};
+
+// Every event in (begin, end], sorted by time
+void findEvents(const BodyTable& bodies, const EventSearch& search, std::vector<EventRecord>& out,
+	JobSystem* jobs = NULL, const Ephemeris* ephemeris = NULL);
+
+// File layout (native byte order):
+//   EventIndexHeader
+//   char[32] name of each body the records refer to
+//   EventRecord[eventCount], sorted by time
+struct EventIndexHeader
+{
+	char magic[8];                  // "PRJEVT01"
+	uint32_t eventCount;
+	uint32_t bodyCount;
+	double startDay, endDay;        // span searched
+};
+
+bool writeEventIndex(const char* path, const BodyTable& bodies, const EventSearch& search,
+	const std::vector<EventRecord>& events);
+
+// Read-only view of an event file, memory mapped like Ephemeris. Lookups are
+// a binary search over the records, so jumping to the next event costs the
+// same for a hundred events as for a million.
+class EventIndex
+{
+public:
+	EventIndex();
+	~EventIndex();
+
+	// Maps path; false (and a message) when it is missing or not an event file
+	bool open(const char* path);
+	void close();
+	bool isOpen() const { return file.isOpen(); }
+
+	size_t count() const { return header != NULL ? header->eventCount : 0; }
+	const EventRecord& at(size_t k) const { return records[k]; }
+	const char* bodyName(int32_t body) const;
+	double startDay() const { return header->startDay; }
+	double endDay() const { return header->endDay; }
+
+	// First event after t and last event before t; count() when there is none
+	size_t next(double t) const;
+	size_t previous(double t) const;
+
+	// "Eclipse solar: Lua - Terra" style text for the HUD
+	std::string describe(size_t k) const;
+
+private:
+	MappedFile file;
+	const EventIndexHeader* header;
+	const char (*names)[32];
+	const EventRecord* records;
+
+	EventIndex(const EventIndex&) = delete;
+	EventIndex& operator=(const EventIndex&) = delete;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// View frustum culling of bounding spheres, so the viewer only hands the GPU
+// the instances that can reach the screen. Part of the Orbitas library.
+
+// The six planes of a frustum (left, right, bottom, top, near, far) as
+// (a, b, c, d) with a x + b y + c z + d the signed distance, positive inside
+struct Frustum
+{
+	float planes[6][4];
+};
+
+// Planes of projection * view (Gribb and Hartmann), normalised, in the
+// coordinates the matrix is applied to (world space for projection * view).
+// The matrix is 16 floats, column-major as OpenGL and glm store it, so the
+// viewer passes glm::value_ptr(projection * view).
+Frustum frustumFromMatrix(const float* projectionView);
+
+// Indices of the spheres a cull found visible, ascending: the first count
+// entries of index. Kept from one cull to the next, so its buffers only grow.
+struct VisibleSet
+{
+	std::vector<uint32_t> index;
+	size_t count = 0;
+	std::vector<size_t> blockCounts;
+};
+
+// Tests spheres 0..count-1 (centres x, y, z, radii radius; radius NULL gives
+// all of them commonRadius) against the six planes, a vector of floats at a
+// time, and writes the ones not entirely outside one of them to out. Blocks
+// of spheres are spread over jobs and compacted in order afterwards.
+// Conservative: a sphere near a corner may pass although it is off screen.
+void cullSpheres(const Frustum& frustum, const float* x, const float* y, const float* z,
+	const float* radius, float commonRadius, size_t count, VisibleSet& out, JobSystem* jobs = NULL);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef HIERARCHY_HPP
+#define HIERARCHY_HPP
+
+#include <cstddef>
+#include <vector>
+
+// Parent-relative transform hierarchy stored as flat arrays. Nodes are kept in
+// depth-first order: every parent comes before its children and each subtree
+// occupies the contiguous range [i, subtreeEnd[i]). World positions are then
+// one linear pass, and disjoint subtrees can be composed independently.
+
+// Depth-first order of the forest described by parent (-1 = root); order[k] is
+// the current index of the node that goes to position k. Siblings keep their
+// relative order. Returns false if parent contains a cycle.
+bool depthFirstOrder(const std::vector<int>& parent, std::vector<int>& order);
+
+// For a forest already in depth-first order
+void computeSubtreeEnds(const std::vector<int>& parent, std::vector<int>& subtreeEnd);
+
+// Splits a depth-first forest into work that can run side by side: the roots,
+// which only depend on themselves, and the subtrees hanging directly off them
+// (branches), which only depend on their root and on nothing in other branches
+void independentSubtrees(const std::vector<int>& parent, const std::vector<int>& subtreeEnd,
+	std::vector<int>& roots, std::vector<int>& branches);
+
+// world = local * scale + world[parent] for the nodes in [begin, end). Parents
+// outside the range must already hold their final world position.
+void composeTransforms(const int* parent, size_t begin, size_t end, double scale,
+	const double* localX, const double* localY, const double* localZ,
+	float* worldX, float* worldY, float* worldZ);
+
+#endif
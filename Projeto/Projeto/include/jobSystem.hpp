@@ -0,0 +1,122 @@
+#ifndef JOBSYSTEM_HPP
+#define JOBSYSTEM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing scheduler for data-parallel loops. Every worker has its own
+// deque: it pushes and pops at the back, idle workers steal from the front of
+// the others, so big ranges get split where the work is and small ones stay on
+// one core. Any thread may call parallelFor (the render and simulation threads
+// both do). While it waits the caller only works on its own loop, never on
+// another caller's, so a frame does not wait on the jobs of a simulation step.
+class JobSystem
+{
+public:
+	// workers threads besides the callers; 0 runs every loop on the caller
+	explicit JobSystem(unsigned workers);
+	~JobSystem();
+
+	// Hardware threads minus one for the caller, or PROJETO_WORKERS if set
+	static unsigned defaultWorkerCount();
+
+	unsigned workerCount() const { return (unsigned)threads.size(); }
+
+	// Calls body(first, last) over disjoint subranges covering [begin, end),
+	// none longer than grain, and returns once all of them are done. Ranges
+	// are split at multiples of grain.
+	template <typename Body>
+	void parallelFor(size_t begin, size_t end, size_t grain, const Body& body)
+	{
+		Loop loop;
+		loop.invoke = &invokeBody<Body>;
+		loop.context = &body;
+		run(loop, begin, end, grain);
+	}
+
+private:
+	// Type-erased loop body; lives on the caller's stack for the whole loop,
+	// so nothing is allocated per call
+	struct Loop
+	{
+		void (*invoke)(const void* context, size_t first, size_t last);
+		const void* context;
+		size_t grain;
+		std::atomic<size_t> remaining;
+	};
+
+	struct Job
+	{
+		Loop* loop;
+		size_t begin, end;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	template <typename Body>
+	static void invokeBody(const void* context, size_t first, size_t last)
+	{
+		(*static_cast<const Body*>(context))(first, last);
+	}
+
+	// Queues for threads that are not workers; more callers than this share them
+	static const unsigned callerQueues = 4;
+
+	std::vector<std::thread> threads;
+	// One queue per worker, then callerQueues for outside callers
+	std::vector<std::unique_ptr<Queue> > queues;
+	std::atomic<unsigned> nextCallerQueue;
+	std::atomic<int> queuedJobs;
+	std::atomic<bool> stopping;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	void run(Loop& loop, size_t begin, size_t end, size_t grain);
+	void push(size_t queue, const Job& job);
+	size_t threadQueue();
+	bool popOrSteal(size_t queue, const Loop* only, Job& job);
+	void execute(size_t queue, Job job);
+	void workerMain(size_t queue);
+};
+
+// Sum of partial(first, last) over [begin, end) cut into blocks of grain,
+// the block sums added pairwise in a fixed order. The result depends on grain
+// only, never on the number of workers or on who ran which block, so it is
+// the same on every machine. jobs may be NULL.
+template <typename Partial>
+double deterministicSum(JobSystem* jobs, size_t begin, size_t end, size_t grain, const Partial& partial)
+{
+	if (end <= begin)
+		return 0.0;
+	grain = grain > 0 ? grain : 1;
+	std::vector<double> sums((end - begin + grain - 1) / grain);
+	auto blocks = [&](size_t first, size_t last) {
+		for (size_t b = first; b < last; b++)
+			sums[b] = partial(begin + b * grain, std::min(end, begin + (b + 1) * grain));
+	};
+	if (jobs != NULL)
+		jobs->parallelFor(0, sums.size(), 1, blocks);
+	else
+		blocks(0, sums.size());
+
+	for (size_t stride = 1; stride < sums.size(); stride *= 2)
+		for (size_t b = 0; b + stride < sums.size(); b += 2 * stride)
+			sums[b] += sums[b + stride];
+	return sums[0];
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef KEPLER_HPP
+#define KEPLER_HPP
+
+#include <cstddef>
+
+// Batch two-body propagation from absolute time. Elements are given as
+// separate arrays (structure of arrays), one entry per body:
+//   semiMajorAxis  any length unit, output uses the same unit
+//   eccentricity   0 <= e < 1
+//   meanMotion     radians per day (2 pi / period)
+//   meanAnomaly0   mean anomaly at t = 0, radians
+// For every body Kepler's equation E - e sin E = M is solved at time t (days)
+// and the position in the orbital plane is written to outX/outZ, with the
+// periapsis on +Z and motion towards +X. The cost does not depend on t, so
+// any date can be evaluated directly.
+void propagateKepler(size_t count, const double* semiMajorAxis, const double* eccentricity,
+	const double* meanMotion, const double* meanAnomaly0, double t, double* outX, double* outZ);
+
+// Same as above, also writing the velocity (length unit per day) to outVX/outVZ
+void propagateKepler(size_t count, const double* semiMajorAxis, const double* eccentricity,
+	const double* meanMotion, const double* meanAnomaly0, double t, double* outX, double* outZ,
+	double* outVX, double* outVZ);
+
+// Name of the instruction set the propagator was compiled for
+const char* keplerInstructionSet();
+
+#endif
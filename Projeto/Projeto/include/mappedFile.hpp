@@ -0,0 +1,38 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+
+// Read-only memory map of a whole file, for the formats that are read in
+// place (Ephemeris, EventIndex): pages are loaded by the OS as they are
+// touched and shared between processes. Part of the Orbitas library.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Maps path; false (and a message) when it is missing, shorter than
+	// minimumBytes or cannot be mapped
+	bool open(const char* path, size_t minimumBytes);
+	void close();
+	bool isOpen() const { return view != NULL; }
+
+	const unsigned char* data() const { return view; }
+	size_t size() const { return bytes; }
+
+private:
+	const unsigned char* view;
+	size_t bytes;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int file;
+#endif
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef NBODY_HPP
+#define NBODY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// Barnes-Hut octree over a set of point masses. Particles are sorted along a
+// Morton (Z-order) curve, so every node owns a contiguous range of them and
+// particles that are close in space are close in memory during the walk.
+class BarnesHutTree
+{
+public:
+	// Particles per leaf; smaller leaves mean deeper trees and more nodes
+	static const int leafSize = 16;
+	// Largest subtree that shares one tree walk when computing forces
+	static const int groupSize = 64;
+
+	void build(size_t count, const double* x, const double* y, const double* z, const double* mass, JobSystem* jobs);
+
+	// Acceleration on every particle used in build(). A node of size s seen from
+	// distance d is replaced by its centre of mass when s < theta * d; theta = 0
+	// is the exact O(N^2) sum. softening (Plummer) keeps close pairs finite;
+	// values below nbodyMinimumSoftening are raised to it.
+	// With rung given, only groups holding a particle with rung >= minRung are
+	// evaluated (other particles may be refreshed too, never left stale).
+	// Every particle's sum is made by one thread in a fixed order, so the
+	// result never depends on the number of workers; deterministic also makes
+	// it independent of the processor and of the vector width of the build.
+	void accelerations(double G, double theta, double softening, double* ax, double* ay, double* az, JobSystem* jobs,
+		const unsigned char* rung = NULL, int minRung = 0, bool deterministic = false) const;
+
+	size_t nodeCount() const { return nodes.size(); }
+	// Particle indices in Morton order, as of the last build
+	const std::vector<int>& mortonOrder() const { return order; }
+
+private:
+	struct Node
+	{
+		double comX, comY, comZ, mass;          // centre of mass
+		double centerX, centerY, centerZ, half; // cube bounds
+		int firstChild, childCount;             // children are contiguous, none for leaves
+		int first, last;                        // particle range in Morton order
+	};
+
+	std::vector<Node> nodes;
+	std::vector<int> groups;                    // walk groups in Morton order
+	std::vector<uint64_t> keys, sortedKeys;
+	std::vector<size_t> radixOffsets;
+	std::vector<int> order, sortedOrder;        // Morton position -> particle index
+	std::vector<double> px, py, pz, pm;         // particles in Morton order
+
+	void buildNode(int index, int first, int last, int level, double centerX, double centerY, double centerZ, double half, bool inGroup);
+	void accelerationRange(size_t firstGroup, size_t lastGroup, double G, double theta2, double eps2,
+		double* ax, double* ay, double* az, bool deterministic) const;
+};
+
+// Smallest softening the float kernels can take, AU (about 150 m). A particle
+// meets itself at distance 0 in its own interaction list; that entry only
+// adds 0 * m / softening^3 while the product stays finite in float.
+const double nbodyMinimumSoftening = 1e-9;
+
+// Self-gravitating particles in structure-of-arrays form. Units are AU, days
+// and solar masses, so G is the Gaussian gravitational constant squared.
+struct NBodySystem
+{
+	double G = 2.959122082855911e-4;
+	double theta = 0.5;                     // Barnes-Hut opening angle
+	double softening = 1e-4;                // AU, at least nbodyMinimumSoftening
+	// Bit-identical results on any machine and worker count, a little slower
+	// (see BarnesHutTree::accelerations). Builds must not contract
+	// multiply-adds either, which /fp:precise, the default, does not.
+	bool deterministic = false;
+
+	std::vector<double> x, y, z;            // AU
+	std::vector<double> vx, vy, vz;         // AU per day
+	std::vector<double> ax, ay, az;         // AU per day^2, valid for the current positions
+	std::vector<double> mass;               // solar masses
+
+	bool accelerationsValid = false;
+	BarnesHutTree tree;
+
+	// Block time steps: particle i moves with dt / 2^rung[i], where the rung is
+	// picked at every full step from eta * |v| / |a|, a fraction of its orbital
+	// time scale. maxRung caps the number of substeps at 2^maxRung.
+	double eta = 0.02;
+	int maxRung = 16;
+	std::vector<unsigned char> rung;
+	int lastSubsteps = 0;                   // substeps taken by the last blockLeapfrogStep
+	size_t lastForceEvaluations = 0;        // particles whose force was computed in it
+
+	// The arrays are kept in Morton order of the positions, re-sorted every
+	// sortInterval steps, so the tree build and walk read them almost in
+	// sequence. id[k] is the order in which the particle at index k was
+	// added and slot its inverse: code outside the integrator goes through
+	// slot and sees stable numbers. The first pinned particles never move.
+	std::vector<int> id, slot;
+	size_t pinned = 0;
+	int sortInterval = 8;                   // 0 = keep the order particles were added in
+	int stepsSinceSort = 0;
+	std::vector<double> sortScratch;
+	std::vector<int> sortFrom;
+
+	size_t size() const { return x.size(); }
+	void add(double px, double py, double pz, double pvx, double pvy, double pvz, double m);
+};
+
+// Rebuilds the tree and refreshes ax/ay/az
+void computeAccelerations(NBodySystem& system, JobSystem* jobs);
+
+// Moves the particles (except the pinned ones) into the Morton order of the
+// last tree build and updates id and slot. The integrators call it every
+// sortInterval steps.
+void sortParticles(NBodySystem& system, JobSystem* jobs);
+
+// One kick-drift-kick leapfrog step of dt days: second order and symplectic,
+// so orbits keep their energy over long runs instead of spiralling out
+void leapfrogStep(NBodySystem& system, double dt, JobSystem* jobs);
+
+// Same integrator with per-particle block time steps: every particle still
+// advances by dt, but fast inner orbits take 2^rung substeps while slow outer
+// ones take one, and forces are only recomputed for particles ending a substep
+void blockLeapfrogStep(NBodySystem& system, double dt, JobSystem* jobs);
+
+// Kinetic plus potential energy by direct summation, O(N^2): for checking the
+// integrators on small systems. The rows are spread over jobs and added with
+// deterministicSum, so the value does not depend on the worker count.
+double totalEnergy(const NBodySystem& system, JobSystem* jobs = NULL);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef ORBITS_HPP
+#define ORBITS_HPP
+
+#include <cstddef>
+#include <vector>
+
+struct BodyTable;
+class JobSystem;
+class Ephemeris;
+
+// Batch evaluation of a body table at many dates, for headless jobs. This is
+// part of the Orbitas static library (kepler, hierarchy, bodyTable, nbody,
+// ephemeris, planetTheory, closeApproach, events, porkchop, frustum,
+// mappedFile, jobSystem), which has no GL or window dependency; the viewer
+// links against it.
+//
+// Positions are in AU along the scene's axes (orbits in the XZ plane, see
+// bodyTable.cpp), relative to the root of each body's hierarchy. The layout
+// is body-major: the dates of one body are contiguous.
+struct PositionGrid
+{
+	size_t bodyCount = 0, timeCount = 0;
+	std::vector<double> x, y, z;
+
+	size_t index(size_t body, size_t time) const { return body * timeCount + time; }
+};
+
+// Positions of every body of the table at times[0..timeCount) (days from the
+// table's t = 0), as updateBodyTable would give them: Kepler orbits, series
+// theories, and the ephemeris for the bodies bound to it (see bindEphemeris).
+// The table is only read, so several batches may run at once. Dates are
+// split into blocks spread over jobs, and each body's orbit is solved for a
+// whole block at a time, so small tables still fill the vector lanes.
+// N-body scenes give the analytic orbits of their bodies.
+void positions(const BodyTable& bodies, const double* times, size_t timeCount, PositionGrid& out,
+	JobSystem* jobs = NULL, const Ephemeris* ephemeris = NULL);
+
+// One body at one date, the same position positions() gives, for searches
+// that refine a date one evaluation at a time
+void bodyPosition(const BodyTable& bodies, size_t body, double t, double& x, double& y, double& z,
+	const Ephemeris* ephemeris = NULL);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef PLANETTHEORY_HPP
+#define PLANETTHEORY_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Semi-analytic theories of motion: long trigonometric series fitted by the
+// Bureau des longitudes to numerical integrations. The series are read from
+// the published data files, which are not part of this repository:
+//   VSOP87 (Bretagnon & Francou), planets: one file per planet and version,
+//     e.g. VSOP87A.ear, ftp://ftp.imcce.fr/pub/ephem/planets/vsop87
+//   ELP 2000-82B (Chapront-Touze & Chapront), Moon: the main problem files
+//     ELP1 (longitude), ELP2 (latitude) and ELP3 (distance)
+// Every series is Sum A cos(phase + Sum m_k theta_k(T)), with its terms sorted
+// by decreasing amplitude, so a tolerance simply keeps a prefix of each one.
+// The tolerance is in radians: angles are compared directly and distances
+// relative to the body's mean distance, so 1e-6 drops terms below ~0.2".
+// Evaluation reads only the kept terms, simd::width of them at a time.
+class PlanetTheory
+{
+public:
+	virtual ~PlanetTheory() {}
+
+	// Position relative to the central body (the Sun for VSOP87, the Earth for
+	// ELP) at Julian day jd (TDB), ecliptic and equinox J2000, AU. Terms
+	// smaller than tolerance are skipped; 0 evaluates the full series.
+	virtual void position(double jd, double tolerance, double& x, double& y, double& z) const = 0;
+
+	// Terms position() reads at this tolerance, summed over the coordinates
+	virtual size_t termCount(double tolerance) const = 0;
+
+	// Mean distance from the central body, AU
+	virtual double meanDistance() const = 0;
+};
+
+// One trigonometric series in structure-of-arrays form. The m_k are stored as
+// doubles so the argument is a few multiply-adds in vector registers.
+struct TrigSeries
+{
+	int arguments = 0;              // number of theta_k, 1 for VSOP87 (theta = T), 4 for ELP
+	std::vector<double> amplitude, phase;
+	std::vector<double> multiplier[4];
+
+	size_t size() const { return amplitude.size(); }
+	// Terms with |amplitude| >= threshold, a prefix once sorted
+	size_t kept(double threshold) const;
+	void add(double a, double p, const double* m);
+	// Orders the terms by decreasing |amplitude|
+	void sort();
+	// Sum over the first count terms of amplitude * cos(phase + Sum m_k theta_k)
+	double evaluate(size_t count, const double* theta) const;
+};
+
+// A VSOP87 file: three coordinates, each a polynomial in T (Julian millennia
+// from J2000) whose coefficients are series. Versions A, C and E are
+// rectangular, B and D spherical (L, B, R) and are converted on evaluation.
+class Vsop87Theory : public PlanetTheory
+{
+public:
+	bool load(const char* path);
+
+	void position(double jd, double tolerance, double& x, double& y, double& z) const;
+	size_t termCount(double tolerance) const;
+	double meanDistance() const { return distance; }
+
+private:
+	static const int maxPower = 6;
+	TrigSeries series[3][maxPower];
+	bool spherical = false;
+	double distance = 1.0;
+};
+
+// The main problem of ELP 2000-82B: geocentric longitude, latitude and
+// distance of the Moon as series of the Delaunay arguments D, l', l, F.
+// Longitudes are of date; precession in longitude brings them back to J2000.
+class Elp82Theory : public PlanetTheory
+{
+public:
+	// Reads ELP1, ELP2 and ELP3 from directory
+	bool load(const std::string& directory);
+
+	void position(double jd, double tolerance, double& x, double& y, double& z) const;
+	size_t termCount(double tolerance) const;
+	double meanDistance() const;
+
+private:
+	TrigSeries longitude, latitude, distance;
+};
+
+#endif
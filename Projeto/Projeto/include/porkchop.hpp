@@ -0,0 +1,63 @@
+#ifndef PORKCHOP_HPP
+#define PORKCHOP_HPP
+
+#include <cstddef>
+#include <vector>
+
+struct BodyTable;
+class JobSystem;
+class Ephemeris;
+
+// Transfer windows between two bodies orbiting the same parent: a Lambert
+// problem solved for every pair of departure and arrival dates of a grid (the
+// "porkchop plot"). Body positions come from positions(), so series theories
+// and ephemerides are used where the scene has them; their velocities are
+// central differences of the positions.
+//
+// Each cell is the zero revolution, prograde transfer (universal variables,
+// Newton's method on z kept inside a bracket). Rows of departure dates are
+// spread over the job system and the arrival dates of a row are solved
+// simd::width at a time. The parent's GM is taken from the departure body's
+// orbit (a^3 n^2), so the transfers agree with the scene's own periods.
+
+struct PorkchopSearch
+{
+	double departureBegin = 0.0, departureEnd = 730.0;     // days
+	double arrivalBegin = 100.0, arrivalEnd = 1100.0;      // days
+	size_t departureCount = 1000, arrivalCount = 1000;
+	double minimumFlight = 10.0;                            // days, shorter cells are left empty
+};
+
+// Speeds in km/s, C3 in km^2/s^2; cells without a transfer hold NaN. Layout is
+// departure-major: the arrival dates of one departure are contiguous.
+struct PorkchopGrid
+{
+	int from = -1, to = -1;
+	size_t departureCount = 0, arrivalCount = 0;
+	std::vector<double> departure, arrival;     // days
+	std::vector<float> c3;                      // departure hyperbolic excess speed squared
+	std::vector<float> arrivalSpeed;            // arrival hyperbolic excess speed
+	std::vector<float> deltaV;                  // sum of both excess speeds
+
+	size_t index(size_t d, size_t a) const { return d * arrivalCount + a; }
+	double flightTime(size_t d, size_t a) const { return arrival[a] - departure[d]; }
+	// Cell with the lowest deltaV, or departureCount * arrivalCount if there is none
+	size_t best() const;
+};
+
+// Arrival window for departures in [departureBegin, departureEnd]: from half
+// to twice the Hohmann transfer time between the two orbits
+PorkchopSearch porkchopWindow(const BodyTable& bodies, int from, int to, double departureBegin, double departureEnd);
+
+// Fills the grid; false (and a message) if the bodies are not distinct
+// bodies with an orbit around the same parent
+bool computePorkchop(const BodyTable& bodies, int from, int to, const PorkchopSearch& search, PorkchopGrid& out,
+	JobSystem* jobs = NULL, const Ephemeris* ephemeris = NULL);
+
+// deltaV colour mapped to RGBA8, departure along x and arrival along y (row 0
+// is the earliest arrival, as glTexImage2D expects). Blue is the cheapest
+// transfer, red maxDeltaV; every kilometre per second is marked by a darker
+// contour line, and cells above maxDeltaV or without a transfer are transparent.
+void porkchopImage(const PorkchopGrid& grid, float maxDeltaV, std::vector<unsigned char>& rgba);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef QUERYSERVER_HPP
+#define QUERYSERVER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Local position server: other programs ask for body positions over a Unix
+// domain socket (AF_UNIX, also on Windows 10 and later) instead of each
+// re-implementing the orbits. Requests are answered with positions() (see
+// orbits.hpp) from the scene the server loaded.
+//
+// The protocol is binary, native byte order, one request and one response at
+// a time per connection:
+//   request   QueryRequest, then bodyCount int32 body indices and timeCount
+//             doubles (days from the scene's t = 0)
+//   response  QueryResponse, then the payload unless it is in shared memory
+// Positions come as [body][time][x y z] doubles, AU, in the scene's axes
+// relative to the roots. Payloads above sharedThreshold bytes are written to
+// a shared memory block owned by the connection; its name is in the
+// response and it stays valid until the connection's next request.
+// Requests for more bodies than the scene has or more than 2^22 dates are
+// refused (status 1) and the connection closed; answers above 256 MB are
+// refused and the connection stays usable.
+
+static const uint32_t queryMagic = 0x514A5250;      // "PRJQ"
+static const size_t sharedThreshold = 64 * 1024;
+
+enum QueryKind
+{
+	queryPositions = 0,     // bodyCount 0 asks for every body
+	queryNames = 1,         // payload: the body names, each ended by '\0'
+	queryStats = 2          // payload: a QueryStats
+};
+
+struct QueryRequest
+{
+	uint32_t magic;
+	uint32_t kind;
+	uint32_t bodyCount;
+	uint32_t timeCount;
+};
+
+struct QueryResponse
+{
+	uint32_t magic;
+	uint32_t status;                // 0 ok, otherwise the request was refused
+	uint64_t bytes;                 // payload size
+	uint32_t shared;                // 1 when the payload is in the block below
+	char sharedName[60];
+};
+
+struct QueryStats
+{
+	uint64_t requests, positions, bytes;
+	double totalMilliseconds, maxMilliseconds;
+};
+
+// Listens on socketPath until the process is stopped, answering from the
+// scene at scenePath. Returns the exit code when it cannot start.
+int runQueryServer(const char* socketPath, const char* scenePath);
+
+// Client side of the protocol. Payloads are not copied: the pointers returned
+// point into the shared block or the client's receive buffer and stay valid
+// until the next call.
+class QueryClient
+{
+public:
+	QueryClient();
+	~QueryClient();
+
+	bool connect(const char* socketPath);
+	void close();
+
+	// Positions of bodies (empty = all) at times; count is set to the number
+	// of doubles, 3 * bodies * times
+	const double* positions(const std::vector<int>& bodies, const std::vector<double>& times, size_t& count);
+	bool names(std::vector<std::string>& bodyNames);
+	bool stats(QueryStats& counters);
+
+private:
+	intptr_t socket;
+	std::vector<unsigned char> received;
+	std::string mappedName;
+	void* view;
+	size_t viewBytes;
+#ifdef _WIN32
+	void* mapping;
+#endif
+
+	const unsigned char* request(uint32_t kind, const std::vector<int>& bodies, const std::vector<double>& times,
+		uint64_t& bytes);
+	void unmap();
+
+	QueryClient(const QueryClient&) = delete;
+	QueryClient& operator=(const QueryClient&) = delete;
+};
+
+#endif
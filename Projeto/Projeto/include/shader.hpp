@@ -1,6 +1,106 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
+#include <string>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Reads, compiles and links a program, or restores it from the on-disk
+// program binary cache (shadercache/, see shader.cpp) when the driver supports
+// it and has linked the same sources before. Prints only compile and link logs.
+// defines is a space separated list of macros ("EMISSIVE") inserted as
+// #define lines after the #version line of both sources.
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines = NULL);
+
+// Specialisations of one vertex + fragment pair, selected in the sources with
+// #if defined(LIT) / #elif defined(EMISSIVE), so each draw only pays for the
+// shading it needs (a source must handle both):
+//   variantLit       Phong lighting from the light in the Frame block
+//   variantEmissive  the ambient term alone, for bodies that are the light
+enum ShaderVariant
+{
+	variantLit = 0,
+	variantEmissive,
+	variantCount
+};
+
+const char * shaderVariantDefines(ShaderVariant variant);
+
+// Builds each variant of a pair the first time it is asked for, then returns
+// the same program
+class ShaderPermutations
+{
+public:
+	ShaderPermutations(const char * vertex_file_path, const char * fragment_file_path);
+	~ShaderPermutations();
+
+	GLuint program(ShaderVariant variant);
+
+private:
+	std::string vertexPath, fragmentPath;
+	GLuint programs[variantCount];
+
+	ShaderPermutations(const ShaderPermutations&) = delete;
+	ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+};
+
+// Programs LoadShaders restored from the cache or compiled since startup, and
+// the time it spent on them: a cold start (empty cache) against a warm one
+struct ShaderLoadStats
+{
+	unsigned cached = 0, compiled = 0;
+	double milliseconds = 0.0;
+};
+const ShaderLoadStats& shaderLoadStats();
+
+// Location of a uniform of a program made by LoadShaders, read from the table
+// it fills at link time; -1 (and a message) if the program has no such uniform.
+// Meant for setting up handles, not for every frame.
+GLint uniformLocation(GLuint programID, const char * name);
+
+// Typed handle to one uniform of one program, resolved once; set() only calls
+// glUniform* on the location, for the program currently in use
+inline void setUniform(GLint location, int value) { glUniform1i(location, value); }
+inline void setUniform(GLint location, float value) { glUniform1f(location, value); }
+inline void setUniform(GLint location, const glm::vec3& value) { glUniform3fv(location, 1, &value[0]); }
+inline void setUniform(GLint location, const glm::mat4& value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+
+template <typename T>
+struct Uniform
+{
+	GLint location = -1;
+
+	Uniform() {}
+	Uniform(GLuint programID, const char * name) : location(uniformLocation(programID, name)) {}
+	void set(const T& value) const { setUniform(location, value); }
+};
+
+// Per-frame camera and light data, one std140 uniform block ("Frame") shared by
+// every program that declares it. LoadShaders binds the block to
+// frameUniformBinding, so updating the buffer once a frame reaches them all.
+const GLuint frameUniformBinding = 0;
+
+struct FrameUniforms
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec4 viewPos;      // xyz used; std140 pads vec3 to 16 bytes anyway
+	glm::vec4 lightPos;
+	glm::vec4 lightColor;
+};
+
+class FrameUniformBuffer
+{
+public:
+	FrameUniformBuffer();
+	~FrameUniformBuffer();
+	void update(const FrameUniforms& frame);
+
+private:
+	GLuint buffer;
+
+	FrameUniformBuffer(const FrameUniformBuffer&) = delete;
+	FrameUniformBuffer& operator=(const FrameUniformBuffer&) = delete;
+};
 
 #endif
@@ -0,0 +1,307 @@
+#ifndef SIMDMATH_HPP
+#define SIMDMATH_HPP
+
+// Thin wrapper over the widest double precision vector unit the compiler was
+// told it may use: AVX2 (4 lanes, /arch:AVX2 or -mavx2), SSE2 (2 lanes, always
+// available on x64) or plain scalar code. Algorithms are written once against
+// vdouble/vmask and get the right width at compile time. vfloat is the single
+// precision counterpart (twice the lanes) for kernels that can afford it.
+
+#include <cmath>
+
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#else
+#define SIMD_SCALAR 1
+#endif
+
+namespace simd {
+
+#if defined(SIMD_AVX2)
+
+const int width = 4;
+inline const char* name() { return "AVX2"; }
+
+struct vmask { __m256d m; };
+struct vdouble
+{
+	__m256d v;
+	vdouble() {}
+	vdouble(__m256d x) : v(x) {}
+	vdouble(double d) : v(_mm256_set1_pd(d)) {}
+	static vdouble load(const double* p) { return _mm256_loadu_pd(p); }
+	void store(double* p) const { _mm256_storeu_pd(p, v); }
+};
+
+inline vdouble operator+(vdouble a, vdouble b) { return _mm256_add_pd(a.v, b.v); }
+inline vdouble operator-(vdouble a, vdouble b) { return _mm256_sub_pd(a.v, b.v); }
+inline vdouble operator*(vdouble a, vdouble b) { return _mm256_mul_pd(a.v, b.v); }
+inline vdouble operator/(vdouble a, vdouble b) { return _mm256_div_pd(a.v, b.v); }
+inline vdouble operator-(vdouble a) { return _mm256_xor_pd(a.v, _mm256_set1_pd(-0.0)); }
+inline vdouble sqrt(vdouble a) { return _mm256_sqrt_pd(a.v); }
+inline vdouble abs(vdouble a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v); }
+inline vdouble min(vdouble a, vdouble b) { return _mm256_min_pd(a.v, b.v); }
+inline vdouble max(vdouble a, vdouble b) { return _mm256_max_pd(a.v, b.v); }
+inline vdouble round(vdouble a) { return _mm256_round_pd(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+inline vdouble floor(vdouble a) { return _mm256_floor_pd(a.v); }
+
+inline vmask operator<(vdouble a, vdouble b) { vmask r = { _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ) }; return r; }
+inline vmask operator>(vdouble a, vdouble b) { vmask r = { _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ) }; return r; }
+inline vmask operator<=(vdouble a, vdouble b) { vmask r = { _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ) }; return r; }
+inline vmask operator>=(vdouble a, vdouble b) { vmask r = { _mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ) }; return r; }
+inline vmask operator==(vdouble a, vdouble b) { vmask r = { _mm256_cmp_pd(a.v, b.v, _CMP_EQ_OQ) }; return r; }
+inline vmask operator&(vmask a, vmask b) { vmask r = { _mm256_and_pd(a.m, b.m) }; return r; }
+inline vmask operator|(vmask a, vmask b) { vmask r = { _mm256_or_pd(a.m, b.m) }; return r; }
+inline bool any(vmask a) { return _mm256_movemask_pd(a.m) != 0; }
+inline bool all(vmask a) { return _mm256_movemask_pd(a.m) == 0xF; }
+// Lane-wise a where mask is set, b elsewhere
+inline vdouble select(vmask mask, vdouble a, vdouble b) { return _mm256_blendv_pd(b.v, a.v, mask.m); }
+
+const int floatWidth = 8;
+
+struct vfloat
+{
+	__m256 v;
+	vfloat() {}
+	vfloat(__m256 x) : v(x) {}
+	vfloat(float f) : v(_mm256_set1_ps(f)) {}
+	static vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+// ~12 bit estimate of 1 / sqrt(a)
+inline vfloat rsqrtEstimate(vfloat a) { return _mm256_rsqrt_ps(a.v); }
+inline vfloat rsqrtExact(vfloat a) { return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(a.v)); }
+
+struct vfmask { __m256 m; };
+inline vfmask operator>=(vfloat a, vfloat b) { vfmask r = { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; return r; }
+inline vfmask operator&(vfmask a, vfmask b) { vfmask r = { _mm256_and_ps(a.m, b.m) }; return r; }
+// Lane l in bit l
+inline int bits(vfmask a) { return _mm256_movemask_ps(a.m); }
+
+#elif defined(SIMD_SSE2)
+
+const int width = 2;
+inline const char* name() { return "SSE2"; }
+
+struct vmask { __m128d m; };
+struct vdouble
+{
+	__m128d v;
+	vdouble() {}
+	vdouble(__m128d x) : v(x) {}
+	vdouble(double d) : v(_mm_set1_pd(d)) {}
+	static vdouble load(const double* p) { return _mm_loadu_pd(p); }
+	void store(double* p) const { _mm_storeu_pd(p, v); }
+};
+
+inline vdouble operator+(vdouble a, vdouble b) { return _mm_add_pd(a.v, b.v); }
+inline vdouble operator-(vdouble a, vdouble b) { return _mm_sub_pd(a.v, b.v); }
+inline vdouble operator*(vdouble a, vdouble b) { return _mm_mul_pd(a.v, b.v); }
+inline vdouble operator/(vdouble a, vdouble b) { return _mm_div_pd(a.v, b.v); }
+inline vdouble operator-(vdouble a) { return _mm_xor_pd(a.v, _mm_set1_pd(-0.0)); }
+inline vdouble sqrt(vdouble a) { return _mm_sqrt_pd(a.v); }
+inline vdouble abs(vdouble a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a.v); }
+inline vdouble min(vdouble a, vdouble b) { return _mm_min_pd(a.v, b.v); }
+inline vdouble max(vdouble a, vdouble b) { return _mm_max_pd(a.v, b.v); }
+
+inline vmask operator<(vdouble a, vdouble b) { vmask r = { _mm_cmplt_pd(a.v, b.v) }; return r; }
+inline vmask operator>(vdouble a, vdouble b) { vmask r = { _mm_cmpgt_pd(a.v, b.v) }; return r; }
+inline vmask operator<=(vdouble a, vdouble b) { vmask r = { _mm_cmple_pd(a.v, b.v) }; return r; }
+inline vmask operator>=(vdouble a, vdouble b) { vmask r = { _mm_cmpge_pd(a.v, b.v) }; return r; }
+inline vmask operator==(vdouble a, vdouble b) { vmask r = { _mm_cmpeq_pd(a.v, b.v) }; return r; }
+inline vmask operator&(vmask a, vmask b) { vmask r = { _mm_and_pd(a.m, b.m) }; return r; }
+inline vmask operator|(vmask a, vmask b) { vmask r = { _mm_or_pd(a.m, b.m) }; return r; }
+inline bool any(vmask a) { return _mm_movemask_pd(a.m) != 0; }
+inline bool all(vmask a) { return _mm_movemask_pd(a.m) == 0x3; }
+inline vdouble select(vmask mask, vdouble a, vdouble b) { return _mm_or_pd(_mm_and_pd(mask.m, a.v), _mm_andnot_pd(mask.m, b.v)); }
+
+const int floatWidth = 4;
+
+struct vfloat
+{
+	__m128 v;
+	vfloat() {}
+	vfloat(__m128 x) : v(x) {}
+	vfloat(float f) : v(_mm_set1_ps(f)) {}
+	static vfloat load(const float* p) { return _mm_loadu_ps(p); }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat rsqrtEstimate(vfloat a) { return _mm_rsqrt_ps(a.v); }
+inline vfloat rsqrtExact(vfloat a) { return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(a.v)); }
+
+struct vfmask { __m128 m; };
+inline vfmask operator>=(vfloat a, vfloat b) { vfmask r = { _mm_cmpge_ps(a.v, b.v) }; return r; }
+inline vfmask operator&(vfmask a, vfmask b) { vfmask r = { _mm_and_ps(a.m, b.m) }; return r; }
+inline int bits(vfmask a) { return _mm_movemask_ps(a.m); }
+
+// SSE2 has no rounding instruction: adding and removing 1.5 * 2^52 rounds to
+// nearest for |a| < 2^51, far beyond any angle or index we feed it
+inline vdouble round(vdouble a)
+{
+	const __m128d magic = _mm_set1_pd(6755399441055744.0);
+	return _mm_sub_pd(_mm_add_pd(a.v, magic), magic);
+}
+inline vdouble floor(vdouble a)
+{
+	vdouble r = round(a);
+	return select(r > a, r - vdouble(1.0), r);
+}
+
+#else
+
+const int width = 1;
+inline const char* name() { return "scalar"; }
+
+struct vmask { bool m; };
+struct vdouble
+{
+	double v;
+	vdouble() {}
+	vdouble(double d) : v(d) {}
+	static vdouble load(const double* p) { return *p; }
+	void store(double* p) const { *p = v; }
+};
+
+inline vdouble operator+(vdouble a, vdouble b) { return a.v + b.v; }
+inline vdouble operator-(vdouble a, vdouble b) { return a.v - b.v; }
+inline vdouble operator*(vdouble a, vdouble b) { return a.v * b.v; }
+inline vdouble operator/(vdouble a, vdouble b) { return a.v / b.v; }
+inline vdouble operator-(vdouble a) { return -a.v; }
+inline vdouble sqrt(vdouble a) { return std::sqrt(a.v); }
+inline vdouble abs(vdouble a) { return std::fabs(a.v); }
+inline vdouble min(vdouble a, vdouble b) { return a.v < b.v ? a.v : b.v; }
+inline vdouble max(vdouble a, vdouble b) { return a.v > b.v ? a.v : b.v; }
+inline vdouble round(vdouble a) { return std::floor(a.v + 0.5); }
+inline vdouble floor(vdouble a) { return std::floor(a.v); }
+
+inline vmask operator<(vdouble a, vdouble b) { vmask r = { a.v < b.v }; return r; }
+inline vmask operator>(vdouble a, vdouble b) { vmask r = { a.v > b.v }; return r; }
+inline vmask operator<=(vdouble a, vdouble b) { vmask r = { a.v <= b.v }; return r; }
+inline vmask operator>=(vdouble a, vdouble b) { vmask r = { a.v >= b.v }; return r; }
+inline vmask operator==(vdouble a, vdouble b) { vmask r = { a.v == b.v }; return r; }
+inline vmask operator&(vmask a, vmask b) { vmask r = { a.m && b.m }; return r; }
+inline vmask operator|(vmask a, vmask b) { vmask r = { a.m || b.m }; return r; }
+inline bool any(vmask a) { return a.m; }
+inline bool all(vmask a) { return a.m; }
+inline vdouble select(vmask mask, vdouble a, vdouble b) { return mask.m ? a : b; }
+
+const int floatWidth = 1;
+
+struct vfloat
+{
+	float v;
+	vfloat() {}
+	vfloat(float f) : v(f) {}
+	static vfloat load(const float* p) { return *p; }
+	void store(float* p) const { *p = v; }
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return a.v + b.v; }
+inline vfloat operator-(vfloat a, vfloat b) { return a.v - b.v; }
+inline vfloat operator*(vfloat a, vfloat b) { return a.v * b.v; }
+inline vfloat rsqrtEstimate(vfloat a) { return 1.0f / std::sqrt(a.v); }
+inline vfloat rsqrtExact(vfloat a) { return 1.0f / std::sqrt(a.v); }
+
+struct vfmask { bool m; };
+inline vfmask operator>=(vfloat a, vfloat b) { vfmask r = { a.v >= b.v }; return r; }
+inline vfmask operator&(vfmask a, vfmask b) { vfmask r = { a.m && b.m }; return r; }
+inline int bits(vfmask a) { return a.m ? 1 : 0; }
+
+#endif
+
+inline vdouble& operator+=(vdouble& a, vdouble b) { a = a + b; return a; }
+inline vdouble& operator-=(vdouble& a, vdouble b) { a = a - b; return a; }
+inline vdouble& operator*=(vdouble& a, vdouble b) { a = a * b; return a; }
+inline vfloat& operator+=(vfloat& a, vfloat b) { a = a + b; return a; }
+inline vfloat operator-(vfloat a) { return vfloat(0.0f) - a; }
+
+// 1 / sqrt(a) to ~23 bits: the hardware estimate plus one Newton step, much
+// cheaper than a division and a square root. The estimate is not specified
+// exactly, its low bits differ between processor makers; rsqrtExact (a
+// correctly rounded division and square root) gives the same bits everywhere.
+inline vfloat rsqrt(vfloat a)
+{
+	vfloat y = rsqrtEstimate(a);
+	return vfloat(0.5f) * y * (vfloat(3.0f) - a * y * y);
+}
+
+inline double sum(vdouble a)
+{
+	double lanes[width];
+	a.store(lanes);
+	double total = 0.0;
+	for (int l = 0; l < width; l++)
+		total += lanes[l];
+	return total;
+}
+
+// Sum of the lanes, in double so long accumulations keep their precision
+inline double sum(vfloat a)
+{
+	float lanes[floatWidth];
+	a.store(lanes);
+	double total = 0.0;
+	for (int l = 0; l < floatWidth; l++)
+		total += lanes[l];
+	return total;
+}
+
+// sin and cos of every lane, accurate to a couple of ulp for |x| < 1e8.
+// Cody-Waite reduction to [-pi/4, pi/4] followed by the Cephes minimax
+// polynomials; the quadrant picks which polynomial and sign each lane uses.
+inline void sincos(vdouble x, vdouble& s, vdouble& c)
+{
+	const vdouble twoOverPi(0.63661977236758134308);
+	const vdouble pio2Hi(1.57079632673412561417);
+	const vdouble pio2Lo(6.07710050650619224932e-11);
+
+	vdouble q = round(x * twoOverPi);
+	vdouble r = (x - q * pio2Hi) - q * pio2Lo;
+	vdouble r2 = r * r;
+
+	vdouble sinPoly = vdouble(1.58962301576546568060e-10);
+	sinPoly = sinPoly * r2 + vdouble(-2.50507477628578072866e-8);
+	sinPoly = sinPoly * r2 + vdouble(2.75573136213857245213e-6);
+	sinPoly = sinPoly * r2 + vdouble(-1.98412698295895385996e-4);
+	sinPoly = sinPoly * r2 + vdouble(8.33333333332211858878e-3);
+	sinPoly = sinPoly * r2 + vdouble(-1.66666666666666307295e-1);
+	sinPoly = r + r * r2 * sinPoly;
+
+	vdouble cosPoly = vdouble(-1.13585365213876817300e-11);
+	cosPoly = cosPoly * r2 + vdouble(2.08757008419747316778e-9);
+	cosPoly = cosPoly * r2 + vdouble(-2.75573141792967388112e-7);
+	cosPoly = cosPoly * r2 + vdouble(2.48015872888517045348e-5);
+	cosPoly = cosPoly * r2 + vdouble(-1.38888888888730564116e-3);
+	cosPoly = cosPoly * r2 + vdouble(4.16666666666665929218e-2);
+	cosPoly = vdouble(1.0) - vdouble(0.5) * r2 + r2 * r2 * cosPoly;
+
+	// quadrant = q mod 4, computed in floating point to stay in vector registers
+	vdouble quadrant = q - vdouble(4.0) * floor(q * vdouble(0.25));
+	vmask odd = (quadrant == vdouble(1.0)) | (quadrant == vdouble(3.0));
+	vmask sinNegative = quadrant >= vdouble(2.0);
+	vmask cosNegative = (quadrant == vdouble(1.0)) | (quadrant == vdouble(2.0));
+
+	vdouble sinValue = select(odd, cosPoly, sinPoly);
+	vdouble cosValue = select(odd, sinPoly, cosPoly);
+	s = select(sinNegative, -sinValue, sinValue);
+	c = select(cosNegative, -cosValue, cosValue);
+}
+
+inline vdouble sin(vdouble x) { vdouble s, c; sincos(x, s, c); return s; }
+inline vdouble cos(vdouble x) { vdouble s, c; sincos(x, s, c); return c; }
+
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SIMULATIONCLOCK_HPP
+#define SIMULATIONCLOCK_HPP
+
+// Fixed-timestep accumulator: real frame time goes in, a whole number of
+// simulation steps comes out, whatever the display refresh rate. What is left
+// over in the accumulator is the fraction (alpha) of the next step the frame
+// should be drawn at, by interpolating the last two simulated states.
+class SimulationClock
+{
+private:
+	double stepSeconds;
+	double accumulator = 0.0;
+	double warp = 1.0;
+
+public:
+	// A long frame (window drag, breakpoint) runs at most this many steps, the
+	// rest is dropped instead of making the next frame even longer
+	static const int maxStepsPerFrame = 8;
+	static constexpr double minWarp = 1.0 / 64.0;
+	static constexpr double maxWarp = 1024.0;
+
+	explicit SimulationClock(double stepsPerSecond) : stepSeconds(1.0 / stepsPerSecond) {}
+
+	// Returns the number of steps to simulate for a frame that took frameSeconds
+	int advance(double frameSeconds)
+	{
+		accumulator += frameSeconds;
+		int steps = (int)(accumulator / stepSeconds);
+		if (steps > maxStepsPerFrame) {
+			steps = maxStepsPerFrame;
+			accumulator = 0.0;
+		}
+		else {
+			accumulator -= steps * stepSeconds;
+		}
+		return steps;
+	}
+
+	// Where the frame lies between the previous and the current state, in [0, 1)
+	float alpha() const
+	{
+		return (float)(accumulator / stepSeconds);
+	}
+
+	// Time warp scales simulated time per step, not the step rate, so a fast
+	// warp costs no more CPU than real time
+	double getWarp() const { return warp; }
+	void setWarp(double value) { warp = value < minWarp ? minWarp : (value > maxWarp ? maxWarp : value); }
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef SIMULATIONTHREAD_HPP
+#define SIMULATIONTHREAD_HPP
+
+#include <atomic>
+#include <thread>
+#include "BodyTable.h"
+#include "nbody.hpp"
+#include "ephemeris.hpp"
+#include "snapshotRing.hpp"
+#include "tripleBuffer.hpp"
+
+// What the renderer gets from the simulation: the last two steps, so frames
+// can be drawn between them, and the moment the newer one was produced
+struct SimulationFrame
+{
+	BodyState previous, current;
+	double stepTime = 0.0;          // SimulationThread::now() when current was published
+};
+
+// Runs the fixed-timestep simulation on its own thread. Once started the
+// thread owns the simulation state of the table (elements in, positions and
+// spins out); the render thread may only read the scene data that never
+// changes after loading (names, radii, materials, camera offsets) and gets
+// positions through latest(), which never blocks.
+class SimulationThread
+{
+private:
+	BodyTable& bodies;
+	JobSystem* jobs;
+	double stepsPerSecond;
+	double daysPerStep;             // at warp 1
+	double spinPerDay;
+	NBodySystem dynamics;           // only used when the scene is in N-body mode
+	Ephemeris ephemeris;            // only open when the scene names one
+	SnapshotRing snapshots;         // N-body states along the timeline
+	double startTime;
+
+	std::atomic<bool> running;
+	std::atomic<bool> stopRequested;
+	std::atomic<double> warp;
+	std::atomic<bool> seekRequested;
+	std::atomic<double> seekTarget;
+	TripleBuffer<SimulationFrame> frames;
+	std::thread worker;
+
+	void run();
+	double seekTo(double target, double time, BodyState& previous, BodyState& current);
+	void publishJump(double time, BodyState& previous, BodyState& current);
+	void saveSnapshotIfDue(double time);
+	const Ephemeris* fitted() const { return ephemeris.isOpen() ? &ephemeris : NULL; }
+
+	SimulationThread(const SimulationThread&) = delete;
+	SimulationThread& operator=(const SimulationThread&) = delete;
+
+public:
+	// jobs may be NULL to keep every step on the simulation thread
+	SimulationThread(BodyTable& bodies, JobSystem* jobs, double stepsPerSecond, double daysPerStep, double spinPerDay, double startTime);
+	~SimulationThread();
+
+	void start();
+	void stop();
+
+	void setRunning(bool value) { running.store(value); }
+	void setWarp(double value);
+	double getWarp() const { return warp.load(); }
+	double getStepSeconds() const { return 1.0 / stepsPerSecond; }
+
+	// Moves the simulation to day t (not before the start time). Analytic
+	// scenes just jump; N-body scenes restore the last snapshot before t,
+	// publish it at once and integrate the rest. Requests made before the
+	// thread gets to them are merged, only the last one counts, and a new one
+	// interrupts the integration of the previous.
+	void seek(double t);
+
+	// Most recent frame published by the simulation thread
+	const SimulationFrame& latest();
+
+	// Seconds on a monotonic clock shared by both threads
+	static double now();
+};
+
+#endif
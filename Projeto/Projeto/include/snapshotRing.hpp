@@ -0,0 +1,79 @@
+#ifndef SNAPSHOTRING_HPP
+#define SNAPSHOTRING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct NBodySystem;
+class JobSystem;
+
+// Periodic copies of an N-body state kept in a fixed-size file used as a ring:
+// when it is full the oldest snapshots are overwritten. Positions and
+// velocities are quantised to fixed point (2^-32 AU, 2^-44 AU/day), zigzag
+// varint encoded. Keyframes store the values; the snapshots in between store
+// their difference from the keyframe carried forward on two-body orbits
+// around the heaviest particle, so only what the other bodies changed is
+// left: about 3 bytes per coordinate against 4.6 for a keyframe (20k belt
+// particles, keyframes 16 snapshots apart). Restoring any snapshot reads at
+// most two records: its keyframe and itself.
+// Only the simulation thread touches the ring.
+class SnapshotRing
+{
+public:
+	SnapshotRing();
+	~SnapshotRing();
+
+	// Creates (or truncates) path with room for capacity bytes of snapshots;
+	// a keyframe is written every keyframeInterval snapshots
+	bool open(const char* path, size_t capacity, int keyframeInterval = 16);
+	void close();
+	bool isOpen() const { return file != NULL; }
+
+	// Appends the state of system at day t; times must increase. The orbit
+	// prediction of the particles is spread over jobs when given.
+	bool write(const NBodySystem& system, double t, JobSystem* jobs = NULL);
+
+	// Restores the latest snapshot at or before day t into system, which must
+	// hold the same particles. Returns false when there is none.
+	bool restore(double t, NBodySystem& system, double& snapshotTime, JobSystem* jobs = NULL);
+
+	// Time of the latest snapshot at or before day t, false when there is none
+	bool latestAtOrBefore(double t, double& snapshotTime) const;
+
+	size_t count() const { return index.size(); }
+	double earliest() const { return index.empty() ? 0.0 : index.front().time; }
+	double latest() const { return index.empty() ? 0.0 : index.back().time; }
+	size_t lastBytes() const { return lastRecordBytes; }
+
+private:
+	struct Entry
+	{
+		double time;
+		uint64_t sequence, keyframe;    // keyframe: sequence of the record it is relative to
+		uint64_t offset, bytes;         // in the file, header included
+	};
+
+	FILE* file;
+	uint64_t capacity, head;
+	int keyframeInterval;
+	uint64_t nextSequence;
+	size_t lastRecordBytes;
+	std::deque<Entry> index;                    // oldest first, increasing time
+	std::vector<int64_t> keyframeValues;        // quantised values of the newest keyframe
+	double keyframeTime;
+	std::vector<int64_t> values, predicted;
+	std::vector<unsigned char> buffer;
+
+	const Entry* find(uint64_t sequence) const;
+	void encode(bool keyframe);
+	bool readValues(const Entry& entry, size_t count, const int64_t* base);
+
+	SnapshotRing(const SnapshotRing&) = delete;
+	SnapshotRing& operator=(const SnapshotRing&) = delete;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef TOOLS_HPP
+#define TOOLS_HPP
+
+// Headless command line tools, selected by the first argument:
+//   --bench-kepler [bodies]    time the batch Kepler propagator, serial and
+//                              over the job system (PROJETO_WORKERS workers)
+//   --bench-nbody [particles] [theta]
+//                              time Barnes-Hut leapfrog steps on a belt,
+//                              in insertion order and in Morton order
+//   --bench-warp [years]       energy error of the planets at large time
+//                              warps, with and without block time steps
+//   --bench-positions [dates] [scene]
+//                              time the batch positions() API (orbits.hpp)
+//                              on every body of a scene at many dates
+//   --bench-culling [spheres]  time the frustum culling pass (frustum.hpp) on
+//                              a belt of spheres, serial and over the job system
+//   --bench-theory [directory] [tolerance]
+//                              time the VSOP87/ELP series found in directory
+//                              in full and truncated at tolerance (radians)
+//   --fit-ephemeris <file> [years] [kepler|nbody] [scene]
+//                              fit the trajectories of a scene, from its
+//                              orbits or an N-body run, into an ephemeris
+//                              file (see ephemeris.hpp) and check it
+//   --check-determinism [steps] [particles]
+//                              run the belt scene on 1, 8 and 64 threads and
+//                              compare the final states bit for bit
+//   --find-approaches [asteroids] [years] [distance]
+//                              close approach search (closeApproach.hpp) in
+//                              the solar system plus a synthetic belt catalog
+//   --find-events [years] [observer] [scene] [output]
+//                              eclipses, transits, occultations and
+//                              oppositions seen from observer (default Terra)
+//                              written to an event index (events.hpp) for the
+//                              scene key "events"
+//   --porkchop [from] [to] [years] [size] [scene] [output]
+//                              Lambert transfers (porkchop.hpp) from one body
+//                              to another (default Terra, Marte) on a size x
+//                              size grid of departure and arrival dates,
+//                              written as a PPM image
+//   --serve [socket] [scene]   answer position queries from other programs
+//                              (queryServer.hpp) until Ctrl+C
+//   --bench-query [socket] [dates]
+//                              time requests to a running --serve and check
+//                              its answers
+// Returns the process exit code.
+int runTool(int argc, char** argv);
+
+#endif
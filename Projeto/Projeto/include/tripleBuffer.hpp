@@ -0,0 +1,54 @@
+#ifndef TRIPLEBUFFER_HPP
+#define TRIPLEBUFFER_HPP
+
+#include <atomic>
+
+// Single producer, single consumer handoff of the latest value without locks.
+// The writer fills its own slot and swaps it with the spare one; the reader
+// swaps its slot with the spare only when something new was published. Neither
+// side ever waits for the other, and the reader's slot is never written.
+template <typename T>
+class TripleBuffer
+{
+private:
+	static const unsigned indexMask = 3u;
+	static const unsigned freshBit = 4u;
+
+	T slots[3];
+	std::atomic<unsigned> spare;    // index of the spare slot, freshBit if it holds an unread value
+	unsigned writing = 0;           // owned by the writer
+	unsigned reading = 1;           // owned by the reader
+
+public:
+	TripleBuffer() : spare(2u) {}
+
+	// Writer side: the slot to fill, then publish() it
+	T& writeSlot() { return slots[writing]; }
+
+	void publish()
+	{
+		unsigned previous = spare.exchange(writing | freshBit, std::memory_order_acq_rel);
+		writing = previous & indexMask;
+	}
+
+	// Reader side: picks up the most recent published value, if any. Returns
+	// false and keeps the current one when nothing new arrived
+	bool acquire()
+	{
+		if (!(spare.load(std::memory_order_relaxed) & freshBit))
+			return false;
+		unsigned previous = spare.exchange(reading, std::memory_order_acq_rel);
+		reading = previous & indexMask;
+		return true;
+	}
+
+	const T& readSlot() const { return slots[reading]; }
+
+	// Only safe before the writer thread starts
+	void fill(const T& value)
+	{
+		slots[0] = slots[1] = slots[2] = value;
+	}
+};
+
+#endif
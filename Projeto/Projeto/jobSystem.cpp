@@ -0,0 +1,172 @@
+#include <stdlib.h>
+
+#include "jobSystem.hpp"
+
+// Queue the current thread pushes to: as a worker of workerSystem, or as a
+// caller of callerSystem
+static thread_local const JobSystem* workerSystem = NULL;
+static thread_local size_t workerQueue = 0;
+static thread_local const JobSystem* callerSystem = NULL;
+static thread_local size_t callerQueueIndex = 0;
+
+unsigned JobSystem::defaultWorkerCount()
+{
+#ifdef _MSC_VER
+	// getenv is flagged as unsafe by the SDL checks
+	char* configured = NULL;
+	size_t length = 0;
+	if (_dupenv_s(&configured, &length, "PROJETO_WORKERS") == 0 && configured != NULL) {
+		unsigned workers = (unsigned)atoi(configured);
+		free(configured);
+		return workers;
+	}
+#else
+	const char* configured = getenv("PROJETO_WORKERS");
+	if (configured != NULL)
+		return (unsigned)atoi(configured);
+#endif
+	unsigned hardware = std::thread::hardware_concurrency();
+	return hardware > 1 ? hardware - 1 : 0;
+}
+
+JobSystem::JobSystem(unsigned workers) : nextCallerQueue(0), queuedJobs(0), stopping(false)
+{
+	for (unsigned i = 0; i < workers + callerQueues; i++)
+		queues.push_back(std::unique_ptr<Queue>(new Queue()));
+	for (unsigned i = 0; i < workers; i++)
+		threads.push_back(std::thread(&JobSystem::workerMain, this, (size_t)i));
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping.store(true);
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+
+void JobSystem::push(size_t queue, const Job& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+		queues[queue]->jobs.push_back(job);
+	}
+	queuedJobs.fetch_add(1);
+	// Taking the lock orders this with a worker that is about to sleep
+	std::lock_guard<std::mutex> lock(sleepMutex);
+	wake.notify_one();
+}
+
+// The queue of the calling thread: a worker's own, or one of the caller
+// queues, handed out in turn the first time a thread runs a loop here
+size_t JobSystem::threadQueue()
+{
+	if (workerSystem == this)
+		return workerQueue;
+	if (callerSystem != this) {
+		callerSystem = this;
+		callerQueueIndex = threads.size() + nextCallerQueue.fetch_add(1) % callerQueues;
+	}
+	return callerQueueIndex;
+}
+
+// Takes a job for the thread of queue; with only set, a job of that loop
+bool JobSystem::popOrSteal(size_t queue, const Loop* only, Job& job)
+{
+	if (queuedJobs.load() <= 0)
+		return false;
+
+	// Own queue first, newest job: its data is still in this core's cache
+	{
+		Queue& own = *queues[queue];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		for (size_t k = own.jobs.size(); k-- > 0;)
+			if (only == NULL || own.jobs[k].loop == only) {
+				job = own.jobs[k];
+				own.jobs.erase(own.jobs.begin() + k);
+				queuedJobs.fetch_sub(1);
+				return true;
+			}
+	}
+
+	// Then the oldest job of the others, which is also the biggest range
+	for (size_t k = 1; k < queues.size(); k++)
+	{
+		Queue& victim = *queues[(queue + k) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		for (size_t j = 0; j < victim.jobs.size(); j++)
+			if (only == NULL || victim.jobs[j].loop == only) {
+				job = victim.jobs[j];
+				victim.jobs.erase(victim.jobs.begin() + j);
+				queuedJobs.fetch_sub(1);
+				return true;
+			}
+	}
+	return false;
+}
+
+void JobSystem::execute(size_t queue, Job job)
+{
+	Loop& loop = *job.loop;
+
+	// Split lazily: keep the first part, leave the rest for whoever is idle
+	while (job.end - job.begin > loop.grain)
+	{
+		size_t chunks = (job.end - job.begin + loop.grain - 1) / loop.grain;
+		size_t middle = job.begin + (chunks / 2) * loop.grain;
+		Job rest = { job.loop, middle, job.end };
+		push(queue, rest);
+		job.end = middle;
+	}
+
+	loop.invoke(loop.context, job.begin, job.end);
+	// Last access to the loop: once remaining hits zero the caller may return
+	loop.remaining.fetch_sub(job.end - job.begin, std::memory_order_acq_rel);
+}
+
+void JobSystem::run(Loop& loop, size_t begin, size_t end, size_t grain)
+{
+	if (begin >= end)
+		return;
+	loop.grain = grain > 0 ? grain : 1;
+	loop.remaining.store(end - begin);
+
+	size_t queue = threadQueue();
+	Job job = { &loop, begin, end };
+	execute(queue, job);
+
+	// Help until our loop is done. A worker takes any job; another thread
+	// only takes the jobs of this loop, or the render thread could end up
+	// running a force chunk of the simulation step. Loops nested in this one
+	// are finished inside its jobs, so there is nothing else of ours to run.
+	const Loop* only = queue < threads.size() ? NULL : &loop;
+	while (loop.remaining.load(std::memory_order_acquire) > 0)
+	{
+		if (popOrSteal(queue, only, job))
+			execute(queue, job);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::workerMain(size_t queue)
+{
+	workerSystem = this;
+	workerQueue = queue;
+	Job job;
+	while (true)
+	{
+		if (popOrSteal(queue, NULL, job)) {
+			execute(queue, job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this] { return stopping.load() || queuedJobs.load() > 0; });
+		if (stopping.load())
+			return;
+	}
+}
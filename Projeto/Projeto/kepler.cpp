@@ -0,0 +1,129 @@
+#include <cmath>
+
+#include "kepler.hpp"
+#include "simdMath.hpp"
+
+using simd::vdouble;
+
+// Independent vectors solved together by each propagateLanes call
+static const int vectorsPerCall = 2;
+
+// Solves Kepler's equation for blocks * simd::width bodies at once and
+// writes their positions (and velocities when vx/vz are not null). Several
+// independent vectors per call keep the pipeline busy while one of them waits
+// on its division or polynomial.
+template <int blocks>
+static void propagateLanes(const double* a, const double* e, const double* n, const double* m0, double t,
+	double* x, double* z, double* vx, double* vz)
+{
+	const vdouble twoPi(6.28318530717958647693);
+	const vdouble invTwoPi(0.15915494309189533577);
+	const vdouble one(1.0);
+	const int w = simd::width;
+
+	vdouble ecc[blocks], M[blocks], E[blocks], sinE[blocks], cosE[blocks];
+	for (int b = 0; b < blocks; b++)
+	{
+		ecc[b] = vdouble::load(e + b * w);
+
+		// Mean anomaly at t, wrapped to [-pi, pi] so the solver always starts close
+		M[b] = vdouble::load(m0 + b * w) + vdouble::load(n + b * w) * vdouble(t);
+		M[b] = M[b] - twoPi * simd::round(M[b] * invTwoPi);
+
+		// Danby's starter E0 = M + 0.85 e sign(sin M) keeps Newton convergent for every e < 1
+		vdouble offset = vdouble(0.85) * ecc[b];
+		E[b] = M[b] + simd::select(M[b] < vdouble(0.0), -offset, offset);
+	}
+
+	// Newton converges quadratically: once every lane's step is below 1e-9 the
+	// remaining error is ~1e-18 and the last sin/cos only need a first order
+	// correction instead of another evaluation
+	for (int iteration = 0; iteration < 32; iteration++)
+	{
+		bool converged = true;
+		for (int b = 0; b < blocks; b++)
+		{
+			simd::sincos(E[b], sinE[b], cosE[b]);
+			vdouble dE = (E[b] - ecc[b] * sinE[b] - M[b]) / (one - ecc[b] * cosE[b]);
+			E[b] = E[b] - dE;
+			vdouble newSin = sinE[b] - dE * cosE[b];
+			cosE[b] = cosE[b] + dE * sinE[b];
+			sinE[b] = newSin;
+			converged = converged && !simd::any(simd::abs(dE) > vdouble(1e-9));
+		}
+		if (converged)
+			break;
+	}
+
+	for (int b = 0; b < blocks; b++)
+	{
+		vdouble semiMajorAxis = vdouble::load(a + b * w);
+		vdouble semiMinorAxis = semiMajorAxis * simd::sqrt(one - ecc[b] * ecc[b]);
+		(semiMinorAxis * sinE[b]).store(x + b * w);
+		(semiMajorAxis * (cosE[b] - ecc[b])).store(z + b * w);
+
+		if (vx)
+		{
+			vdouble dEdt = vdouble::load(n + b * w) / (one - ecc[b] * cosE[b]);
+			(semiMinorAxis * cosE[b] * dEdt).store(vx + b * w);
+			(-semiMajorAxis * sinE[b] * dEdt).store(vz + b * w);
+		}
+	}
+}
+
+static void propagate(size_t count, const double* semiMajorAxis, const double* eccentricity,
+	const double* meanMotion, const double* meanAnomaly0, double t, double* outX, double* outZ,
+	double* outVX, double* outVZ)
+{
+	const size_t width = simd::width * vectorsPerCall;
+	size_t i = 0;
+	for (; i + width <= count; i += width)
+	{
+		propagateLanes<vectorsPerCall>(semiMajorAxis + i, eccentricity + i, meanMotion + i, meanAnomaly0 + i, t,
+			outX + i, outZ + i, outVX ? outVX + i : 0, outVZ ? outVZ + i : 0);
+	}
+
+	// Remaining bodies go through the same code with zero padded lanes
+	if (i < count)
+	{
+		double a[width] = {}, e[width] = {}, n[width] = {}, m0[width] = {};
+		double x[width], z[width], vx[width], vz[width];
+		size_t rest = count - i;
+		for (size_t k = 0; k < rest; k++)
+		{
+			a[k] = semiMajorAxis[i + k];
+			e[k] = eccentricity[i + k];
+			n[k] = meanMotion[i + k];
+			m0[k] = meanAnomaly0[i + k];
+		}
+		propagateLanes<vectorsPerCall>(a, e, n, m0, t, x, z, outVX ? vx : 0, outVZ ? vz : 0);
+		for (size_t k = 0; k < rest; k++)
+		{
+			outX[i + k] = x[k];
+			outZ[i + k] = z[k];
+			if (outVX)
+			{
+				outVX[i + k] = vx[k];
+				outVZ[i + k] = vz[k];
+			}
+		}
+	}
+}
+
+void propagateKepler(size_t count, const double* semiMajorAxis, const double* eccentricity,
+	const double* meanMotion, const double* meanAnomaly0, double t, double* outX, double* outZ)
+{
+	propagate(count, semiMajorAxis, eccentricity, meanMotion, meanAnomaly0, t, outX, outZ, 0, 0);
+}
+
+void propagateKepler(size_t count, const double* semiMajorAxis, const double* eccentricity,
+	const double* meanMotion, const double* meanAnomaly0, double t, double* outX, double* outZ,
+	double* outVX, double* outVZ)
+{
+	propagate(count, semiMajorAxis, eccentricity, meanMotion, meanAnomaly0, t, outX, outZ, outVX, outVZ);
+}
+
+const char* keplerInstructionSet()
+{
+	return simd::name();
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedFile.hpp"
+
+#ifdef _WIN32
+MappedFile::MappedFile() : view(NULL), bytes(0), file(INVALID_HANDLE_VALUE), mapping(NULL) {}
+#else
+MappedFile::MappedFile() : view(NULL), bytes(0), file(-1) {}
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* path, size_t minimumBytes)
+{
+	close();
+
+#ifdef _WIN32
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		printf("Impossible to open %s. Are you in the right directory ?\n", path);
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && size.QuadPart >= (LONGLONG)minimumBytes) {
+		bytes = (size_t)size.QuadPart;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+			view = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	file = ::open(path, O_RDONLY);
+	if (file < 0) {
+		printf("Impossible to open %s. Are you in the right directory ?\n", path);
+		return false;
+	}
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size > 0 && status.st_size >= (off_t)minimumBytes) {
+		bytes = (size_t)status.st_size;
+		void* mapped = mmap(NULL, bytes, PROT_READ, MAP_SHARED, file, 0);
+		if (mapped != MAP_FAILED)
+			view = (const unsigned char*)mapped;
+	}
+#endif
+
+	if (view == NULL) {
+		printf("%s: could not map the file\n", path);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (view != NULL)
+		UnmapViewOfFile(view);
+	if (mapping != NULL)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (view != NULL)
+		munmap((void*)view, bytes);
+	if (file >= 0)
+		::close(file);
+	file = -1;
+#endif
+	view = NULL;
+	bytes = 0;
+}
@@ -0,0 +1,634 @@
+#include <cmath>
+#include <algorithm>
+
+#include "nbody.hpp"
+#include "jobSystem.hpp"
+#include "simdMath.hpp"
+
+using simd::vfloat;
+
+// Bits per axis of the Morton keys, and so the deepest level of the tree
+static const int mortonBits = 16;
+static const int radixBits = 16;
+static const uint64_t radixMask = (1u << radixBits) - 1;
+
+template <typename Body>
+static void forRange(JobSystem* jobs, size_t count, size_t grain, const Body& body)
+{
+	if (jobs != NULL)
+		jobs->parallelFor(0, count, grain, body);
+	else
+		body((size_t)0, count);
+}
+
+// Spreads the low 16 bits of v so there are two zero bits between each of them
+static uint64_t spreadBits(uint64_t v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 16)) & 0x0000FF0000FFull;
+	v = (v | (v << 8)) & 0x00F00F00F00Full;
+	v = (v | (v << 4)) & 0x0C30C30C30C3ull;
+	v = (v | (v << 2)) & 0x249249249249ull;
+	return v;
+}
+
+void BarnesHutTree::build(size_t count, const double* x, const double* y, const double* z, const double* mass, JobSystem* jobs)
+{
+	nodes.clear();
+	if (count == 0)
+		return;
+
+	// Bounding cube of all the particles
+	double minX = x[0], minY = y[0], minZ = z[0], maxX = x[0], maxY = y[0], maxZ = z[0];
+	for (size_t i = 1; i < count; i++)
+	{
+		minX = std::min(minX, x[i]); maxX = std::max(maxX, x[i]);
+		minY = std::min(minY, y[i]); maxY = std::max(maxY, y[i]);
+		minZ = std::min(minZ, z[i]); maxZ = std::max(maxZ, z[i]);
+	}
+	double half = 0.5 * std::max(maxX - minX, std::max(maxY - minY, maxZ - minZ));
+	half = half * (1.0 + 1e-9) + 1e-12;
+	double centerX = 0.5 * (minX + maxX), centerY = 0.5 * (minY + maxY), centerZ = 0.5 * (minZ + maxZ);
+
+	keys.resize(count);
+	order.resize(count);
+	const double cells = (double)(1 << mortonBits);
+	const double toCell = cells / (2.0 * half);
+	forRange(jobs, count, 16384, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++)
+		{
+			uint64_t cx = (uint64_t)std::min(cells - 1.0, (x[i] - centerX + half) * toCell);
+			uint64_t cy = (uint64_t)std::min(cells - 1.0, (y[i] - centerY + half) * toCell);
+			uint64_t cz = (uint64_t)std::min(cells - 1.0, (z[i] - centerZ + half) * toCell);
+			keys[i] = (spreadBits(cx) << 2) | (spreadBits(cy) << 1) | spreadBits(cz);
+			order[i] = (int)i;
+		}
+	});
+
+	// LSD radix sort of the 48-bit keys, three passes of 16 bits. Clearing
+	// the 64k buckets costs more than sorting a few thousand keys directly.
+	if (count < 16384) {
+		std::sort(order.begin(), order.end(), [this](int a, int b) { return keys[a] < keys[b]; });
+		sortedKeys.resize(count);
+		for (size_t k = 0; k < count; k++)
+			sortedKeys[k] = keys[order[k]];
+		keys.swap(sortedKeys);
+	}
+	else {
+		radixOffsets.resize(radixMask + 2);
+		sortedKeys.resize(count);
+		sortedOrder.resize(count);
+		for (int shift = 0; shift < 3 * mortonBits; shift += radixBits)
+		{
+			std::fill(radixOffsets.begin(), radixOffsets.end(), 0);
+			for (size_t i = 0; i < count; i++)
+				radixOffsets[((keys[i] >> shift) & radixMask) + 1]++;
+			for (size_t b = 0; b < radixMask + 1; b++)
+				radixOffsets[b + 1] += radixOffsets[b];
+			for (size_t i = 0; i < count; i++)
+			{
+				size_t slot = radixOffsets[(keys[i] >> shift) & radixMask]++;
+				sortedKeys[slot] = keys[i];
+				sortedOrder[slot] = order[i];
+			}
+			keys.swap(sortedKeys);
+			order.swap(sortedOrder);
+		}
+	}
+
+	px.resize(count);
+	py.resize(count);
+	pz.resize(count);
+	pm.resize(count);
+	forRange(jobs, count, 16384, [&](size_t first, size_t last) {
+		for (size_t k = first; k < last; k++)
+		{
+			int i = order[k];
+			px[k] = x[i];
+			py[k] = y[i];
+			pz[k] = z[i];
+			pm[k] = mass[i];
+		}
+	});
+
+	nodes.reserve(2 * count / leafSize + 64);
+	groups.clear();
+	nodes.push_back(Node());
+	buildNode(0, 0, (int)count, 0, centerX, centerY, centerZ, half, false);
+}
+
+// Fills nodes[index] for the particles [first, last), all inside the given
+// cube. The children of a node are appended together, so they are contiguous.
+// nodes may grow during the recursion: only indices are kept across calls.
+void BarnesHutTree::buildNode(int index, int first, int last, int level, double centerX, double centerY, double centerZ, double half, bool inGroup)
+{
+	Node node;
+	node.centerX = centerX;
+	node.centerY = centerY;
+	node.centerZ = centerZ;
+	node.half = half;
+	node.first = first;
+	node.last = last;
+	node.firstChild = -1;
+	node.childCount = 0;
+
+	// The first node on the way down that fits in a group is the largest one.
+	// Leaves at the deepest level can hold more (coincident particles)
+	bool leaf = last - first <= leafSize || level == mortonBits;
+	if (!inGroup && (last - first <= groupSize || leaf)) {
+		groups.push_back(index);
+		inGroup = true;
+	}
+
+	if (!leaf)
+	{
+		// The keys are sorted, so each octant of this cube is a subrange
+		int shift = 3 * (mortonBits - 1 - level);
+		int bounds[9];
+		bounds[0] = first;
+		for (int octant = 0; octant < 8; octant++)
+		{
+			uint64_t prefix = (keys[first] >> (shift + 3) << 3) | (uint64_t)octant;
+			uint64_t limit = ((prefix + 1) << shift);
+			bounds[octant + 1] = (int)(std::lower_bound(keys.begin() + bounds[octant], keys.begin() + last, limit) - keys.begin());
+		}
+
+		int occupied = 0;
+		for (int octant = 0; octant < 8; octant++)
+			if (bounds[octant + 1] > bounds[octant])
+				occupied++;
+		node.firstChild = (int)nodes.size();
+		node.childCount = occupied;
+		nodes.resize(nodes.size() + occupied);
+
+		double childHalf = 0.5 * half;
+		int child = node.firstChild;
+		for (int octant = 0; octant < 8; octant++)
+		{
+			if (bounds[octant + 1] == bounds[octant])
+				continue;
+			// Key bit order is x, y, z from high to low
+			double childX = centerX + ((octant & 4) ? childHalf : -childHalf);
+			double childY = centerY + ((octant & 2) ? childHalf : -childHalf);
+			double childZ = centerZ + ((octant & 1) ? childHalf : -childHalf);
+
+			buildNode(child++, bounds[octant], bounds[octant + 1], level + 1, childX, childY, childZ, childHalf, inGroup);
+		}
+	}
+
+	node.mass = 0.0;
+	node.comX = node.comY = node.comZ = 0.0;
+	if (node.firstChild < 0) {
+		for (int k = first; k < last; k++)
+		{
+			node.mass += pm[k];
+			node.comX += pm[k] * px[k];
+			node.comY += pm[k] * py[k];
+			node.comZ += pm[k] * pz[k];
+		}
+	}
+	else {
+		for (int c = node.firstChild; c < node.firstChild + node.childCount; c++)
+		{
+			node.mass += nodes[c].mass;
+			node.comX += nodes[c].mass * nodes[c].comX;
+			node.comY += nodes[c].mass * nodes[c].comY;
+			node.comZ += nodes[c].mass * nodes[c].comZ;
+		}
+	}
+	if (node.mass > 0.0) {
+		node.comX /= node.mass;
+		node.comY /= node.mass;
+		node.comZ /= node.mass;
+	}
+	else {
+		node.comX = centerX;
+		node.comY = centerY;
+		node.comZ = centerZ;
+	}
+
+	nodes[index] = node;
+}
+
+// Interaction list of one group: monopoles and particles, stored in single
+// precision relative to the group centre, where float resolution is plenty
+struct InteractionList
+{
+	std::vector<float> x, y, z, m;
+
+	void clear() { x.clear(); y.clear(); z.clear(); m.clear(); }
+	size_t size() const { return x.size(); }
+
+	void add(double dx, double dy, double dz, double mass)
+	{
+		x.push_back((float)dx);
+		y.push_back((float)dy);
+		z.push_back((float)dz);
+		m.push_back((float)mass);
+	}
+};
+
+// Pull of the whole list on count particles of the group, two at a time so
+// their independent sums hide the latency of each other's adds
+static void sumInteractions(const InteractionList& list, float eps2, const float* x, const float* y, const float* z,
+	int count, double* sumX, double* sumY, double* sumZ)
+{
+	const size_t size = list.size();
+	const vfloat e2(eps2);
+	for (int k = 0; k < count; k += 2)
+	{
+		int k1 = k + 1 < count ? k + 1 : k;
+		const vfloat x0(x[k]), y0(y[k]), z0(z[k]), x1(x[k1]), y1(y[k1]), z1(z[k1]);
+		vfloat ax0(0.0f), ay0(0.0f), az0(0.0f), ax1(0.0f), ay1(0.0f), az1(0.0f);
+		for (size_t j = 0; j < size; j += simd::floatWidth)
+		{
+			vfloat lx = vfloat::load(&list.x[j]), ly = vfloat::load(&list.y[j]), lz = vfloat::load(&list.z[j]);
+			vfloat lm = vfloat::load(&list.m[j]);
+
+			// The particle itself has d = 0 and adds nothing
+			vfloat dx0 = lx - x0, dy0 = ly - y0, dz0 = lz - z0;
+			vfloat inv0 = simd::rsqrt(dx0 * dx0 + dy0 * dy0 + dz0 * dz0 + e2);
+			vfloat s0 = lm * inv0 * inv0 * inv0;
+			ax0 += s0 * dx0;
+			ay0 += s0 * dy0;
+			az0 += s0 * dz0;
+
+			vfloat dx1 = lx - x1, dy1 = ly - y1, dz1 = lz - z1;
+			vfloat inv1 = simd::rsqrt(dx1 * dx1 + dy1 * dy1 + dz1 * dz1 + e2);
+			vfloat s1 = lm * inv1 * inv1 * inv1;
+			ax1 += s1 * dx1;
+			ay1 += s1 * dy1;
+			az1 += s1 * dz1;
+		}
+		sumX[k] = simd::sum(ax0);
+		sumY[k] = simd::sum(ay0);
+		sumZ[k] = simd::sum(az0);
+		if (k1 != k) {
+			sumX[k1] = simd::sum(ax1);
+			sumY[k1] = simd::sum(ay1);
+			sumZ[k1] = simd::sum(az1);
+		}
+	}
+}
+
+// Deterministic variant of sumInteractions. The hardware 1/sqrt estimate is
+// replaced by a correctly rounded division and square root, and the list is
+// always summed in eight float lanes, whatever the width of the vectors: a
+// build for SSE2 keeps two accumulators, the scalar build eight.
+static const int fixedLanes = 8;
+static_assert(fixedLanes % simd::floatWidth == 0, "fixedLanes must be a multiple of the vector width");
+
+static void sumInteractionsExact(const InteractionList& list, float eps2, const float* x, const float* y, const float* z,
+	int count, double* sumX, double* sumY, double* sumZ)
+{
+	const int blocks = fixedLanes / simd::floatWidth;
+	const size_t size = list.size();
+	const vfloat e2(eps2);
+	for (int k = 0; k < count; k++)
+	{
+		const vfloat x0(x[k]), y0(y[k]), z0(z[k]);
+		vfloat ax[blocks], ay[blocks], az[blocks];
+		for (int b = 0; b < blocks; b++)
+			ax[b] = ay[b] = az[b] = vfloat(0.0f);
+		for (size_t j = 0; j < size; j += fixedLanes)
+		{
+			for (int b = 0; b < blocks; b++)
+			{
+				size_t at = j + b * simd::floatWidth;
+				vfloat dx = vfloat::load(&list.x[at]) - x0, dy = vfloat::load(&list.y[at]) - y0, dz = vfloat::load(&list.z[at]) - z0;
+				vfloat inv = simd::rsqrtExact(dx * dx + dy * dy + dz * dz + e2);
+				vfloat s = vfloat::load(&list.m[at]) * inv * inv * inv;
+				ax[b] += s * dx;
+				ay[b] += s * dy;
+				az[b] += s * dz;
+			}
+		}
+		// Lanes 0 to 7 added one after the other, however they are split
+		// between registers
+		float lanesX[fixedLanes], lanesY[fixedLanes], lanesZ[fixedLanes];
+		for (int b = 0; b < blocks; b++)
+		{
+			ax[b].store(lanesX + b * simd::floatWidth);
+			ay[b].store(lanesY + b * simd::floatWidth);
+			az[b].store(lanesZ + b * simd::floatWidth);
+		}
+		sumX[k] = sumY[k] = sumZ[k] = 0.0;
+		for (int l = 0; l < fixedLanes; l++)
+		{
+			sumX[k] += lanesX[l];
+			sumY[k] += lanesY[l];
+			sumZ[k] += lanesZ[l];
+		}
+	}
+}
+
+void BarnesHutTree::accelerationRange(size_t firstGroup, size_t lastGroup, double G, double theta2, double eps2,
+	double* ax, double* ay, double* az, bool deterministic) const
+{
+	// Deepest walk: mortonBits levels of at most 8 children each
+	int stack[8 * mortonBits + 8];
+	InteractionList list;
+	float x[groupSize], y[groupSize], z[groupSize];
+	double sumX[groupSize], sumY[groupSize], sumZ[groupSize];
+
+	for (size_t g = firstGroup; g < lastGroup; g++)
+	{
+		const Node& group = nodes[groups[g]];
+
+		// Tight box of the group's particles: one walk serves all of them, so a
+		// node is only used as a monopole when it is far from the whole box
+		double minX = px[group.first], maxX = minX, minY = py[group.first], maxY = minY, minZ = pz[group.first], maxZ = minZ;
+		for (int k = group.first + 1; k < group.last; k++)
+		{
+			minX = std::min(minX, px[k]); maxX = std::max(maxX, px[k]);
+			minY = std::min(minY, py[k]); maxY = std::max(maxY, py[k]);
+			minZ = std::min(minZ, pz[k]); maxZ = std::max(maxZ, pz[k]);
+		}
+		const double originX = 0.5 * (minX + maxX), originY = 0.5 * (minY + maxY), originZ = 0.5 * (minZ + maxZ);
+		const double halfX = 0.5 * (maxX - minX), halfY = 0.5 * (maxY - minY), halfZ = 0.5 * (maxZ - minZ);
+
+		list.clear();
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const Node& node = nodes[stack[--top]];
+			double dx = std::max(0.0, std::fabs(node.comX - originX) - halfX);
+			double dy = std::max(0.0, std::fabs(node.comY - originY) - halfY);
+			double dz = std::max(0.0, std::fabs(node.comZ - originZ) - halfZ);
+			double size = 2.0 * node.half;
+
+			if (node.firstChild >= 0 && size * size < theta2 * (dx * dx + dy * dy + dz * dz)) {
+				list.add(node.comX - originX, node.comY - originY, node.comZ - originZ, node.mass);
+			}
+			else if (node.firstChild >= 0) {
+				for (int c = 0; c < node.childCount; c++)
+					stack[top++] = node.firstChild + c;
+			}
+			else {
+				for (int j = node.first; j < node.last; j++)
+					list.add(px[j] - originX, py[j] - originY, pz[j] - originZ, pm[j]);
+			}
+		}
+
+		// Pad to whole vectors with massless entries
+		const size_t lanes = deterministic ? fixedLanes : simd::floatWidth;
+		while (list.size() % lanes != 0)
+			list.add(1.0, 0.0, 0.0, 0.0);
+
+		for (int chunk = group.first; chunk < group.last; chunk += groupSize)
+		{
+			const int count = std::min(groupSize, group.last - chunk);
+			for (int k = 0; k < count; k++)
+			{
+				x[k] = (float)(px[chunk + k] - originX);
+				y[k] = (float)(py[chunk + k] - originY);
+				z[k] = (float)(pz[chunk + k] - originZ);
+			}
+			if (deterministic)
+				sumInteractionsExact(list, (float)eps2, x, y, z, count, sumX, sumY, sumZ);
+			else
+				sumInteractions(list, (float)eps2, x, y, z, count, sumX, sumY, sumZ);
+			for (int k = 0; k < count; k++)
+			{
+				int i = order[chunk + k];
+				ax[i] = G * sumX[k];
+				ay[i] = G * sumY[k];
+				az[i] = G * sumZ[k];
+			}
+		}
+	}
+}
+
+void BarnesHutTree::accelerations(double G, double theta, double softening, double* ax, double* ay, double* az, JobSystem* jobs,
+	const unsigned char* rung, int minRung, bool deterministic) const
+{
+	if (nodes.empty())
+		return;
+	// A particle's own entry is 0 * m / eps^3: eps must keep that finite in float
+	double eps = std::max(softening, nbodyMinimumSoftening);
+	double eps2 = eps * eps;
+	// Groups are in Morton order: neighbouring groups open the same nodes
+	forRange(jobs, groups.size(), 8, [&](size_t first, size_t last) {
+		for (size_t g = first; g < last; g++)
+		{
+			bool active = rung == NULL;
+			for (int k = nodes[groups[g]].first; !active && k < nodes[groups[g]].last; k++)
+				active = rung[order[k]] >= minRung;
+			if (active)
+				accelerationRange(g, g + 1, G, theta * theta, eps2, ax, ay, az, deterministic);
+		}
+	});
+}
+
+void NBodySystem::add(double px, double py, double pz, double pvx, double pvy, double pvz, double m)
+{
+	x.push_back(px);
+	y.push_back(py);
+	z.push_back(pz);
+	vx.push_back(pvx);
+	vy.push_back(pvy);
+	vz.push_back(pvz);
+	ax.push_back(0.0);
+	ay.push_back(0.0);
+	az.push_back(0.0);
+	mass.push_back(m);
+	id.push_back((int)slot.size());
+	slot.push_back((int)slot.size());
+	accelerationsValid = false;
+}
+
+void computeAccelerations(NBodySystem& system, JobSystem* jobs)
+{
+	system.tree.build(system.size(), system.x.data(), system.y.data(), system.z.data(), system.mass.data(), jobs);
+	system.tree.accelerations(system.G, system.theta, system.softening,
+		system.ax.data(), system.ay.data(), system.az.data(), jobs, NULL, 0, system.deterministic);
+	system.accelerationsValid = true;
+}
+
+template <typename T>
+static void permute(std::vector<T>& values, const std::vector<int>& from, std::vector<T>& scratch, JobSystem* jobs)
+{
+	scratch.resize(values.size());
+	forRange(jobs, values.size(), 16384, [&](size_t first, size_t last) {
+		for (size_t k = first; k < last; k++)
+			scratch[k] = values[from[k]];
+	});
+	values.swap(scratch);
+}
+
+void sortParticles(NBodySystem& system, JobSystem* jobs)
+{
+	const size_t count = system.size();
+	system.stepsSinceSort = 0;
+	if (count <= system.pinned + 1)
+		return;
+	// The order has to describe the current positions
+	if (!system.accelerationsValid)
+		computeAccelerations(system, jobs);
+
+	// Index each particle comes from: pinned ones stay, the others follow the tree
+	const std::vector<int>& order = system.tree.mortonOrder();
+	std::vector<int>& from = system.sortFrom;
+	from.resize(count);
+	size_t next = system.pinned;
+	for (size_t k = 0; k < system.pinned; k++)
+		from[k] = (int)k;
+	for (size_t k = 0; k < count; k++)
+		if ((size_t)order[k] >= system.pinned)
+			from[next++] = order[k];
+
+	std::vector<double>& scratch = system.sortScratch;
+	std::vector<double>* arrays[] = { &system.x, &system.y, &system.z, &system.vx, &system.vy, &system.vz,
+		&system.ax, &system.ay, &system.az, &system.mass };
+	for (std::vector<double>* values : arrays)
+		permute(*values, from, scratch, jobs);
+	std::vector<int> ids;
+	permute(system.id, from, ids, jobs);
+	for (size_t k = 0; k < count; k++)
+		system.slot[system.id[k]] = (int)k;
+	// Rungs are picked again at the start of every block step
+	system.rung.clear();
+	// The tree still indexes the old order; every step rebuilds it before use
+}
+
+// Re-sorts once every sortInterval calls
+static void sortIfDue(NBodySystem& system, JobSystem* jobs)
+{
+	if (system.sortInterval > 0 && ++system.stepsSinceSort >= system.sortInterval)
+		sortParticles(system, jobs);
+}
+
+// Kicks the particles with rung >= minRung by half of their own substep
+static void kickRungs(NBodySystem& s, const double* halfStep, int minRung, JobSystem* jobs)
+{
+	forRange(jobs, s.size(), 16384, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++)
+		{
+			if (s.rung[i] < minRung)
+				continue;
+			double dt = halfStep[s.rung[i]];
+			s.vx[i] += s.ax[i] * dt;
+			s.vy[i] += s.ay[i] * dt;
+			s.vz[i] += s.az[i] * dt;
+		}
+	});
+}
+
+static void kick(NBodySystem& s, double dt, JobSystem* jobs)
+{
+	forRange(jobs, s.size(), 16384, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++)
+		{
+			s.vx[i] += s.ax[i] * dt;
+			s.vy[i] += s.ay[i] * dt;
+			s.vz[i] += s.az[i] * dt;
+		}
+	});
+}
+
+static void drift(NBodySystem& s, double dt, JobSystem* jobs)
+{
+	forRange(jobs, s.size(), 16384, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++)
+		{
+			s.x[i] += s.vx[i] * dt;
+			s.y[i] += s.vy[i] * dt;
+			s.z[i] += s.vz[i] * dt;
+		}
+	});
+}
+
+void leapfrogStep(NBodySystem& system, double dt, JobSystem* jobs)
+{
+	// The closing kick of the last step already computed these
+	if (!system.accelerationsValid)
+		computeAccelerations(system, jobs);
+	sortIfDue(system, jobs);
+
+	kick(system, 0.5 * dt, jobs);
+	drift(system, dt, jobs);
+	computeAccelerations(system, jobs);
+	kick(system, 0.5 * dt, jobs);
+}
+
+// Number of times n can be halved; n > 0
+static int trailingZeros(unsigned n)
+{
+	int count = 0;
+	while ((n & 1u) == 0) {
+		n >>= 1;
+		count++;
+	}
+	return count;
+}
+
+void blockLeapfrogStep(NBodySystem& system, double dt, JobSystem* jobs)
+{
+	const size_t count = system.size();
+	if (!system.accelerationsValid)
+		computeAccelerations(system, jobs);
+	sortIfDue(system, jobs);
+
+	// Everyone is synchronised here, so this is where rungs may change
+	system.rung.resize(count);
+	int deepest = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		double v = std::sqrt(system.vx[i] * system.vx[i] + system.vy[i] * system.vy[i] + system.vz[i] * system.vz[i]);
+		double a = std::sqrt(system.ax[i] * system.ax[i] + system.ay[i] * system.ay[i] + system.az[i] * system.az[i]);
+		int r = 0;
+		// Halve until the substep fits in the particle's own step
+		double wanted = a > 0.0 ? system.eta * v / a : dt;
+		while (r < system.maxRung && dt / (double)(1u << r) > wanted)
+			r++;
+		system.rung[i] = (unsigned char)r;
+		deepest = std::max(deepest, r);
+	}
+
+	double halfStep[32];
+	for (int r = 0; r <= deepest; r++)
+		halfStep[r] = 0.5 * dt / (double)(1u << r);
+
+	// Walk the finest substeps; a particle on rung r starts and ends its step
+	// every 2^(deepest - r) of them
+	const unsigned substeps = 1u << deepest;
+	system.lastSubsteps = (int)substeps;
+	system.lastForceEvaluations = 0;
+	for (unsigned step = 0; step < substeps; step++)
+	{
+		int startRung = step == 0 ? 0 : deepest - trailingZeros(step);
+		kickRungs(system, halfStep, startRung, jobs);
+		drift(system, halfStep[deepest] * 2.0, jobs);
+
+		int endRung = step + 1 == substeps ? 0 : deepest - trailingZeros(step + 1);
+		system.tree.build(count, system.x.data(), system.y.data(), system.z.data(), system.mass.data(), jobs);
+		system.tree.accelerations(system.G, system.theta, system.softening,
+			system.ax.data(), system.ay.data(), system.az.data(), jobs, system.rung.data(), endRung, system.deterministic);
+		for (size_t i = 0; i < count; i++)
+			if (system.rung[i] >= endRung)
+				system.lastForceEvaluations++;
+
+		kickRungs(system, halfStep, endRung, jobs);
+	}
+	system.accelerationsValid = true;
+}
+
+double totalEnergy(const NBodySystem& system, JobSystem* jobs)
+{
+	const size_t count = system.size();
+	const double eps2 = system.softening * system.softening;
+	return deterministicSum(jobs, 0, count, 64, [&](size_t first, size_t last) {
+		double kinetic = 0.0, potential = 0.0;
+		for (size_t i = first; i < last; i++)
+		{
+			kinetic += 0.5 * system.mass[i] * (system.vx[i] * system.vx[i] + system.vy[i] * system.vy[i] + system.vz[i] * system.vz[i]);
+			for (size_t j = i + 1; j < count; j++)
+			{
+				double dx = system.x[j] - system.x[i], dy = system.y[j] - system.y[i], dz = system.z[j] - system.z[i];
+				potential -= system.G * system.mass[i] * system.mass[j] / std::sqrt(dx * dx + dy * dy + dz * dz + eps2);
+			}
+		}
+		return kinetic + potential;
+	});
+}
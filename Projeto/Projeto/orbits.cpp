@@ -0,0 +1,110 @@
+#include <algorithm>
+
+#include "orbits.hpp"
+#include "BodyTable.h"
+#include "kepler.hpp"
+#include "jobSystem.hpp"
+#include "ephemeris.hpp"
+
+// Dates per block: enough for full vectors, small enough for the stack
+static const size_t blockDates = 256;
+
+// Every body over the dates [first, last). Parents come before their children,
+// so their positions for the block are final when a child adds them.
+static void positionBlock(const BodyTable& bodies, const double* times, size_t first, size_t last, PositionGrid& out,
+	const Ephemeris* ephemeris)
+{
+	const size_t n = last - first;
+	double a[blockDates], e[blockDates], zero[blockDates], meanAnomaly[blockDates];
+	std::fill(zero, zero + n, 0.0);
+
+	for (size_t i = 0; i < bodies.size(); i++)
+	{
+		double* x = out.x.data() + out.index(i, first);
+		double* y = out.y.data() + out.index(i, first);
+		double* z = out.z.data() + out.index(i, first);
+
+		// One body at many dates is the batch propagator with the elements
+		// repeated and the date folded into the mean anomaly
+		std::fill(a, a + n, bodies.semiMajorAxis[i]);
+		std::fill(e, e + n, bodies.eccentricity[i]);
+		for (size_t k = 0; k < n; k++)
+			meanAnomaly[k] = bodies.meanAnomaly0[i] + bodies.meanMotion[i] * times[first + k];
+		propagateKepler(n, a, e, zero, meanAnomaly, 0.0, x, z);
+		std::fill(y, y + n, 0.0);
+
+		if (bodies.theory[i])
+			for (size_t k = 0; k < n; k++)
+				theoryPosition(bodies, i, times[first + k], x[k], y[k], z[k]);
+
+		// Outside the file's span the analytic position stays
+		int record = ephemeris != NULL && !bodies.ephemerisIndex.empty() ? bodies.ephemerisIndex[i] : -1;
+		if (record >= 0)
+			for (size_t k = 0; k < n; k++)
+			{
+				double ex, ey, ez;
+				if (ephemeris->position(record, times[first + k], ex, ey, ez)) {
+					x[k] = ex;
+					y[k] = ey;
+					z[k] = ez;
+				}
+			}
+
+		int p = bodies.parent[i];
+		if (p >= 0) {
+			const double* px = out.x.data() + out.index(p, first);
+			const double* py = out.y.data() + out.index(p, first);
+			const double* pz = out.z.data() + out.index(p, first);
+			for (size_t k = 0; k < n; k++)
+			{
+				x[k] += px[k];
+				y[k] += py[k];
+				z[k] += pz[k];
+			}
+		}
+	}
+}
+
+void positions(const BodyTable& bodies, const double* times, size_t timeCount, PositionGrid& out,
+	JobSystem* jobs, const Ephemeris* ephemeris)
+{
+	out.bodyCount = bodies.size();
+	out.timeCount = timeCount;
+	out.x.resize(out.bodyCount * timeCount);
+	out.y.resize(out.bodyCount * timeCount);
+	out.z.resize(out.bodyCount * timeCount);
+
+	const size_t blocks = (timeCount + blockDates - 1) / blockDates;
+	auto run = [&](size_t firstBlock, size_t lastBlock) {
+		for (size_t b = firstBlock; b < lastBlock; b++)
+			positionBlock(bodies, times, b * blockDates, std::min(timeCount, (b + 1) * blockDates), out, ephemeris);
+	};
+	if (jobs != NULL)
+		jobs->parallelFor(0, blocks, 1, run);
+	else
+		run(0, blocks);
+}
+
+void bodyPosition(const BodyTable& bodies, size_t body, double t, double& x, double& y, double& z,
+	const Ephemeris* ephemeris)
+{
+	x = y = z = 0.0;
+	for (int i = (int)body; i >= 0; i = bodies.parent[i])
+	{
+		double lx, ly = 0.0, lz;
+		propagateKepler(1, &bodies.semiMajorAxis[i], &bodies.eccentricity[i], &bodies.meanMotion[i],
+			&bodies.meanAnomaly0[i], t, &lx, &lz);
+		if (bodies.theory[i])
+			theoryPosition(bodies, i, t, lx, ly, lz);
+		int record = ephemeris != NULL && !bodies.ephemerisIndex.empty() ? bodies.ephemerisIndex[i] : -1;
+		double ex, ey, ez;
+		if (record >= 0 && ephemeris->position(record, t, ex, ey, ez)) {
+			lx = ex;
+			ly = ey;
+			lz = ez;
+		}
+		x += lx;
+		y += ly;
+		z += lz;
+	}
+}
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "planetTheory.hpp"
+#include "simdMath.hpp"
+
+using simd::vdouble;
+
+static const double j2000 = 2451545.0;
+static const double radiansPerArcsecond = M_PI / 648000.0;
+static const double kilometresPerAU = 149597870.7;
+
+size_t TrigSeries::kept(double threshold) const
+{
+	// Sorted by decreasing amplitude: find the first term below threshold
+	return std::partition_point(amplitude.begin(), amplitude.end(),
+		[threshold](double a) { return std::fabs(a) >= threshold; }) - amplitude.begin();
+}
+
+void TrigSeries::add(double a, double p, const double* m)
+{
+	amplitude.push_back(a);
+	phase.push_back(p);
+	for (int k = 0; k < arguments; k++)
+		multiplier[k].push_back(m[k]);
+}
+
+void TrigSeries::sort()
+{
+	std::vector<size_t> order(size());
+	std::iota(order.begin(), order.end(), (size_t)0);
+	std::stable_sort(order.begin(), order.end(),
+		[this](size_t a, size_t b) { return std::fabs(amplitude[a]) > std::fabs(amplitude[b]); });
+
+	std::vector<double> sorted(size());
+	for (size_t i = 0; i < order.size(); i++)
+		sorted[i] = amplitude[order[i]];
+	amplitude.swap(sorted);
+	for (size_t i = 0; i < order.size(); i++)
+		sorted[i] = phase[order[i]];
+	phase.swap(sorted);
+	for (int k = 0; k < arguments; k++)
+	{
+		for (size_t i = 0; i < order.size(); i++)
+			sorted[i] = multiplier[k][order[i]];
+		multiplier[k].swap(sorted);
+	}
+}
+
+// The argument count is a template parameter so the inner loop has no branches
+template <int arguments>
+static double sumTerms(const TrigSeries& series, size_t count, const double* theta)
+{
+	const int w = simd::width;
+	vdouble angle[arguments > 0 ? arguments : 1];
+	for (int k = 0; k < arguments; k++)
+		angle[k] = vdouble(theta[k]);
+
+	vdouble total(0.0);
+	size_t i = 0;
+	for (; i + w <= count; i += w)
+	{
+		vdouble argument = vdouble::load(series.phase.data() + i);
+		for (int k = 0; k < arguments; k++)
+			argument += vdouble::load(series.multiplier[k].data() + i) * angle[k];
+		total += vdouble::load(series.amplitude.data() + i) * simd::cos(argument);
+	}
+
+	double rest = 0.0;
+	for (; i < count; i++)
+	{
+		double argument = series.phase[i];
+		for (int k = 0; k < arguments; k++)
+			argument += series.multiplier[k][i] * theta[k];
+		rest += series.amplitude[i] * std::cos(argument);
+	}
+	return simd::sum(total) + rest;
+}
+
+double TrigSeries::evaluate(size_t count, const double* theta) const
+{
+	if (arguments == 1)
+		return sumTerms<1>(*this, count, theta);
+	return sumTerms<4>(*this, count, theta);
+}
+
+bool Vsop87Theory::load(const char* path)
+{
+	std::ifstream file(path, std::ios::in);
+	if (!file.is_open()) {
+		printf("Impossible to open %s. Are you in the right directory ?\n", path);
+		return false;
+	}
+
+	for (int c = 0; c < 3; c++)
+		for (int power = 0; power < maxPower; power++)
+		{
+			series[c][power] = TrigSeries();
+			series[c][power].arguments = 1;
+		}
+
+	// Each block starts with a header such as
+	//  VSOP87 VERSION A1    EARTH     VARIABLE 1 (XYZ)       *T**0    843 TERMS ...
+	// followed by one term per line ending in the amplitude A, phase B and
+	// frequency C of A cos(B + C T)
+	std::string line;
+	int lineNumber = 0;
+	char version = 0;
+	TrigSeries* current = NULL;
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+		size_t header = line.find("VSOP87");
+		if (header != std::string::npos) {
+			size_t versionAt = line.find("VERSION", header), variableAt = line.find("VARIABLE", header),
+				powerAt = line.find("*T**", header);
+			if (versionAt == std::string::npos || variableAt == std::string::npos || powerAt == std::string::npos ||
+				versionAt + 8 >= line.size()) {
+				printf("%s:%d: invalid VSOP87 header\n", path, lineNumber);
+				return false;
+			}
+			version = line[versionAt + 8];
+			int variable = atoi(line.c_str() + variableAt + 8), power = atoi(line.c_str() + powerAt + 4);
+			if (strchr("ABCDE", version) == NULL || variable < 1 || variable > 3 || power < 0 || power >= maxPower) {
+				printf("%s:%d: unsupported VSOP87 block (version 0 elements are not handled)\n", path, lineNumber);
+				return false;
+			}
+			current = &series[variable - 1][power];
+			continue;
+		}
+
+		std::istringstream fields(line);
+		std::vector<std::string> tokens;
+		std::string token;
+		while (fields >> token)
+			tokens.push_back(token);
+		if (tokens.empty())
+			continue;
+		if (current == NULL || tokens.size() < 3) {
+			printf("%s:%d: invalid VSOP87 term\n", path, lineNumber);
+			return false;
+		}
+		size_t n = tokens.size();
+		double frequency = atof(tokens[n - 1].c_str());
+		current->add(atof(tokens[n - 3].c_str()), atof(tokens[n - 2].c_str()), &frequency);
+	}
+
+	for (int c = 0; c < 3; c++)
+		for (int power = 0; power < maxPower; power++)
+			series[c][power].sort();
+
+	// The largest constant term: R itself, or the semi-major axis along X
+	spherical = version == 'B' || version == 'D';
+	const TrigSeries& scale = series[spherical ? 2 : 0][0];
+	distance = scale.size() > 0 && scale.amplitude[0] != 0.0 ? std::fabs(scale.amplitude[0]) : 1.0;
+	return true;
+}
+
+void Vsop87Theory::position(double jd, double tolerance, double& x, double& y, double& z) const
+{
+	const double T = (jd - j2000) / 365250.0;
+	double value[3];
+	for (int c = 0; c < 3; c++)
+	{
+		// Angles compare to the tolerance directly, distances relative to their size
+		double threshold = spherical && c < 2 ? tolerance : tolerance * distance;
+		double sum = 0.0;
+		for (int power = maxPower - 1; power >= 0; power--)
+		{
+			const TrigSeries& terms = series[c][power];
+			sum = sum * T + terms.evaluate(terms.kept(threshold), &T);
+		}
+		value[c] = sum;
+	}
+
+	if (spherical) {
+		double cosLatitude = std::cos(value[1]);
+		x = value[2] * cosLatitude * std::cos(value[0]);
+		y = value[2] * cosLatitude * std::sin(value[0]);
+		z = value[2] * std::sin(value[1]);
+	}
+	else {
+		x = value[0];
+		y = value[1];
+		z = value[2];
+	}
+}
+
+size_t Vsop87Theory::termCount(double tolerance) const
+{
+	size_t count = 0;
+	for (int c = 0; c < 3; c++)
+	{
+		double threshold = spherical && c < 2 ? tolerance : tolerance * distance;
+		for (int power = 0; power < maxPower; power++)
+			count += series[c][power].kept(threshold);
+	}
+	return count;
+}
+
+// Reads one main problem file: a title line, then one term per line with the
+// multipliers of D, l', l, F, the amplitude and corrections we do not use.
+// Sine series are stored as cosines with the phase shifted by -pi/2.
+static bool loadElpFile(const std::string& path, double unit, bool sine, TrigSeries& series)
+{
+	std::ifstream file(path.c_str(), std::ios::in);
+	if (!file.is_open()) {
+		printf("Impossible to open %s. Are you in the right directory ?\n", path.c_str());
+		return false;
+	}
+
+	series = TrigSeries();
+	series.arguments = 4;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+		std::istringstream fields(line);
+		int i[4];
+		double amplitude;
+		if (!(fields >> i[0] >> i[1] >> i[2] >> i[3] >> amplitude)) {
+			if (lineNumber == 1)
+				continue;
+			printf("%s:%d: invalid ELP term\n", path.c_str(), lineNumber);
+			return false;
+		}
+		double m[4] = { (double)i[0], (double)i[1], (double)i[2], (double)i[3] };
+		series.add(amplitude * unit, sine ? -0.5 * M_PI : 0.0, m);
+	}
+	series.sort();
+	return series.size() > 0;
+}
+
+bool Elp82Theory::load(const std::string& directory)
+{
+	return loadElpFile(directory + "/ELP1", radiansPerArcsecond, true, longitude) &&
+		loadElpFile(directory + "/ELP2", radiansPerArcsecond, true, latitude) &&
+		loadElpFile(directory + "/ELP3", 1.0 / kilometresPerAU, false, distance);
+}
+
+double Elp82Theory::meanDistance() const
+{
+	// The constant term of the distance series
+	return distance.size() > 0 ? std::fabs(distance.amplitude[0]) : 385000.56 / kilometresPerAU;
+}
+
+static double degreesToRadians(double degrees)
+{
+	return std::fmod(degrees, 360.0) * (M_PI / 180.0);
+}
+
+void Elp82Theory::position(double jd, double tolerance, double& x, double& y, double& z) const
+{
+	const double T = (jd - j2000) / 36525.0;
+	const double T2 = T * T, T3 = T2 * T, T4 = T3 * T;
+
+	// Mean longitude of the Moon and the Delaunay arguments, of date
+	double meanLongitude = degreesToRadians(218.3164477 + 481267.88123421 * T - 0.0015786 * T2 + T3 / 538841.0 - T4 / 65194000.0);
+	double theta[4] = {
+		degreesToRadians(297.8501921 + 445267.1114034 * T - 0.0018819 * T2 + T3 / 545868.0 - T4 / 113065000.0),   // D
+		degreesToRadians(357.5291092 + 35999.0502909 * T - 0.0001536 * T2 + T3 / 24490000.0),                     // l'
+		degreesToRadians(134.9633964 + 477198.8675055 * T + 0.0087414 * T2 + T3 / 69699.0 - T4 / 14712000.0),     // l
+		degreesToRadians(93.2720950 + 483202.0175233 * T - 0.0036539 * T2 - T3 / 3526000.0 + T4 / 863310000.0)    // F
+	};
+
+	double lambda = meanLongitude + longitude.evaluate(longitude.kept(tolerance), theta);
+	double beta = latitude.evaluate(latitude.kept(tolerance), theta);
+	double r = distance.evaluate(distance.kept(tolerance * meanDistance()), theta);
+
+	// General precession in longitude since J2000; the slow tilt of the
+	// ecliptic (47" a century) is left out
+	lambda -= (5029.0966 * T + 1.11113 * T2) * radiansPerArcsecond;
+
+	x = r * std::cos(beta) * std::cos(lambda);
+	y = r * std::cos(beta) * std::sin(lambda);
+	z = r * std::sin(beta);
+}
+
+size_t Elp82Theory::termCount(double tolerance) const
+{
+	return longitude.kept(tolerance) + latitude.kept(tolerance) + distance.kept(tolerance * meanDistance());
+}
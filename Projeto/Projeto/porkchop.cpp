@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+#include "porkchop.hpp"
+#include "BodyTable.h"
+#include "orbits.hpp"
+#include "jobSystem.hpp"
+#include "simdMath.hpp"
+
+using simd::vdouble;
+using simd::vmask;
+
+static const double kmPerSecond = 149597870.7 / 86400.0;   // one AU per day
+static const double fourPiSquared = 39.47841760435743;
+// Bracket of z: below it the transfer is hyperbolic beyond any useful speed,
+// at 4 pi^2 the zero revolution ellipse becomes infinitely long
+static const double lowestZ = -1.0e4;
+// Half a step of the central differences giving the planet velocities, days
+static const double velocityStep = 0.01;
+
+size_t PorkchopGrid::best() const
+{
+	size_t found = departureCount * arrivalCount;
+	for (size_t k = 0; k < deltaV.size(); k++)
+		if (deltaV[k] == deltaV[k] && (found == deltaV.size() || deltaV[k] < deltaV[found]))
+			found = k;
+	return found;
+}
+
+// Stumpff functions c2(z), c3(z) and their derivatives. z is divided by four
+// until every lane is small, c0..c3 are summed from their series there and
+// brought back by the quadrupling formulas (c0 = cos, c1 = sin / s with s^2
+// = z, and their hyperbolic counterparts below zero), so no lane needs sin or
+// cosh. The derivatives c2' = (2 c4 - c3) / 2 and c3' = (3 c5 - c4) / 2 need
+// c4 and c5: (1/2 - c2) / z and (1/6 - c3) / z, or their series near zero.
+static void stumpff(vdouble z, vdouble& c2, vdouble& c3, vdouble& dc2, vdouble& dc3)
+{
+	double lanes[simd::width];
+	simd::abs(z).store(lanes);
+	double largest = *std::max_element(lanes, lanes + simd::width);
+	int quarterings = 0;
+	double scale = 1.0;
+	for (; largest > 0.5 && quarterings < 16; quarterings++)
+	{
+		largest *= 0.25;
+		scale *= 0.25;
+	}
+
+	// c_k = sum over j of (-z)^j / (k + 2j)!, eight terms are enough for |z| <= 0.5
+	vdouble small = z * vdouble(scale);
+	vdouble s2(1.0 / 20922789888000.0), s3(1.0 / 355687428096000.0);
+	double factorial2 = 20922789888000.0, factorial3 = 355687428096000.0;
+	for (int j = 7; j > 0; j--)
+	{
+		factorial2 /= (double)((2 * j + 1) * (2 * j + 2));
+		factorial3 /= (double)((2 * j + 2) * (2 * j + 3));
+		s2 = vdouble(1.0 / factorial2) - small * s2;
+		s3 = vdouble(1.0 / factorial3) - small * s3;
+	}
+	vdouble s0 = vdouble(1.0) - small * s2;
+	vdouble s1 = vdouble(1.0) - small * s3;
+	for (int q = 0; q < quarterings; q++)
+	{
+		vdouble n3 = (s2 + s0 * s3) * vdouble(0.25);
+		vdouble n2 = vdouble(0.5) * s1 * s1;
+		s1 = s0 * s1;
+		s0 = vdouble(2.0) * s0 * s0 - vdouble(1.0);
+		s2 = n2;
+		s3 = n3;
+	}
+	c2 = s2;
+	c3 = s3;
+
+	vdouble c4 = (vdouble(0.5) - c2) / z, c5 = (vdouble(1.0 / 6.0) - c3) / z;
+	vmask nearZero = simd::abs(z) < vdouble(1.0);
+	if (simd::any(nearZero)) {
+		vdouble p4(0.0), p5(0.0);
+		double factorial4 = 1.0, factorial5 = 1.0;
+		for (int k = 2; k <= 23; k++)
+		{
+			if (k <= 22)
+				factorial4 *= k;
+			factorial5 *= k;
+		}
+		// 4 + 2 * 9 = 22, 5 + 2 * 9 = 23: ten terms, exact to rounding for |z| < 1
+		for (int j = 9; j >= 0; j--)
+		{
+			p4 = vdouble(1.0 / factorial4) - z * p4;
+			p5 = vdouble(1.0 / factorial5) - z * p5;
+			if (j > 0) {
+				factorial4 /= (double)((2 * j + 3) * (2 * j + 4));
+				factorial5 /= (double)((2 * j + 4) * (2 * j + 5));
+			}
+		}
+		c4 = simd::select(nearZero, p4, c4);
+		c5 = simd::select(nearZero, p5, c5);
+	}
+	dc2 = (vdouble(2.0) * c4 - c3) * vdouble(0.5);
+	dc3 = (vdouble(3.0) * c5 - c4) * vdouble(0.5);
+}
+
+struct Departure
+{
+	double x, y, z;         // position relative to the parent, AU
+	double vx, vy, vz;      // AU/day
+	double r;
+	double nx, ny, nz;      // direction of the orbit's angular momentum (prograde)
+};
+
+// One departure against simd::width arrival dates. Arrays hold the arrival
+// body's state for those dates; dt is the flight time of each lane, skip the
+// lanes left empty.
+static void solveLanes(const Departure& from, const double* x2, const double* y2, const double* z2,
+	const double* vx2, const double* vy2, const double* vz2, const double* dt, const bool* skip, double mu,
+	float* c3Out, float* arrivalOut, float* deltaVOut)
+{
+	const vdouble one(1.0), zero(0.0), half(0.5);
+	const vdouble sqrtMu(std::sqrt(mu));
+	const vdouble r1(from.r);
+	const vdouble x1(from.x), y1(from.y), z1(from.z);
+
+	vdouble bx = vdouble::load(x2), by = vdouble::load(y2), bz = vdouble::load(z2);
+	vdouble r2 = simd::sqrt(bx * bx + by * by + bz * bz);
+	vdouble time = vdouble::load(dt);
+
+	// Transfer angle: its cosine from the dot product, the sign of its sine
+	// from the side of the departure orbit's plane the cross product is on
+	vdouble crossX = y1 * bz - z1 * by, crossY = z1 * bx - x1 * bz, crossZ = x1 * by - y1 * bx;
+	vdouble crossLength = simd::sqrt(crossX * crossX + crossY * crossY + crossZ * crossZ);
+	vdouble side = crossX * vdouble(from.nx) + crossY * vdouble(from.ny) + crossZ * vdouble(from.nz);
+	vdouble cosAngle = (x1 * bx + y1 * by + z1 * bz) / (r1 * r2);
+	vdouble sinAngle = crossLength / (r1 * r2);
+	sinAngle = simd::select(side < zero, -sinAngle, sinAngle);
+	vdouble A = sinAngle * simd::sqrt(r1 * r2 / simd::max(one - cosAngle, vdouble(1e-300)));
+
+	// F(z) = chi^3 c3 + A sqrt(y) - sqrt(mu) dt rises from negative (or y <
+	// 0, left of the root) to +infinity at 4 pi^2
+	vdouble zLow(lowestZ), zHigh(fourPiSquared);
+	vdouble z(0.0), y(0.0), F(0.0);
+	for (int iteration = 0; iteration < 64; iteration++)
+	{
+		vdouble c2, c3, dc2, dc3;
+		stumpff(z, c2, c3, dc2, dc3);
+		vdouble rootC2 = simd::sqrt(c2);
+		y = r1 + r2 + A * (z * c3 - one) / rootC2;
+		vmask valid = y > zero;
+		vdouble safeY = simd::select(valid, y, one);
+		vdouble rootY = simd::sqrt(safeY);
+		vdouble chi2 = safeY / c2;
+		vdouble chi = simd::sqrt(chi2);
+		F = simd::select(valid, chi2 * chi * c3 + A * rootY - sqrtMu * time, vdouble(-1.0));
+
+		zLow = simd::select(F < zero, z, zLow);
+		zHigh = simd::select(F > zero, z, zHigh);
+
+		vdouble dy = A * ((c3 + z * dc3) * rootC2 - (z * c3 - one) * dc2 * half / rootC2) / c2;
+		vdouble dchi2 = (dy * c2 - safeY * dc2) / (c2 * c2);
+		vdouble dF = vdouble(1.5) * chi * dchi2 * c3 + chi2 * chi * dc3 + A * dy * half / rootY;
+		vdouble next = z - F / dF;
+
+		// Newton where it stays inside the bracket, bisection elsewhere (NaN
+		// fails both comparisons and is bisected too)
+		vmask inside = valid & (next > zLow) & (next < zHigh);
+		next = simd::select(inside, next, half * (zLow + zHigh));
+		vmask moving = simd::abs(next - z) > vdouble(1e-12) * (one + simd::abs(z));
+		z = next;
+		if (!simd::any(moving))
+			break;
+	}
+
+	// Lagrange coefficients give both ends of the transfer
+	vdouble c2, c3, dc2, dc3;
+	stumpff(z, c2, c3, dc2, dc3);
+	y = r1 + r2 + A * (z * c3 - one) / simd::sqrt(c2);
+	vdouble f = one - y / r1;
+	vdouble g = A * simd::sqrt(y / vdouble(mu));
+	vdouble gDot = one - y / r2;
+	vdouble v1x = (bx - f * x1) / g - vdouble(from.vx);
+	vdouble v1y = (by - f * y1) / g - vdouble(from.vy);
+	vdouble v1z = (bz - f * z1) / g - vdouble(from.vz);
+	vdouble v2x = (gDot * bx - x1) / g - vdouble::load(vx2);
+	vdouble v2y = (gDot * by - y1) / g - vdouble::load(vy2);
+	vdouble v2z = (gDot * bz - z1) / g - vdouble::load(vz2);
+	vdouble departureSquared = v1x * v1x + v1y * v1y + v1z * v1z;
+	vdouble arrivalSpeed = simd::sqrt(v2x * v2x + v2y * v2y + v2z * v2z);
+
+	double c3Lanes[simd::width], arrivalLanes[simd::width], departureLanes[simd::width], yLanes[simd::width];
+	(departureSquared * vdouble(kmPerSecond * kmPerSecond)).store(c3Lanes);
+	(arrivalSpeed * vdouble(kmPerSecond)).store(arrivalLanes);
+	y.store(yLanes);
+	for (int l = 0; l < simd::width; l++)
+	{
+		departureLanes[l] = std::sqrt(c3Lanes[l]);
+		bool solved = !skip[l] && yLanes[l] > 0.0 && std::isfinite(c3Lanes[l]) && std::isfinite(arrivalLanes[l]);
+		const float nan = std::numeric_limits<float>::quiet_NaN();
+		c3Out[l] = solved ? (float)c3Lanes[l] : nan;
+		arrivalOut[l] = solved ? (float)arrivalLanes[l] : nan;
+		deltaVOut[l] = solved ? (float)(departureLanes[l] + arrivalLanes[l]) : nan;
+	}
+}
+
+// Positions and velocities of body relative to parent at the dates, velocities
+// as (p(t + h) - p(t - h)) / 2h
+static void bodyStates(const BodyTable& bodies, int body, int parent, const std::vector<double>& dates,
+	std::vector<double> state[6], JobSystem* jobs, const Ephemeris* ephemeris)
+{
+	const size_t n = dates.size();
+	std::vector<double> times(3 * n);
+	for (size_t k = 0; k < n; k++)
+	{
+		times[k] = dates[k];
+		times[n + k] = dates[k] - velocityStep;
+		times[2 * n + k] = dates[k] + velocityStep;
+	}
+	PositionGrid grid;
+	positions(bodies, times.data(), times.size(), grid, jobs, ephemeris);
+
+	for (int c = 0; c < 6; c++)
+		state[c].resize(n);
+	const std::vector<double>* axes[3] = { &grid.x, &grid.y, &grid.z };
+	for (int c = 0; c < 3; c++)
+	{
+		const std::vector<double>& p = *axes[c];
+		for (size_t k = 0; k < n; k++)
+		{
+			double relative[3];
+			for (int s = 0; s < 3; s++)
+				relative[s] = p[grid.index(body, s * n + k)] - (parent >= 0 ? p[grid.index(parent, s * n + k)] : 0.0);
+			state[c][k] = relative[0];
+			state[3 + c][k] = (relative[2] - relative[1]) / (2.0 * velocityStep);
+		}
+	}
+}
+
+static double parentGM(const BodyTable& bodies, int body)
+{
+	double a = bodies.semiMajorAxis[body], n = bodies.meanMotion[body];
+	return a * a * a * n * n;
+}
+
+PorkchopSearch porkchopWindow(const BodyTable& bodies, int from, int to, double departureBegin, double departureEnd)
+{
+	PorkchopSearch search;
+	search.departureBegin = departureBegin;
+	search.departureEnd = departureEnd;
+	double mu = parentGM(bodies, from);
+	double transfer = 0.5 * (bodies.semiMajorAxis[from] + bodies.semiMajorAxis[to]);
+	double hohmann = mu > 0.0 ? 3.14159265358979324 * std::sqrt(transfer * transfer * transfer / mu) : 365.25;
+	search.arrivalBegin = departureBegin + 0.5 * hohmann;
+	search.arrivalEnd = departureEnd + 2.0 * hohmann;
+	return search;
+}
+
+bool computePorkchop(const BodyTable& bodies, int from, int to, const PorkchopSearch& search, PorkchopGrid& out,
+	JobSystem* jobs, const Ephemeris* ephemeris)
+{
+	if (from < 0 || to < 0 || from == to || bodies.parent[from] != bodies.parent[to] || parentGM(bodies, from) <= 0.0) {
+		printf("Porkchop: the two bodies must differ and orbit the same parent\n");
+		return false;
+	}
+	const int parent = bodies.parent[from];
+	const double mu = parentGM(bodies, from);
+
+	out.from = from;
+	out.to = to;
+	out.departureCount = search.departureCount;
+	out.arrivalCount = search.arrivalCount;
+	out.departure.resize(out.departureCount);
+	out.arrival.resize(out.arrivalCount);
+	for (size_t d = 0; d < out.departureCount; d++)
+		out.departure[d] = search.departureBegin +
+			(search.departureEnd - search.departureBegin) * d / std::max<size_t>(1, out.departureCount - 1);
+	for (size_t a = 0; a < out.arrivalCount; a++)
+		out.arrival[a] = search.arrivalBegin +
+			(search.arrivalEnd - search.arrivalBegin) * a / std::max<size_t>(1, out.arrivalCount - 1);
+	const size_t cells = out.departureCount * out.arrivalCount;
+	out.c3.resize(cells);
+	out.arrivalSpeed.resize(cells);
+	out.deltaV.resize(cells);
+
+	std::vector<double> departureState[6], arrivalState[6];
+	bodyStates(bodies, from, parent, out.departure, departureState, jobs, ephemeris);
+	bodyStates(bodies, to, parent, out.arrival, arrivalState, jobs, ephemeris);
+
+	// Arrival dates padded to whole vectors with copies of the last one
+	const int w = simd::width;
+	const size_t padded = (out.arrivalCount + w - 1) / w * w;
+	for (int c = 0; c < 6; c++)
+		arrivalState[c].resize(padded, arrivalState[c].empty() ? 0.0 : arrivalState[c].back());
+
+	auto run = [&](size_t firstRow, size_t lastRow) {
+		for (size_t d = firstRow; d < lastRow; d++)
+		{
+			Departure start;
+			start.x = departureState[0][d];
+			start.y = departureState[1][d];
+			start.z = departureState[2][d];
+			start.vx = departureState[3][d];
+			start.vy = departureState[4][d];
+			start.vz = departureState[5][d];
+			start.r = std::sqrt(start.x * start.x + start.y * start.y + start.z * start.z);
+			start.nx = start.y * start.vz - start.z * start.vy;
+			start.ny = start.z * start.vx - start.x * start.vz;
+			start.nz = start.x * start.vy - start.y * start.vx;
+
+			for (size_t a = 0; a < padded; a += w)
+			{
+				double dt[simd::width];
+				bool skip[simd::width];
+				float c3[simd::width], arrivalSpeed[simd::width], deltaV[simd::width];
+				for (int l = 0; l < w; l++)
+				{
+					double flight = a + l < out.arrivalCount ? out.arrival[a + l] - out.departure[d] : 0.0;
+					skip[l] = !(flight >= search.minimumFlight);
+					dt[l] = std::max(flight, search.minimumFlight);
+				}
+				solveLanes(start, &arrivalState[0][a], &arrivalState[1][a], &arrivalState[2][a],
+					&arrivalState[3][a], &arrivalState[4][a], &arrivalState[5][a], dt, skip, mu, c3, arrivalSpeed, deltaV);
+				for (int l = 0; l < w && a + l < out.arrivalCount; l++)
+				{
+					size_t k = out.index(d, a + l);
+					out.c3[k] = c3[l];
+					out.arrivalSpeed[k] = arrivalSpeed[l];
+					out.deltaV[k] = deltaV[l];
+				}
+			}
+		}
+	};
+	if (jobs != NULL)
+		jobs->parallelFor(0, out.departureCount, 8, run);
+	else
+		run(0, out.departureCount);
+	return true;
+}
+
+void porkchopImage(const PorkchopGrid& grid, float maxDeltaV, std::vector<unsigned char>& rgba)
+{
+	const size_t width = grid.departureCount, height = grid.arrivalCount;
+	rgba.assign(width * height * 4, 0);
+	size_t best = grid.best();
+	if (best >= grid.deltaV.size())
+		return;
+	const float lowest = grid.deltaV[best];
+	const float range = std::max(maxDeltaV - lowest, 1e-3f);
+
+	// Blue, cyan, green, yellow, red
+	static const float ramp[5][3] = { { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 } };
+	for (size_t a = 0; a < height; a++)
+		for (size_t d = 0; d < width; d++)
+		{
+			float value = grid.deltaV[grid.index(d, a)];
+			if (!(value <= maxDeltaV))
+				continue;
+			float u = (value - lowest) / range * 4.0f;
+			int segment = std::min(3, (int)u);
+			float f = u - segment;
+			// Darker where the value is close to a whole km/s
+			float contour = std::fabs(value - std::floor(value + 0.5f)) < 0.05f ? 0.55f : 1.0f;
+			unsigned char* pixel = &rgba[(a * width + d) * 4];
+			for (int c = 0; c < 3; c++)
+				pixel[c] = (unsigned char)(255.0f * contour * (ramp[segment][c] + f * (ramp[segment + 1][c] - ramp[segment][c])));
+			pixel[3] = 255;
+		}
+}
@@ -0,0 +1,594 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET SocketHandle;
+static const SocketHandle invalidSocket = INVALID_SOCKET;
+static const int sendFlags = 0;
+static void closeSocket(SocketHandle s) { closesocket(s); }
+static int processId() { return (int)GetCurrentProcessId(); }
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int SocketHandle;
+static const SocketHandle invalidSocket = -1;
+static const int sendFlags = MSG_NOSIGNAL;     // a client that went away is an error, not a signal
+static void closeSocket(SocketHandle s) { ::close(s); }
+static int processId() { return (int)getpid(); }
+#endif
+
+#include "queryServer.hpp"
+#include "BodyTable.h"
+#include "orbits.hpp"
+#include "jobSystem.hpp"
+
+// Largest request accepted, so a bad header cannot make the server allocate
+// gigabytes: 2^22 dates (32 MB received) and a 256 MB answer. positions()
+// fills a grid for every body of the scene, so the dates are evaluated a
+// chunk at a time, each grid within gridBudget bytes.
+static const uint32_t maxTimes = 1u << 22;
+static const uint64_t maxResponseBytes = 256ull << 20;
+static const size_t gridBudget = 32u << 20;
+
+static bool startSockets()
+{
+#ifdef _WIN32
+	static bool started = false;
+	WSADATA data;
+	if (!started && WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+		printf("Winsock could not be started\n");
+		return false;
+	}
+	started = true;
+#endif
+	return true;
+}
+
+static bool sendAll(SocketHandle s, const void* data, size_t bytes)
+{
+	const char* p = (const char*)data;
+	while (bytes > 0)
+	{
+		int chunk = (int)std::min<size_t>(bytes, 1 << 30);
+		int sent = send(s, p, chunk, sendFlags);
+		if (sent <= 0)
+			return false;
+		p += sent;
+		bytes -= sent;
+	}
+	return true;
+}
+
+static bool receiveAll(SocketHandle s, void* data, size_t bytes)
+{
+	char* p = (char*)data;
+	while (bytes > 0)
+	{
+		int chunk = (int)std::min<size_t>(bytes, 1 << 30);
+		int got = recv(s, p, chunk, 0);
+		if (got <= 0)
+			return false;
+		p += got;
+		bytes -= got;
+	}
+	return true;
+}
+
+static bool fillAddress(const char* socketPath, sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(address.sun_path)) {
+		printf("Socket path %s is too long\n", socketPath);
+		return false;
+	}
+	memcpy(address.sun_path, socketPath, strlen(socketPath));
+	return true;
+}
+
+// A socket file left by a server that was killed would make bind fail, so it
+// is removed; anything else at the path is the user's and stays
+static bool removeStaleSocket(const char* socketPath)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE search = FindFirstFileA(socketPath, &found);
+	if (search == INVALID_HANDLE_VALUE)
+		return true;
+	FindClose(search);
+	bool socketFile = (found.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0 && found.dwReserved0 == IO_REPARSE_TAG_AF_UNIX;
+#else
+	struct stat status;
+	if (lstat(socketPath, &status) != 0)
+		return true;
+	bool socketFile = S_ISSOCK(status.st_mode);
+#endif
+	if (!socketFile) {
+		printf("%s exists and is not a socket, choose another path\n", socketPath);
+		return false;
+	}
+	remove(socketPath);
+	return true;
+}
+
+// Shared memory block a connection writes large payloads into. Windows
+// mappings cannot grow, so a bigger block is a new one with a new name.
+class SharedBlock
+{
+public:
+	SharedBlock() : view(NULL), capacity(0), generation(0)
+#ifdef _WIN32
+		, mapping(NULL)
+#endif
+	{}
+	~SharedBlock() { release(); }
+
+	// Room for bytes; prefix names the owner
+	unsigned char* reserve(const std::string& prefix, size_t bytes)
+	{
+		if (view != NULL && bytes <= capacity)
+			return view;
+		release();
+		size_t size = std::max<size_t>(bytes + bytes / 2, 1 << 20);
+		char buffer[sizeof(((QueryResponse*)0)->sharedName)];
+		snprintf(buffer, sizeof(buffer), "%s-%d", prefix.c_str(), generation++);
+		name = buffer;
+#ifdef _WIN32
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32),
+			(DWORD)size, name.c_str());
+		if (mapping != NULL)
+			view = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+#else
+		int file = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (file >= 0) {
+			if (ftruncate(file, (off_t)size) == 0) {
+				void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+				if (mapped != MAP_FAILED)
+					view = (unsigned char*)mapped;
+			}
+			::close(file);
+		}
+#endif
+		if (view == NULL) {
+			printf("Could not create shared memory %s\n", name.c_str());
+			release();
+			return NULL;
+		}
+		capacity = size;
+		return view;
+	}
+
+	void release()
+	{
+#ifdef _WIN32
+		if (view != NULL)
+			UnmapViewOfFile(view);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		mapping = NULL;
+#else
+		if (view != NULL)
+			munmap(view, capacity);
+		if (!name.empty())
+			shm_unlink(name.c_str());
+#endif
+		view = NULL;
+		capacity = 0;
+		name.clear();
+	}
+
+	std::string name;
+
+private:
+	unsigned char* view;
+	size_t capacity;
+	int generation;
+#ifdef _WIN32
+	HANDLE mapping;
+#endif
+};
+
+struct Connection
+{
+	SocketHandle socket;
+	std::string blockPrefix;
+	SharedBlock block;
+	std::vector<int> bodies;
+	std::vector<double> times;
+	std::vector<unsigned char> payload;
+};
+
+class QueryServer
+{
+public:
+	QueryServer(const BodyTable& bodies) : bodies(bodies), jobs(JobSystem::defaultWorkerCount()), connectionCount(0)
+	{
+		memset(&counters, 0, sizeof(counters));
+		memset(&reported, 0, sizeof(reported));
+		lastReport = std::chrono::steady_clock::now();
+	}
+
+	// false when the connection has to be closed
+	bool serve(Connection& connection);
+	void report(bool force);
+	std::string nextBlockPrefix();
+
+private:
+	const BodyTable& bodies;
+	JobSystem jobs;
+	PositionGrid grid;
+	QueryStats counters, reported;
+	std::chrono::steady_clock::time_point lastReport;
+	int connectionCount;
+
+	bool respond(Connection& connection, uint32_t status, const unsigned char* inlinePayload, uint64_t bytes, bool shared);
+};
+
+std::string QueryServer::nextBlockPrefix()
+{
+	// Windows wants Local\ for a session-wide name, POSIX a leading slash
+#ifdef _WIN32
+	const char* root = "Local\\projeto";
+#else
+	const char* root = "/projeto";
+#endif
+	char prefix[40];
+	snprintf(prefix, sizeof(prefix), "%s-%d-%d", root, processId(), connectionCount++);
+	return prefix;
+}
+
+bool QueryServer::respond(Connection& connection, uint32_t status, const unsigned char* inlinePayload, uint64_t bytes, bool shared)
+{
+	QueryResponse response;
+	memset(&response, 0, sizeof(response));
+	response.magic = queryMagic;
+	response.status = status;
+	response.bytes = bytes;
+	response.shared = shared ? 1 : 0;
+	if (shared)
+		memcpy(response.sharedName, connection.block.name.c_str(), connection.block.name.size());
+	return sendAll(connection.socket, &response, sizeof(response)) &&
+		(shared || bytes == 0 || sendAll(connection.socket, inlinePayload, (size_t)bytes));
+}
+
+bool QueryServer::serve(Connection& connection)
+{
+	QueryRequest request;
+	if (!receiveAll(connection.socket, &request, sizeof(request)) || request.magic != queryMagic)
+		return false;
+	// The indices and dates of a refused header are still in the socket and
+	// would be read as the next request: refuse and close instead
+	if (request.bodyCount > bodies.size() || request.timeCount > maxTimes) {
+		respond(connection, 1, NULL, 0, false);
+		return false;
+	}
+	connection.bodies.resize(request.bodyCount);
+	connection.times.resize(request.timeCount);
+	if ((request.bodyCount > 0 && !receiveAll(connection.socket, connection.bodies.data(), request.bodyCount * sizeof(int32_t))) ||
+		(request.timeCount > 0 && !receiveAll(connection.socket, connection.times.data(), request.timeCount * sizeof(double))))
+		return false;
+
+	// Latency is counted from a whole request in hand to the answer sent
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool ok;
+	uint64_t positionCount = 0, bytes = 0;
+	if (request.kind == queryPositions) {
+		if (connection.bodies.empty())
+			for (size_t i = 0; i < bodies.size(); i++)
+				connection.bodies.push_back((int)i);
+		for (size_t k = 0; k < connection.bodies.size(); k++)
+			if (connection.bodies[k] < 0 || connection.bodies[k] >= (int)bodies.size())
+				return respond(connection, 1, NULL, 0, false);
+		positionCount = (uint64_t)connection.bodies.size() * connection.times.size();
+		bytes = positionCount * 3 * sizeof(double);
+		if (bytes > maxResponseBytes)
+			return respond(connection, 1, NULL, 0, false);
+		bool shared = bytes > sharedThreshold;
+		unsigned char* out;
+		if (shared) {
+			out = connection.block.reserve(connection.blockPrefix, (size_t)bytes);
+			if (out == NULL)
+				return respond(connection, 2, NULL, 0, false);
+		}
+		else {
+			connection.payload.resize((size_t)bytes);
+			out = connection.payload.data();
+		}
+
+		const size_t timeCount = connection.times.size();
+		const size_t chunk = std::max<size_t>(1, gridBudget / (std::max<size_t>(1, bodies.size()) * 3 * sizeof(double)));
+		for (size_t first = 0; first < timeCount; first += chunk)
+		{
+			size_t count = std::min(chunk, timeCount - first);
+			positions(bodies, connection.times.data() + first, count, grid, &jobs);
+			for (size_t k = 0; k < connection.bodies.size(); k++)
+			{
+				int body = connection.bodies[k];
+				double* values = (double*)out + (k * timeCount + first) * 3;
+				for (size_t t = 0; t < count; t++)
+				{
+					size_t g = grid.index(body, t);
+					*values++ = grid.x[g];
+					*values++ = grid.y[g];
+					*values++ = grid.z[g];
+				}
+			}
+		}
+		ok = respond(connection, 0, out, bytes, shared);
+	}
+	else if (request.kind == queryNames) {
+		connection.payload.clear();
+		for (size_t i = 0; i < bodies.size(); i++)
+			connection.payload.insert(connection.payload.end(), bodies.name[i].c_str(), bodies.name[i].c_str() + bodies.name[i].size() + 1);
+		bytes = connection.payload.size();
+		ok = respond(connection, 0, connection.payload.data(), bytes, false);
+	}
+	else if (request.kind == queryStats) {
+		bytes = sizeof(counters);
+		ok = respond(connection, 0, (const unsigned char*)&counters, bytes, false);
+	}
+	else
+		ok = respond(connection, 1, NULL, 0, false);
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	counters.requests++;
+	counters.positions += positionCount;
+	counters.bytes += bytes;
+	counters.totalMilliseconds += ms;
+	counters.maxMilliseconds = std::max(counters.maxMilliseconds, ms);
+	return ok;
+}
+
+// Throughput since the last report, every few seconds while there is traffic
+void QueryServer::report(bool force)
+{
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - lastReport).count();
+	uint64_t requests = counters.requests - reported.requests;
+	if (requests == 0 || (seconds < 5.0 && !force))
+		return;
+	printf("Query server: %llu requests, %.1f M positions/s, %.1f MB/s, latency mean %.3f ms, max %.3f ms\n",
+		(unsigned long long)requests, (counters.positions - reported.positions) / seconds / 1e6,
+		(counters.bytes - reported.bytes) / seconds / 1e6,
+		(counters.totalMilliseconds - reported.totalMilliseconds) / requests, counters.maxMilliseconds);
+	reported = counters;
+	lastReport = std::chrono::steady_clock::now();
+}
+
+static volatile std::sig_atomic_t stopServer = 0;
+
+static void onInterrupt(int)
+{
+	stopServer = 1;
+}
+
+int runQueryServer(const char* socketPath, const char* scenePath)
+{
+	BodyTable bodies;
+	if (!loadBodyTable(scenePath, bodies) || !startSockets())
+		return 1;
+
+	sockaddr_un address;
+	if (!fillAddress(socketPath, address) || !removeStaleSocket(socketPath))
+		return 1;
+	SocketHandle listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == invalidSocket || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+		printf("Impossible to listen on %s\n", socketPath);
+		if (listener != invalidSocket)
+			closeSocket(listener);
+		return 1;
+	}
+
+	QueryServer server(bodies);
+	std::vector<std::unique_ptr<Connection> > connections;
+	std::signal(SIGINT, onInterrupt);
+	printf("Serving %zu bodies of %s on %s, Ctrl+C to stop\n", bodies.size(), scenePath, socketPath);
+
+	while (!stopServer)
+	{
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(listener, &readable);
+		SocketHandle highest = listener;
+		for (size_t c = 0; c < connections.size(); c++)
+		{
+			FD_SET(connections[c]->socket, &readable);
+			highest = std::max(highest, connections[c]->socket);
+		}
+		// Wake up now and then to notice Ctrl+C and print the counters
+		timeval timeout = { 1, 0 };
+		int ready = select((int)highest + 1, &readable, NULL, NULL, &timeout);
+		server.report(false);
+		if (ready <= 0)
+			continue;
+
+		for (size_t c = 0; c < connections.size();)
+		{
+			if (FD_ISSET(connections[c]->socket, &readable) && !server.serve(*connections[c])) {
+				closeSocket(connections[c]->socket);
+				connections.erase(connections.begin() + c);
+			}
+			else
+				c++;
+		}
+
+		if (FD_ISSET(listener, &readable)) {
+			SocketHandle client = accept(listener, NULL, NULL);
+			// select() watches at most FD_SETSIZE sockets
+			if (client != invalidSocket && connections.size() + 1 >= FD_SETSIZE)
+				closeSocket(client);
+			else if (client != invalidSocket) {
+				std::unique_ptr<Connection> connection(new Connection());
+				connection->socket = client;
+				connection->blockPrefix = server.nextBlockPrefix();
+				connections.push_back(std::move(connection));
+			}
+		}
+	}
+
+	server.report(true);
+	for (size_t c = 0; c < connections.size(); c++)
+		closeSocket(connections[c]->socket);
+	connections.clear();
+	closeSocket(listener);
+	remove(socketPath);
+	return 0;
+}
+
+#ifdef _WIN32
+QueryClient::QueryClient() : socket((intptr_t)INVALID_SOCKET), view(NULL), viewBytes(0), mapping(NULL) {}
+#else
+QueryClient::QueryClient() : socket(-1), view(NULL), viewBytes(0) {}
+#endif
+
+QueryClient::~QueryClient()
+{
+	close();
+}
+
+bool QueryClient::connect(const char* socketPath)
+{
+	close();
+	sockaddr_un address;
+	if (!startSockets() || !fillAddress(socketPath, address))
+		return false;
+	SocketHandle s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == invalidSocket)
+		return false;
+	if (::connect(s, (sockaddr*)&address, sizeof(address)) != 0) {
+		printf("Impossible to connect to %s. Is the server running (Projeto --serve) ?\n", socketPath);
+		closeSocket(s);
+		return false;
+	}
+	socket = (intptr_t)s;
+	return true;
+}
+
+void QueryClient::close()
+{
+	unmap();
+	if ((SocketHandle)socket != invalidSocket)
+		closeSocket((SocketHandle)socket);
+	socket = (intptr_t)invalidSocket;
+}
+
+void QueryClient::unmap()
+{
+#ifdef _WIN32
+	if (view != NULL)
+		UnmapViewOfFile(view);
+	if (mapping != NULL)
+		CloseHandle(mapping);
+	mapping = NULL;
+#else
+	if (view != NULL)
+		munmap(view, viewBytes);
+#endif
+	view = NULL;
+	viewBytes = 0;
+	mappedName.clear();
+}
+
+const unsigned char* QueryClient::request(uint32_t kind, const std::vector<int>& bodies, const std::vector<double>& times,
+	uint64_t& bytes)
+{
+	SocketHandle s = (SocketHandle)socket;
+	QueryRequest header = { queryMagic, kind, (uint32_t)bodies.size(), (uint32_t)times.size() };
+	QueryResponse response;
+	if (s == invalidSocket || !sendAll(s, &header, sizeof(header)) ||
+		(!bodies.empty() && !sendAll(s, bodies.data(), bodies.size() * sizeof(int32_t))) ||
+		(!times.empty() && !sendAll(s, times.data(), times.size() * sizeof(double))) ||
+		!receiveAll(s, &response, sizeof(response)) || response.magic != queryMagic) {
+		close();
+		return NULL;
+	}
+	bytes = response.bytes;
+	if (response.status != 0)
+		return NULL;
+
+	if (!response.shared) {
+		received.resize((size_t)bytes);
+		if (bytes > 0 && !receiveAll(s, received.data(), (size_t)bytes)) {
+			close();
+			return NULL;
+		}
+		return received.data();
+	}
+
+	// Same block as last time unless the server had to make a bigger one
+	response.sharedName[sizeof(response.sharedName) - 1] = '\0';
+	if (mappedName != response.sharedName || bytes > viewBytes) {
+		unmap();
+#ifdef _WIN32
+		mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, response.sharedName);
+		if (mapping != NULL)
+			view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (size_t)bytes);
+#else
+		int file = shm_open(response.sharedName, O_RDONLY, 0);
+		if (file >= 0) {
+			void* mapped = mmap(NULL, (size_t)bytes, PROT_READ, MAP_SHARED, file, 0);
+			if (mapped != MAP_FAILED)
+				view = mapped;
+			::close(file);
+		}
+#endif
+		if (view == NULL) {
+			printf("Could not map the shared memory %s\n", response.sharedName);
+			unmap();
+			return NULL;
+		}
+		mappedName = response.sharedName;
+		viewBytes = (size_t)bytes;
+	}
+	return (const unsigned char*)view;
+}
+
+const double* QueryClient::positions(const std::vector<int>& bodies, const std::vector<double>& times, size_t& count)
+{
+	uint64_t bytes = 0;
+	const unsigned char* payload = request(queryPositions, bodies, times, bytes);
+	count = payload != NULL ? (size_t)(bytes / sizeof(double)) : 0;
+	return (const double*)payload;
+}
+
+bool QueryClient::names(std::vector<std::string>& bodyNames)
+{
+	uint64_t bytes = 0;
+	const unsigned char* payload = request(queryNames, std::vector<int>(), std::vector<double>(), bytes);
+	if (payload == NULL)
+		return false;
+	bodyNames.clear();
+	for (size_t at = 0; at < bytes;)
+	{
+		size_t length = strnlen((const char*)payload + at, (size_t)bytes - at);
+		bodyNames.push_back(std::string((const char*)payload + at, length));
+		at += length + 1;
+	}
+	return true;
+}
+
+bool QueryClient::stats(QueryStats& counters)
+{
+	uint64_t bytes = 0;
+	const unsigned char* payload = request(queryStats, std::vector<int>(), std::vector<double>(), bytes);
+	if (payload == NULL || bytes != sizeof(QueryStats))
+		return false;
+	memcpy(&counters, payload, sizeof(counters));
+	return true;
+}
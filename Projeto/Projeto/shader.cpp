@@ -5,20 +5,249 @@
 #include <fstream>
 #include <algorithm>
 #include <sstream>
+#include <map>
+#include <chrono>
 using namespace std;
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 #include <GL/glew.h>
 
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+// Uniform locations of every program LoadShaders made, by name
+static std::map<GLuint, std::map<std::string, GLint> > uniformTables;
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+// Reads the active uniforms of a linked program into its table and binds the
+// uniform blocks it knows to their binding points (GLSL 3.30 has no binding
+// layout qualifier)
+static void reflectProgram(GLuint ProgramID){
+	std::map<std::string, GLint>& table = uniformTables[ProgramID];
+	table.clear();
+
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(ProgramID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(ProgramID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<char> name(maxLength + 1);
+	for (GLint i = 0; i < count; i++) {
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(ProgramID, (GLuint)i, (GLsizei)name.size(), NULL, &size, &type, &name[0]);
+		// Members of uniform blocks have no location; they are set through the block's buffer
+		GLint location = glGetUniformLocation(ProgramID, &name[0]);
+		if (location < 0)
+			continue;
+		std::string uniform(&name[0]);
+		table[uniform] = location;
+		// Arrays are reported as "name[0]"; the bare name is just as valid
+		if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+			table[uniform.substr(0, uniform.size() - 3)] = location;
+	}
+
+	GLuint frameBlock = glGetUniformBlockIndex(ProgramID, "Frame");
+	if (frameBlock != GL_INVALID_INDEX)
+		glUniformBlockBinding(ProgramID, frameBlock, frameUniformBinding);
+}
+
+GLint uniformLocation(GLuint programID, const char * name){
+	std::map<GLuint, std::map<std::string, GLint> >::const_iterator program = uniformTables.find(programID);
+	if (program != uniformTables.end()) {
+		std::map<std::string, GLint>::const_iterator uniform = program->second.find(name);
+		if (uniform != program->second.end())
+			return uniform->second;
+	}
+	printf("Program %u has no active uniform %s\n", programID, name);
+	return -1;
+}
+
+FrameUniformBuffer::FrameUniformBuffer(){
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, frameUniformBinding, buffer);
+}
+
+FrameUniformBuffer::~FrameUniformBuffer(){
+	glDeleteBuffers(1, &buffer);
+}
+
+void FrameUniformBuffer::update(const FrameUniforms& frame){
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Linked programs are kept in shadercache/<key>.bin, the key hashing both
+// sources and the driver's vendor, renderer and version strings, so editing a
+// shader or updating the driver simply misses the cache. A file the driver
+// rejects (glProgramBinary fails to link) is compiled over, silently.
+static const char* programCacheDirectory = "shadercache";
+static const char programCacheMagic[8] = { 'P', 'R', 'J', 'P', 'B', 'I', 'N', '1' };
+
+struct ProgramCacheHeader {
+	char magic[8];
+	uint64_t key;
+	uint32_t format;        // binaryFormat from glGetProgramBinary
+	uint32_t length;
+};
+
+static ShaderLoadStats loadStats;
+
+const ShaderLoadStats& shaderLoadStats(){
+	return loadStats;
+}
+
+// 64 bit FNV-1a, continued from hash
+static uint64_t hashText(uint64_t hash, const char * text, size_t length){
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)text[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static bool programBinariesSupported(){
+	if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+static uint64_t programCacheKey(const std::string& vertexCode, const std::string& fragmentCode){
+	uint64_t hash = 14695981039346656037ull;
+	const GLenum strings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (int i = 0; i < 3; i++) {
+		const char * text = (const char *)glGetString(strings[i]);
+		if (text != NULL)
+			hash = hashText(hash, text, strlen(text) + 1);
+	}
+	hash = hashText(hash, vertexCode.c_str(), vertexCode.size() + 1);
+	return hashText(hash, fragmentCode.c_str(), fragmentCode.size());
+}
+
+static std::string programCachePath(uint64_t key){
+	char name[64];
+	snprintf(name, sizeof(name), "%s/%016llx.bin", programCacheDirectory, (unsigned long long)key);
+	return name;
+}
+
+// The program stored under key, or 0 when there is none or the driver refuses it
+static GLuint loadProgramBinary(uint64_t key){
+	FILE * file = fopen(programCachePath(key).c_str(), "rb");
+	if (file == NULL)
+		return 0;
+	ProgramCacheHeader header;
+	std::vector<char> binary;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, programCacheMagic, 8) == 0 &&
+		header.key == key && header.length > 0;
+	if (ok) {
+		binary.resize(header.length);
+		ok = fread(&binary[0], 1, binary.size(), file) == binary.size();
+	}
+	fclose(file);
+	if (!ok)
+		return 0;
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.format, &binary[0], (GLsizei)binary.size());
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result != GL_TRUE) {
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
+
+static void saveProgramBinary(GLuint ProgramID, uint64_t key){
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(ProgramID, length, NULL, &format, &binary[0]);
+
+#ifdef _WIN32
+	_mkdir(programCacheDirectory);
+#else
+	mkdir(programCacheDirectory, 0755);
+#endif
+	// Written under another name and renamed, so a crash never leaves half a file behind
+	std::string path = programCachePath(key);
+	std::string partial = path + ".tmp";
+	FILE * file = fopen(partial.c_str(), "wb");
+	if (file == NULL)
+		return;
+	ProgramCacheHeader header;
+	memcpy(header.magic, programCacheMagic, 8);
+	header.key = key;
+	header.format = (uint32_t)format;
+	header.length = (uint32_t)length;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&binary[0], 1, binary.size(), file) == binary.size();
+	ok = fclose(file) == 0 && ok;
+	remove(path.c_str());
+	if (!ok || rename(partial.c_str(), path.c_str()) != 0)
+		remove(partial.c_str());
+}
+
+// The #define lines go right after #version, which has to stay first; #line
+// keeps the line numbers of compile errors those of the file
+static std::string withDefines(const std::string& code, const char * defines){
+	if (defines == NULL || defines[0] == 0)
+		return code;
+	std::string lines;
+	std::istringstream words(defines);
+	std::string word;
+	while (words >> word)
+		lines += "#define " + word + "\n";
+	size_t at = 0;
+	if (code.compare(0, 8, "#version") == 0) {
+		at = code.find('\n');
+		if (at == std::string::npos)
+			return code + "\n" + lines;
+		at++;
+		lines += "#line 2\n";
+	}
+	return code.substr(0, at) + lines + code.substr(at);
+}
+
+const char * shaderVariantDefines(ShaderVariant variant){
+	static const char * const defines[variantCount] = { "LIT", "EMISSIVE" };
+	return variant < variantCount ? defines[variant] : "";
+}
+
+ShaderPermutations::ShaderPermutations(const char * vertex_file_path, const char * fragment_file_path)
+	: vertexPath(vertex_file_path), fragmentPath(fragment_file_path){
+	for (int i = 0; i < variantCount; i++)
+		programs[i] = 0;
+}
+
+ShaderPermutations::~ShaderPermutations(){
+	for (int i = 0; i < variantCount; i++)
+		if (programs[i] != 0) {
+			uniformTables.erase(programs[i]);
+			glDeleteProgram(programs[i]);
+		}
+}
+
+GLuint ShaderPermutations::program(ShaderVariant variant){
+	if (programs[variant] == 0)
+		programs[variant] = LoadShaders(vertexPath.c_str(), fragmentPath.c_str(), shaderVariantDefines(variant));
+	return programs[variant];
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines){
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
 	// Read the Vertex Shader code from the file
 	std::string VertexShaderCode;
@@ -44,12 +273,28 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 		FragmentShaderStream.close();
 	}
 
+	VertexShaderCode = withDefines(VertexShaderCode, defines);
+	FragmentShaderCode = withDefines(FragmentShaderCode, defines);
+
+	bool useCache = programBinariesSupported();
+	uint64_t key = useCache ? programCacheKey(VertexShaderCode, FragmentShaderCode) : 0;
+	GLuint CachedProgramID = useCache ? loadProgramBinary(key) : 0;
+	if (CachedProgramID != 0) {
+		reflectProgram(CachedProgramID);
+		loadStats.cached++;
+		loadStats.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return CachedProgramID;
+	}
+
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
 
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
+	// Compile Vertex Shader; only problems are printed
 	char const * VertexSourcePointer = VertexShaderCode.c_str();
 	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
 	glCompileShader(VertexShaderID);
@@ -60,13 +305,12 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	if ( InfoLogLength > 0 ){
 		std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
 		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
+		printf("%s:\n%s\n", vertex_file_path, &VertexShaderErrorMessage[0]);
 	}
 
 
 
 	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
 	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
 	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
 	glCompileShader(FragmentShaderID);
@@ -77,16 +321,17 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	if ( InfoLogLength > 0 ){
 		std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
 		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
+		printf("%s:\n%s\n", fragment_file_path, &FragmentShaderErrorMessage[0]);
 	}
 
 
 
 	// Link the program
-	printf("Linking program\n");
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if (useCache)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -95,8 +340,10 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	if ( InfoLogLength > 0 ){
 		std::vector<char> ProgramErrorMessage(InfoLogLength+1);
 		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-		printf("%s\n", &ProgramErrorMessage[0]);
+		printf("%s + %s:\n%s\n", vertex_file_path, fragment_file_path, &ProgramErrorMessage[0]);
 	}
+	if (useCache && Result == GL_TRUE)
+		saveProgramBinary(ProgramID, key);
 
 	
 	glDetachShader(ProgramID, VertexShaderID);
@@ -105,6 +352,10 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
+	reflectProgram(ProgramID);
+	loadStats.compiled++;
+	loadStats.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
 	return ProgramID;
 }
 
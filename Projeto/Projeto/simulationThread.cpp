@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "simulationThread.hpp"
+#include "simulationClock.hpp"
+
+double SimulationThread::now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SimulationThread::SimulationThread(BodyTable& bodies, JobSystem* jobs, double stepsPerSecond, double daysPerStep, double spinPerDay, double startTime)
+	: bodies(bodies), jobs(jobs), stepsPerSecond(stepsPerSecond), daysPerStep(daysPerStep), spinPerDay(spinPerDay),
+	startTime(startTime), running(true), stopRequested(false), warp(1.0),
+	seekRequested(false), seekTarget(startTime)
+{
+	SimulationFrame first;
+	if (!bodies.ephemerisPath.empty() && ephemeris.open(bodies.ephemerisPath.c_str()))
+		printf("Ephemeris %s: %zu bodies, days %.0f to %.0f\n", bodies.ephemerisPath.c_str(),
+			bindEphemeris(bodies, ephemeris), ephemeris.startDay(), ephemeris.endDay());
+	if (bodies.nbody) {
+		initBodyDynamics(bodies, startTime, dynamics);
+		if (bodies.snapshotInterval > 0.0 && snapshots.open(bodies.snapshotPath.c_str(), bodies.snapshotMegabytes << 20))
+			saveSnapshotIfDue(startTime);
+	}
+	const NBodySystem* state = bodies.nbody ? &dynamics : NULL;
+	updateBodyTable(bodies, startTime, spinPerDay, jobs, state, fitted());
+	captureBodyState(bodies, startTime, first.current, state);
+	first.previous = first.current;
+	first.stepTime = now();
+	frames.fill(first);
+}
+
+SimulationThread::~SimulationThread()
+{
+	stop();
+}
+
+void SimulationThread::start()
+{
+	if (!worker.joinable())
+		worker = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop()
+{
+	stopRequested.store(true);
+	if (worker.joinable())
+		worker.join();
+}
+
+void SimulationThread::setWarp(double value)
+{
+	if (value < SimulationClock::minWarp)
+		value = SimulationClock::minWarp;
+	if (value > SimulationClock::maxWarp)
+		value = SimulationClock::maxWarp;
+	warp.store(value);
+}
+
+void SimulationThread::seek(double t)
+{
+	seekTarget.store(t);
+	seekRequested.store(true);
+}
+
+// One snapshot per interval, once past the newest one: after seeking back the
+// snapshots ahead are kept, so scrubbing forward again is just as quick
+void SimulationThread::saveSnapshotIfDue(double time)
+{
+	if (snapshots.isOpen() && (snapshots.count() == 0 || time - snapshots.latest() >= bodies.snapshotInterval))
+		snapshots.write(dynamics, time, jobs);
+}
+
+// Shows the state at time straight away, with no interpolation across the jump
+void SimulationThread::publishJump(double time, BodyState& previous, BodyState& current)
+{
+	updateBodyTable(bodies, time, spinPerDay, jobs, bodies.nbody ? &dynamics : NULL, fitted());
+	captureBodyState(bodies, time, current, bodies.nbody ? &dynamics : NULL);
+	previous = current;
+
+	SimulationFrame& frame = frames.writeSlot();
+	frame.previous = previous;
+	frame.current = current;
+	frame.stepTime = now();
+	frames.publish();
+}
+
+// Brings the dynamics from time to target and returns the new time. The
+// restored snapshot is shown before the rest is integrated, so scrubbing
+// answers within a restore (milliseconds) at the snapshot interval; a newer
+// seek request stops the integration early and the time reached is returned.
+double SimulationThread::seekTo(double target, double time, BodyState& previous, BodyState& current)
+{
+	if (target < startTime)
+		target = startTime;
+	if (!bodies.nbody)
+		return target;
+
+	// Start from the last snapshot before target when it is ahead of where we
+	// are or we are going back; going back with none left means starting over
+	double from = time, snapshotTime;
+	if (snapshots.latestAtOrBefore(target, snapshotTime) && (target < time || snapshotTime > time) &&
+		snapshots.restore(target, dynamics, snapshotTime, jobs)) {
+		from = snapshotTime;
+		publishJump(from, previous, current);
+	}
+	else if (target < time) {
+		initBodyDynamics(bodies, startTime, dynamics);
+		from = startTime;
+		publishJump(from, previous, current);
+	}
+
+	// Long steps: block time steps still give the inner orbits their substeps
+	const double seekStep = 16.0;
+	while (from < target)
+	{
+		if (seekRequested.load())
+			return from;
+		double dt = std::min(seekStep, target - from);
+		blockLeapfrogStep(dynamics, dt, jobs);
+		from += dt;
+		saveSnapshotIfDue(from);
+	}
+	return target;
+}
+
+const SimulationFrame& SimulationThread::latest()
+{
+	frames.acquire();
+	return frames.readSlot();
+}
+
+void SimulationThread::run()
+{
+	SimulationClock clock(stepsPerSecond);
+	BodyState previous, current = frames.readSlot().current;
+	double simulationTime = current.time;
+	const NBodySystem* state = bodies.nbody ? &dynamics : NULL;
+	double lastTime = now();
+
+	while (!stopRequested.load())
+	{
+		if (seekRequested.exchange(false)) {
+			simulationTime = seekTo(seekTarget.load(), simulationTime, previous, current);
+			publishJump(simulationTime, previous, current);
+
+			// The time spent seeking is not simulation time to catch up on
+			lastTime = now();
+		}
+
+		double time = now();
+		double frameSeconds = time - lastTime;
+		lastTime = time;
+
+		if (running.load()) {
+			clock.setWarp(warp.load());
+			int steps = clock.advance(frameSeconds);
+			for (int step = 0; step < steps; step++) {
+				// A seek replaces the state anyway, so the remaining steps are dropped
+				if (seekRequested.load()) {
+					steps = step;
+					break;
+				}
+				double dt = daysPerStep * clock.getWarp();
+				simulationTime += dt;
+				// Block steps: a large warp only adds substeps to the fast inner orbits
+				if (bodies.nbody) {
+					blockLeapfrogStep(dynamics, dt, jobs);
+					saveSnapshotIfDue(simulationTime);
+				}
+				updateBodyTable(bodies, simulationTime, spinPerDay, jobs, state, fitted());
+				std::swap(previous, current);
+				captureBodyState(bodies, simulationTime, current, state);
+			}
+
+			// Only the newest pair is handed over, a slow renderer just skips steps
+			if (steps > 0) {
+				SimulationFrame& frame = frames.writeSlot();
+				frame.previous = previous;
+				frame.current = current;
+				frame.stepTime = now();
+				frames.publish();
+			}
+		}
+
+		// Sleep until the next step is due; a step that ran long makes this zero
+		double wait = (1.0 - clock.alpha()) / stepsPerSecond;
+		std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+	}
+}
@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+#include "snapshotRing.hpp"
+#include "nbody.hpp"
+#include "jobSystem.hpp"
+
+static const uint32_t snapshotMagic = 0x50414E53;     // "SNAP"
+static const double positionQuantum = 4294967296.0;   // steps per AU
+static const double velocityQuantum = 17592186044416.0;   // steps per AU/day
+
+struct SnapshotHeader
+{
+	uint32_t magic;
+	uint32_t count;                 // particles
+	uint64_t sequence, keyframe;
+	double time;
+	uint64_t payloadBytes;
+};
+
+SnapshotRing::SnapshotRing()
+	: file(NULL), capacity(0), head(0), keyframeInterval(16), nextSequence(0), lastRecordBytes(0), keyframeTime(0.0) {}
+
+SnapshotRing::~SnapshotRing()
+{
+	close();
+}
+
+bool SnapshotRing::open(const char* path, size_t capacityBytes, int keyframes)
+{
+	close();
+	file = fopen(path, "w+b");
+	if (file == NULL) {
+		printf("Impossible to create %s, timeline seeking will re-simulate from the start\n", path);
+		return false;
+	}
+	// fseek takes a long, 32 bits on Windows
+	capacity = std::min<uint64_t>(capacityBytes, 0x7FFFFFFF);
+	keyframeInterval = std::max(keyframes, 1);
+	return true;
+}
+
+void SnapshotRing::close()
+{
+	if (file != NULL)
+		fclose(file);
+	file = NULL;
+	head = 0;
+	nextSequence = 0;
+	index.clear();
+	keyframeValues.clear();
+}
+
+const SnapshotRing::Entry* SnapshotRing::find(uint64_t sequence) const
+{
+	// Sequences in the index are consecutive
+	if (index.empty() || sequence < index.front().sequence || sequence > index.back().sequence)
+		return NULL;
+	return &index[(size_t)(sequence - index.front().sequence)];
+}
+
+static void quantise(const NBodySystem& system, std::vector<int64_t>& values)
+{
+	const size_t n = system.size();
+	values.resize(6 * n);
+	// Stored by particle number, not by where the last re-sort put them
+	for (size_t k = 0; k < n; k++)
+	{
+		size_t i = system.slot[k];
+		values[k] = (int64_t)std::llround(system.x[i] * positionQuantum);
+		values[n + k] = (int64_t)std::llround(system.y[i] * positionQuantum);
+		values[2 * n + k] = (int64_t)std::llround(system.z[i] * positionQuantum);
+		values[3 * n + k] = (int64_t)std::llround(system.vx[i] * velocityQuantum);
+		values[4 * n + k] = (int64_t)std::llround(system.vy[i] * velocityQuantum);
+		values[5 * n + k] = (int64_t)std::llround(system.vz[i] * velocityQuantum);
+	}
+}
+
+// Two-body motion of the relative state r, v over dt days under mu, with the
+// f and g functions of the eccentric anomaly. False (r, v untouched) when
+// the orbit is not an ellipse or the solution does not settle.
+static bool twoBody(double mu, double dt, double r[3], double v[3])
+{
+	double radius = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+	double speed2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+	double rv = r[0] * v[0] + r[1] * v[1] + r[2] * v[2];
+	double inverseA = 2.0 / radius - speed2 / mu;
+	if (!(radius > 0.0) || !(inverseA > 0.0))
+		return false;
+	double a = 1.0 / inverseA;
+	double n = std::sqrt(mu * inverseA * inverseA * inverseA);
+	double eCosE = 1.0 - radius * inverseA, eSinE = rv / std::sqrt(mu * a);
+
+	// Kepler's equation for the change x of eccentric anomaly
+	double M = n * dt, x = M;
+	for (int iteration = 0; ; iteration++)
+	{
+		double s = std::sin(x), c = std::cos(x);
+		double step = (x - eCosE * s + eSinE * (1.0 - c) - M) / (1.0 - eCosE * c + eSinE * s);
+		x -= step;
+		if (std::fabs(step) < 1e-13)
+			break;
+		if (iteration == 30 || !(std::fabs(x) < 1e12))
+			return false;
+	}
+
+	double s = std::sin(x), c = std::cos(x);
+	double f = 1.0 - a / radius * (1.0 - c), g = dt + (s - x) / n;
+	double p[3] = { f * r[0] + g * v[0], f * r[1] + g * v[1], f * r[2] + g * v[2] };
+	double newRadius = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+	double fDot = -std::sqrt(mu * a) / (radius * newRadius) * s, gDot = 1.0 - a / newRadius * (1.0 - c);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		v[axis] = fDot * r[axis] + gDot * v[axis];
+		r[axis] = p[axis];
+	}
+	return true;
+}
+
+// The quantised state keyframe carried dt days forward: the heaviest particle
+// in a straight line, the others on two-body orbits around it (a straight line
+// when that fails). Writer and reader run it on the same values, so it gives
+// the same prediction at both ends.
+static void predict(const NBodySystem& system, const std::vector<int64_t>& keyframe, double dt,
+	std::vector<int64_t>& out, JobSystem* jobs)
+{
+	const size_t n = system.size();
+	out.resize(keyframe.size());
+	size_t central = 0;
+	for (size_t k = 1; k < n; k++)
+		if (system.mass[system.slot[k]] > system.mass[system.slot[central]])
+			central = k;
+	const double mu = system.G * system.mass[system.slot[central]];
+	double centre[6];
+	for (int c = 0; c < 3; c++)
+	{
+		centre[c] = keyframe[c * n + central] / positionQuantum;
+		centre[3 + c] = keyframe[(3 + c) * n + central] / velocityQuantum;
+	}
+
+	auto particles = [&](size_t first, size_t last) {
+		for (size_t k = first; k < last; k++)
+		{
+			double r[3], v[3];
+			for (int c = 0; c < 3; c++)
+			{
+				r[c] = keyframe[c * n + k] / positionQuantum - centre[c];
+				v[c] = keyframe[(3 + c) * n + k] / velocityQuantum - centre[3 + c];
+			}
+			if (k == central || !twoBody(mu, dt, r, v))
+				for (int c = 0; c < 3; c++)
+					r[c] += v[c] * dt;
+			for (int c = 0; c < 3; c++)
+			{
+				double position = (r[c] + centre[c] + centre[3 + c] * dt) * positionQuantum;
+				double velocity = (v[c] + centre[3 + c]) * velocityQuantum;
+				// A prediction off the fixed point range is no prediction
+				out[c * n + k] = std::fabs(position) < 4e18 ? (int64_t)std::llround(position) : keyframe[c * n + k];
+				out[(3 + c) * n + k] = std::fabs(velocity) < 4e18 ? (int64_t)std::llround(velocity) : keyframe[(3 + c) * n + k];
+			}
+		}
+	};
+	if (jobs != NULL)
+		jobs->parallelFor(0, n, 1024, particles);
+	else
+		particles(0, n);
+}
+
+// Zigzag maps small negative and positive differences to small unsigned
+// numbers, then 7 bits per byte with the high bit marking a continuation
+void SnapshotRing::encode(bool keyframe)
+{
+	buffer.clear();
+	for (size_t k = 0; k < values.size(); k++)
+	{
+		int64_t value = keyframe ? values[k] : values[k] - predicted[k];
+		uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+		while (zigzag >= 0x80)
+		{
+			buffer.push_back((unsigned char)(zigzag | 0x80));
+			zigzag >>= 7;
+		}
+		buffer.push_back((unsigned char)zigzag);
+	}
+}
+
+bool SnapshotRing::write(const NBodySystem& system, double t, JobSystem* jobs)
+{
+	if (file == NULL)
+		return false;
+	const size_t n = system.size();
+	quantise(system, values);
+
+	uint64_t currentKeyframe = index.empty() ? 0 : index.back().keyframe;
+	bool keyframe = index.empty() || find(currentKeyframe) == NULL || keyframeValues.size() != values.size() ||
+		nextSequence - currentKeyframe >= (uint64_t)keyframeInterval;
+	if (!keyframe)
+		predict(system, keyframeValues, t - keyframeTime, predicted, jobs);
+
+	uint64_t bytes;
+	for (;;)
+	{
+		encode(keyframe);
+		bytes = sizeof(SnapshotHeader) + buffer.size();
+		if (bytes > capacity) {
+			printf("Snapshot of %zu particles does not fit in the %llu byte ring, timeline seeking disabled\n",
+				n, (unsigned long long)capacity);
+			close();
+			return false;
+		}
+
+		// Out of room at the end: the records left there are older than the ones
+		// at the start, drop them and wrap. Then drop whatever the new record covers.
+		if (head + bytes > capacity) {
+			while (!index.empty() && index.front().offset >= head)
+				index.pop_front();
+			head = 0;
+		}
+		while (!index.empty() && index.front().offset < head + bytes && index.front().offset + index.front().bytes > head)
+			index.pop_front();
+		// Deltas whose keyframe just went are of no use any more
+		while (!index.empty() && find(index.front().keyframe) == NULL)
+			index.pop_front();
+
+		// The space for a delta may have taken its own keyframe: store a keyframe instead
+		if (keyframe || find(currentKeyframe) != NULL)
+			break;
+		keyframe = true;
+	}
+	if (keyframe)
+		currentKeyframe = nextSequence;
+
+	SnapshotHeader header;
+	header.magic = snapshotMagic;
+	header.count = (uint32_t)n;
+	header.sequence = nextSequence;
+	header.keyframe = currentKeyframe;
+	header.time = t;
+	header.payloadBytes = buffer.size();
+
+	bool ok = fseek(file, (long)head, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	if (!ok) {
+		printf("Snapshot write failed, timeline seeking disabled\n");
+		close();
+		return false;
+	}
+
+	Entry entry;
+	entry.time = t;
+	entry.sequence = nextSequence++;
+	entry.keyframe = currentKeyframe;
+	entry.offset = head;
+	entry.bytes = bytes;
+	index.push_back(entry);
+	head += bytes;
+	lastRecordBytes = (size_t)bytes;
+	if (keyframe) {
+		keyframeValues = values;
+		keyframeTime = t;
+	}
+	return true;
+}
+
+// Decodes a record into values: as they are for a keyframe (base NULL), added
+// to base for a delta
+bool SnapshotRing::readValues(const Entry& entry, size_t count, const int64_t* base)
+{
+	SnapshotHeader header;
+	if (fseek(file, (long)entry.offset, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, file) != 1 ||
+		header.magic != snapshotMagic || header.sequence != entry.sequence || header.count != count ||
+		header.payloadBytes != entry.bytes - sizeof(header))
+		return false;
+	buffer.resize((size_t)header.payloadBytes);
+	if (fread(buffer.data(), 1, buffer.size(), file) != buffer.size())
+		return false;
+
+	size_t position = 0;
+	for (size_t k = 0; k < values.size(); k++)
+	{
+		uint64_t zigzag = 0;
+		for (int shift = 0; ; shift += 7)
+		{
+			if (position >= buffer.size() || shift > 63)
+				return false;
+			unsigned char byte = buffer[position++];
+			zigzag |= (uint64_t)(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				break;
+		}
+		int64_t value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+		values[k] = base != NULL ? base[k] + value : value;
+	}
+	return true;
+}
+
+bool SnapshotRing::latestAtOrBefore(double t, double& snapshotTime) const
+{
+	for (size_t i = index.size(); i-- > 0;)
+	{
+		if (index[i].time <= t) {
+			snapshotTime = index[i].time;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SnapshotRing::restore(double t, NBodySystem& system, double& snapshotTime, JobSystem* jobs)
+{
+	if (file == NULL)
+		return false;
+	const size_t n = system.size();
+	values.resize(6 * n);
+
+	// Latest snapshot at or before t whose keyframe is still in the ring
+	for (size_t i = index.size(); i-- > 0;)
+	{
+		const Entry& entry = index[i];
+		if (entry.time > t)
+			continue;
+		const Entry* keyframe = find(entry.keyframe);
+		if (keyframe == NULL)
+			continue;
+		bool ok = readValues(*keyframe, n, NULL);
+		if (ok && keyframe != &entry) {
+			predict(system, values, entry.time - keyframe->time, predicted, jobs);
+			ok = readValues(entry, n, predicted.data());
+		}
+		if (!ok) {
+			printf("Snapshot %llu could not be read back\n", (unsigned long long)entry.sequence);
+			return false;
+		}
+
+		for (size_t k = 0; k < n; k++)
+		{
+			size_t i = system.slot[k];
+			system.x[i] = values[k] / positionQuantum;
+			system.y[i] = values[n + k] / positionQuantum;
+			system.z[i] = values[2 * n + k] / positionQuantum;
+			system.vx[i] = values[3 * n + k] / velocityQuantum;
+			system.vy[i] = values[4 * n + k] / velocityQuantum;
+			system.vz[i] = values[5 * n + k] / velocityQuantum;
+		}
+		system.accelerationsValid = false;
+		snapshotTime = entry.time;
+		return true;
+	}
+	return false;
+}
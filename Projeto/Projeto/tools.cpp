@@ -0,0 +1,858 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "tools.hpp"
+#include "kepler.hpp"
+#include "jobSystem.hpp"
+#include "nbody.hpp"
+#include "BodyTable.h"
+#include "ephemeris.hpp"
+#include "planetTheory.hpp"
+#include "orbits.hpp"
+#include "closeApproach.hpp"
+#include "events.hpp"
+#include "porkchop.hpp"
+#include "frustum.hpp"
+#include "queryServer.hpp"
+#include "simdMath.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Propagates a synthetic asteroid catalog at a series of unrelated dates
+static int benchKepler(size_t count)
+{
+	std::vector<double> a(count), e(count), n(count), m0(count), x(count), z(count);
+	std::mt19937 random(12345);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	for (size_t i = 0; i < count; i++)
+	{
+		a[i] = 2.1 + 1.2 * uniform(random);
+		e[i] = 0.3 * uniform(random);
+		n[i] = 0.01720209895 / (a[i] * sqrt(a[i]));
+		m0[i] = 6.283185307179586 * uniform(random);
+	}
+
+	// Warm up: first touch of the output pages is not propagator time
+	propagateKepler(count, a.data(), e.data(), n.data(), m0.data(), 0.0, x.data(), z.data());
+
+	const int runs = 10;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int run = 0; run < runs; run++)
+	{
+		double t = 36525.0 * run;   // one century apart, cost must not depend on the date
+		propagateKepler(count, a.data(), e.data(), n.data(), m0.data(), t, x.data(), z.data());
+	}
+	double ms = millisecondsSince(start) / runs;
+
+	printf("Kepler propagator (%s): %zu bodies in %.2f ms, %.1f M bodies/s\n",
+		keplerInstructionSet(), count, ms, count / ms / 1000.0);
+
+	// Same catalog split over the job system, as the simulation thread runs it
+	JobSystem jobs(JobSystem::defaultWorkerCount());
+	start = std::chrono::steady_clock::now();
+	for (int run = 0; run < runs; run++)
+	{
+		double t = 36525.0 * run;
+		jobs.parallelFor(0, count, 16384, [&](size_t first, size_t last) {
+			propagateKepler(last - first, a.data() + first, e.data() + first, n.data() + first, m0.data() + first, t,
+				x.data() + first, z.data() + first);
+		});
+	}
+	double parallelMs = millisecondsSince(start) / runs;
+
+	printf("Kepler propagator, %u workers + caller: %.2f ms, %.1f M bodies/s, %.2fx\n",
+		jobs.workerCount(), parallelMs, count / parallelMs / 1000.0, ms / parallelMs);
+	return 0;
+}
+
+// Mean distance in memory, in particles, between neighbours along the Morton
+// curve of the last tree build: what the build gathers and the walk scatters
+static double mortonStride(const NBodySystem& system)
+{
+	const std::vector<int>& order = system.tree.mortonOrder();
+	double total = 0.0;
+	for (size_t k = 1; k < order.size(); k++)
+		total += std::abs(order[k] - order[k - 1]);
+	return order.size() > 1 ? total / (order.size() - 1) : 0.0;
+}
+
+// Barnes-Hut steps on a thin disk of equal particles around a central mass,
+// the shape of the belt scenes. The particles are added in random order, then
+// the same steps run with the arrays left that way and kept in Morton order.
+static int benchNBody(size_t count, double theta)
+{
+	NBodySystem system;
+	system.theta = theta;
+	system.add(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
+	std::mt19937 random(12345);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::normal_distribution<double> normal(0.0, 1.0);
+	for (size_t i = 0; i < count; i++)
+	{
+		double r = 2.1 + 1.2 * uniform(random), angle = 6.283185307179586 * uniform(random);
+		double speed = sqrt(system.G / r);
+		system.add(r * sin(angle), 0.03 * r * normal(random), r * cos(angle),
+			speed * cos(angle), 0.0, -speed * sin(angle), 4e-10 / count);
+	}
+
+	JobSystem jobs(JobSystem::defaultWorkerCount());
+	const int steps = 8;
+	for (int sorted = 0; sorted < 2; sorted++)
+	{
+		NBodySystem run = system;
+		run.sortInterval = sorted ? 4 : 0;
+		computeAccelerations(run, &jobs);
+		if (sorted)
+			sortParticles(run, &jobs);
+		leapfrogStep(run, 1.0, &jobs);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int step = 0; step < steps; step++)
+			leapfrogStep(run, 1.0, &jobs);
+		double ms = millisecondsSince(start) / steps;
+
+		printf("Barnes-Hut (theta %.2f, %u workers + caller, %s): %zu particles, %zu nodes, %.1f ms per step, %.1f steps/s, "
+			"Morton neighbours %.0f particles apart\n", theta, jobs.workerCount(), sorted ? "Morton order" : "insertion order",
+			run.size(), run.tree.nodeCount(), ms, 1000.0 / ms, mortonStride(run));
+	}
+	return 0;
+}
+
+// Positions of every body of a scene at many dates with the batch API,
+// checked against updateBodyTable at a few of them
+static int benchPositions(size_t dates, const char* scenePath)
+{
+	BodyTable bodies;
+	if (!loadBodyTable(scenePath, bodies))
+		return 1;
+
+	// One date every 0.37 days from J2000
+	std::vector<double> times(dates);
+	for (size_t k = 0; k < dates; k++)
+		times[k] = 0.37 * k;
+
+	PositionGrid grid;
+	positions(bodies, times.data(), dates, grid);     // first touch of the pages
+	JobSystem jobs(JobSystem::defaultWorkerCount());
+	const int runs = 5;
+	double ms[2];
+	for (int parallel = 0; parallel < 2; parallel++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int run = 0; run < runs; run++)
+			positions(bodies, times.data(), dates, grid, parallel ? &jobs : NULL);
+		ms[parallel] = millisecondsSince(start) / runs;
+	}
+
+	// Same dates through the viewer's path; it composes in float scene units
+	double worst = 0.0;
+	for (size_t k = 0; k < dates; k += std::max<size_t>(dates / 16, 1))
+	{
+		updateBodyTable(bodies, times[k], 0.0);
+		for (size_t i = 0; i < bodies.size(); i++)
+		{
+			size_t g = grid.index(i, k);
+			worst = std::max(worst, std::fabs(bodies.x[i] / bodies.sceneScale - grid.x[g]));
+			worst = std::max(worst, std::fabs(bodies.y[i] / bodies.sceneScale - grid.y[g]));
+			worst = std::max(worst, std::fabs(bodies.z[i] / bodies.sceneScale - grid.z[g]));
+		}
+	}
+
+	double count = (double)bodies.size() * dates;
+	printf("Batch positions (%s): %zu bodies x %zu dates in %.2f ms, %.1f M positions/s; "
+		"%u workers + caller: %.2f ms, %.1f M positions/s\n", keplerInstructionSet(), bodies.size(), dates,
+		ms[0], count / ms[0] / 1000.0, jobs.workerCount(), ms[1], count / ms[1] / 1000.0);
+	printf("Largest difference from updateBodyTable: %.2e AU\n", worst);
+	return 0;
+}
+
+// Culls a synthetic belt of spheres against the viewer's starting camera,
+// in one block at a time and over the job system, checked against a plain
+// per-sphere test
+static int benchCulling(size_t count)
+{
+	// Belt of asteroidBelt.scene in scene units: 2.1 to 3.3 AU at 50 units per AU
+	std::vector<float> x(count), y(count), z(count);
+	std::mt19937 random(12345);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	for (size_t i = 0; i < count; i++)
+	{
+		float r = 50.0f * (2.1f + 1.2f * uniform(random)), angle = 6.2831853f * uniform(random);
+		x[i] = r * std::cos(angle);
+		y[i] = 4.0f * (uniform(random) - 0.5f);
+		z[i] = r * std::sin(angle);
+	}
+	const float radius = 0.08f;
+
+	// Projection and camera of the viewer at startup (controlsProjeto.cpp), facing the Sun
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 3200.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(-5.5f, 35.5f, 85.5f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projectionView = projection * view;
+	Frustum frustum = frustumFromMatrix(glm::value_ptr(projectionView));
+
+	VisibleSet visible;
+	cullSpheres(frustum, x.data(), y.data(), z.data(), NULL, radius, count, visible);   // first touch of the pages
+	JobSystem jobs(JobSystem::defaultWorkerCount());
+	const int runs = 20;
+	double ms[2];
+	for (int parallel = 0; parallel < 2; parallel++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int run = 0; run < runs; run++)
+			cullSpheres(frustum, x.data(), y.data(), z.data(), NULL, radius, count, visible, parallel ? &jobs : NULL);
+		ms[parallel] = millisecondsSince(start) / runs;
+	}
+
+	size_t expected = 0, mismatches = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6; p++)
+		{
+			const float* plane = frustum.planes[p];
+			inside = inside && plane[0] * x[i] + plane[1] * y[i] + plane[2] * z[i] + plane[3] >= -radius;
+		}
+		if (inside)
+		{
+			if (expected >= visible.count || visible.index[expected] != i)
+				mismatches++;
+			expected++;
+		}
+	}
+	if (expected != visible.count)
+		mismatches++;
+
+	printf("Frustum culling (%s): %zu spheres, %zu visible (%.1f%%), %.2f ms, %.1f M spheres/s; "
+		"%u workers + caller: %.2f ms, %.1f M spheres/s\n", simd::name(), count, visible.count,
+		100.0 * visible.count / count, ms[0], count / ms[0] / 1000.0, jobs.workerCount(), ms[1], count / ms[1] / 1000.0);
+	printf("%zu differences from the per-sphere test\n", mismatches);
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Integrates the planets of the belt scene (without the belt) for a few
+// centuries at increasing time warps, with and without block time steps
+static int benchWarp(double years)
+{
+	BodyTable bodies;
+	if (!loadBodyTable("scenes/asteroidBelt.scene", bodies))
+		return 1;
+	bodies.beltCount = 0;
+
+	const double warps[] = { 1.0, 64.0, 1024.0 };
+	for (int w = 0; w < 3; w++)
+	{
+		// days_per_step of the viewer at warp 1
+		double dt = 2 * 3.14159 * 10 / 360 * warps[w];
+		int steps = (int)(365.25 * years / dt);
+		NBodySystem block, single;
+		initBodyDynamics(bodies, 0.0, block);
+		single = block;
+		double initial = totalEnergy(block);
+
+		size_t evaluations = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int step = 0; step < steps; step++)
+		{
+			blockLeapfrogStep(block, dt, NULL);
+			evaluations += block.lastForceEvaluations;
+		}
+		double ms = millisecondsSince(start);
+		for (int step = 0; step < steps; step++)
+			leapfrogStep(single, dt, NULL);
+
+		printf("warp %5.0f (%.1f days/step): block steps dE/E %.2e, %d substeps, %.1f forces per body and step, %.1f ms; single step dE/E %.2e\n",
+			warps[w], dt, (totalEnergy(block) - initial) / initial, block.lastSubsteps,
+			(double)evaluations / steps / block.size(), ms, (totalEnergy(single) - initial) / initial);
+	}
+	return 0;
+}
+
+// FNV-1a over the positions and velocities, by particle number
+static uint64_t stateHash(const NBodySystem& system)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t k = 0; k < system.size(); k++)
+	{
+		size_t i = system.slot[k];
+		double values[6] = { system.x[i], system.y[i], system.z[i], system.vx[i], system.vy[i], system.vz[i] };
+		const unsigned char* bytes = (const unsigned char*)values;
+		for (size_t b = 0; b < sizeof(values); b++)
+			hash = (hash ^ bytes[b]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// Runs the belt scene with 0, 7 and 63 workers and compares the final
+// states bit for bit. The hashes printed can be compared with a run of the
+// same build on another machine.
+static int checkDeterminism(int steps, size_t particles)
+{
+	BodyTable bodies;
+	if (!loadBodyTable("scenes/asteroidBelt.scene", bodies))
+		return 1;
+	bodies.beltCount = particles;
+
+	const unsigned workers[] = { 0, 7, 63 };
+	const double dt = 2 * 3.14159 * 10 / 360 * 64.0;   // days_per_step of the viewer at warp 64
+	bool identical = true;
+	for (int deterministic = 1; deterministic >= 0; deterministic--)
+	{
+		bodies.nbodyDeterministic = deterministic != 0;
+		uint64_t reference = 0;
+		for (int w = 0; w < 3; w++)
+		{
+			JobSystem jobs(workers[w]);
+			NBodySystem system;
+			initBodyDynamics(bodies, 0.0, system);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int step = 0; step < steps; step++)
+				blockLeapfrogStep(system, dt, &jobs);
+			double ms = millisecondsSince(start);
+
+			uint64_t hash = stateHash(system);
+			if (w == 0)
+				reference = hash;
+			bool same = hash == reference;
+			if (deterministic)
+				identical = identical && same;
+			printf("%s, %2u workers + caller: %zu particles, %d steps in %.0f ms, state %016llx%s\n",
+				deterministic ? "deterministic" : "fast         ", workers[w], system.size(), steps, ms,
+				(unsigned long long)hash, same ? "" : " (differs)");
+		}
+	}
+	printf(identical ? "Deterministic states are identical\n" : "Deterministic states differ\n");
+	return identical ? 0 : 1;
+}
+
+// Positions from the orbital elements of the scene
+class KeplerSource : public EphemerisSource
+{
+public:
+	explicit KeplerSource(BodyTable& bodies) : bodies(bodies) {}
+
+	void sample(double t, double* x, double* y, double* z)
+	{
+		updateBodyTable(bodies, t, 0.0);
+		for (size_t i = 0; i < bodies.size(); i++)
+		{
+			x[i] = bodies.localX[i];
+			y[i] = bodies.localY[i];
+			z[i] = bodies.localZ[i];
+		}
+	}
+
+private:
+	BodyTable& bodies;
+};
+
+// Positions from an N-body run started at startDay, as the belt scenes
+// integrate them; moons keep their analytic orbits around the moving planets.
+// The run takes fixed steps and dates between two steps are filled in with
+// cubic Hermite curves, so the trajectory does not depend on which dates are
+// asked for.
+class NBodySource : public EphemerisSource
+{
+public:
+	NBodySource(BodyTable& bodies, double startDay) : bodies(bodies), time(startDay)
+	{
+		initBodyDynamics(bodies, startDay, system);
+		before = system;
+		between = system;
+	}
+
+	void sample(double t, double* x, double* y, double* z)
+	{
+		while (time < t) {
+			before.x = system.x;
+			before.y = system.y;
+			before.z = system.z;
+			before.vx = system.vx;
+			before.vy = system.vy;
+			before.vz = system.vz;
+			blockLeapfrogStep(system, step, NULL);
+			time += step;
+		}
+
+		double s = 1.0 - (time - t) / step;
+		double h00 = (2 * s - 3) * s * s + 1, h10 = ((s - 2) * s + 1) * s * step;
+		double h01 = (3 - 2 * s) * s * s, h11 = (s - 1) * s * s * step;
+		for (size_t k = 0; k < system.size(); k++)
+		{
+			between.x[k] = h00 * before.x[k] + h10 * before.vx[k] + h01 * system.x[k] + h11 * system.vx[k];
+			between.y[k] = h00 * before.y[k] + h10 * before.vy[k] + h01 * system.y[k] + h11 * system.vy[k];
+			between.z[k] = h00 * before.z[k] + h10 * before.vz[k] + h01 * system.z[k] + h11 * system.vz[k];
+		}
+
+		updateBodyTable(bodies, t, 0.0, NULL, &between);
+		for (size_t i = 0; i < bodies.size(); i++)
+		{
+			x[i] = bodies.localX[i];
+			y[i] = bodies.localY[i];
+			z[i] = bodies.localZ[i];
+		}
+	}
+
+private:
+	BodyTable& bodies;
+	NBodySystem system, before, between;
+	double time;
+	static constexpr double step = 0.125;   // days
+};
+
+// Fits the bodies of a scene over [0, years] into an ephemeris file, then
+// checks it against a second run of the same source and times the lookups
+static int fitEphemeris(const char* outPath, double years, bool integrated, const char* scenePath)
+{
+	BodyTable bodies;
+	if (!loadBodyTable(scenePath, bodies))
+		return 1;
+	bodies.beltCount = 0;
+	bodies.theoryTolerance = 0.0;   // a file made once is worth the full series
+	const double endDay = 365.25 * years;
+	if (integrated) {
+		NBodySystem system;
+		initBodyDynamics(bodies, 0.0, system);
+	}
+
+	// A quarter orbit per interval: 12 coefficients follow a Kepler orbit to
+	// ~1e-13 of its size. Integrated positions are relative to a parent that
+	// wobbles with the inner planets, so they get a month at most.
+	std::vector<EphemerisBody> fitted(bodies.size());
+	for (size_t i = 0; i < bodies.size(); i++)
+	{
+		bool moving = bodies.period[i] > 0.0 || integrated;
+		double interval = bodies.period[i] > 0.0 ? bodies.period[i] / 4.0 : endDay;
+		if (integrated && bodies.nbodyIndex[i] >= 0)
+			interval = std::min(interval, 32.0);
+		fitted[i].name = bodies.name[i];
+		fitted[i].parent = bodies.parent[i];
+		fitted[i].intervalDays = interval;
+		fitted[i].coefficients = moving ? 12 : 1;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool ok;
+	if (integrated) {
+		NBodySource source(bodies, 0.0);
+		ok = writeEphemeris(outPath, fitted, 0.0, endDay, source);
+	}
+	else {
+		KeplerSource source(bodies);
+		ok = writeEphemeris(outPath, fitted, 0.0, endDay, source);
+	}
+	if (!ok)
+		return 1;
+	double fitMs = millisecondsSince(start);
+
+	Ephemeris ephemeris;
+	if (!ephemeris.open(outPath))
+		return 1;
+	FILE* file = fopen(outPath, "rb");
+	long bytes = 0;
+	if (file != NULL) {
+		fseek(file, 0, SEEK_END);
+		bytes = ftell(file);
+		fclose(file);
+	}
+	printf("%s: %zu bodies over %.0f days from %s, %.1f MB, fitted in %.0f ms\n", outPath, ephemeris.bodyCount(),
+		endDay, integrated ? "an N-body run" : "the orbital elements", bytes / 1048576.0, fitMs);
+
+	// Largest distance between the file and the source at random dates
+	std::mt19937 random(12345);
+	std::uniform_real_distribution<double> uniform(0.0, endDay);
+	std::vector<double> dates(2000);
+	for (size_t d = 0; d < dates.size(); d++)
+		dates[d] = uniform(random);
+	std::sort(dates.begin(), dates.end());
+
+	std::vector<double> x(bodies.size()), y(bodies.size()), z(bodies.size()), worst(bodies.size(), 0.0);
+	std::unique_ptr<EphemerisSource> check;
+	if (integrated)
+		check.reset(new NBodySource(bodies, 0.0));
+	else
+		check.reset(new KeplerSource(bodies));
+	for (size_t d = 0; d < dates.size(); d++)
+	{
+		check->sample(dates[d], x.data(), y.data(), z.data());
+		for (size_t i = 0; i < bodies.size(); i++)
+		{
+			double ex, ey, ez;
+			ephemeris.position(i, dates[d], ex, ey, ez);
+			double error = sqrt((ex - x[i]) * (ex - x[i]) + (ey - y[i]) * (ey - y[i]) + (ez - z[i]) * (ez - z[i]));
+			worst[i] = std::max(worst[i], error);
+		}
+	}
+	for (size_t i = 0; i < bodies.size(); i++)
+		printf("  %-12s %7u intervals of %8.3f days, largest error %.2e AU (%.3f km)\n", bodies.name[i].c_str(),
+			ephemeris.record(i).intervalCount, ephemeris.record(i).intervalDays, worst[i], worst[i] * 149597870.7);
+
+	// Lookups at unrelated dates, the cost of seeking anywhere on the timeline
+	const size_t lookups = 1000000;
+	double sum = 0.0;
+	start = std::chrono::steady_clock::now();
+	for (size_t l = 0; l < lookups; l++)
+	{
+		double ex, ey, ez;
+		ephemeris.position(l % ephemeris.bodyCount(), uniform(random), ex, ey, ez);
+		sum += ex;
+	}
+	double ms = millisecondsSince(start);
+	printf("Random lookups: %.1f ns each (checksum %.3f)\n", ms * 1e6 / lookups, sum);
+	return 0;
+}
+
+// Times one theory over dates spread across two millennia, with the full series
+// and truncated at tolerance, and measures what the truncation costs in km
+static void benchTheory(const char* label, const PlanetTheory& theory, double tolerance)
+{
+	const int dates = 2000;
+	std::vector<double> jd(dates), full(3 * dates);
+	std::mt19937 random(12345);
+	std::uniform_real_distribution<double> uniform(2451545.0 - 365250.0, 2451545.0 + 365250.0);
+	for (int d = 0; d < dates; d++)
+		jd[d] = uniform(random);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int d = 0; d < dates; d++)
+		theory.position(jd[d], 0.0, full[3 * d], full[3 * d + 1], full[3 * d + 2]);
+	double fullUs = millisecondsSince(start) * 1000.0 / dates;
+
+	double worst = 0.0;
+	start = std::chrono::steady_clock::now();
+	for (int d = 0; d < dates; d++)
+	{
+		double x, y, z;
+		theory.position(jd[d], tolerance, x, y, z);
+		double dx = x - full[3 * d], dy = y - full[3 * d + 1], dz = z - full[3 * d + 2];
+		worst = std::max(worst, dx * dx + dy * dy + dz * dz);
+	}
+	double coarseUs = millisecondsSince(start) * 1000.0 / dates;
+
+	printf("  %-14s full %6zu terms %8.2f us | tolerance %.0e: %5zu terms %7.2f us, %6.1fx, largest error %9.3f km\n",
+		label, theory.termCount(0.0), fullUs, tolerance, theory.termCount(tolerance), coarseUs, fullUs / coarseUs,
+		sqrt(worst) * 149597870.7);
+}
+
+// Every VSOP87 planet file and the ELP main problem found in directory
+static int benchTheories(const std::string& directory, double tolerance)
+{
+	static const char* planets[] = { "mer", "ven", "ear", "mar", "jup", "sat", "ura", "nep" };
+	static const char* versions[] = { "A", "B", "C", "D", "E" };
+	printf("Series theories from %s (%s):\n", directory.c_str(), simd::name());
+
+	int found = 0;
+	for (int p = 0; p < 8; p++)
+		for (int v = 0; v < 5; v++)
+		{
+			std::string path = directory + "/VSOP87" + versions[v] + "." + planets[p];
+			FILE* file = fopen(path.c_str(), "r");
+			if (file == NULL)
+				continue;
+			fclose(file);
+			Vsop87Theory theory;
+			if (theory.load(path.c_str())) {
+				benchTheory(path.c_str() + directory.size() + 1, theory, tolerance);
+				found++;
+			}
+			break;
+		}
+
+	std::string elpPath = directory + "/ELP1";
+	FILE* file = fopen(elpPath.c_str(), "r");
+	if (file != NULL) {
+		fclose(file);
+		Elp82Theory moon;
+		if (moon.load(directory)) {
+			benchTheory("ELP 2000-82B", moon, tolerance);
+			found++;
+		}
+	}
+
+	if (found == 0)
+		printf("No VSOP87 or ELP files in %s, see planetTheory.hpp for where to get them\n", directory.c_str());
+	return found > 0 ? 0 : 1;
+}
+
+// Client side check of a running --serve: round trip latency of small
+// requests, throughput of large ones through shared memory, and that a subset
+// of bodies comes back as the same numbers as the whole table
+static int benchQuery(const char* socketPath, size_t dates)
+{
+	QueryClient client;
+	std::vector<std::string> names;
+	if (!client.connect(socketPath) || !client.names(names) || names.empty()) {
+		printf("No answer from the query server on %s\n", socketPath);
+		return 1;
+	}
+
+	std::vector<double> times(dates);
+	for (size_t k = 0; k < dates; k++)
+		times[k] = 0.37 * k;
+	size_t count = 0;
+	const double* all = client.positions(std::vector<int>(), times, count);
+	if (all == NULL || count != 3 * names.size() * dates) {
+		printf("Position request refused\n");
+		return 1;
+	}
+	std::vector<double> reference(all, all + count);
+
+	// Last and first body at a few dates, small enough to come inline
+	std::vector<int> subset = { (int)names.size() - 1, 0 };
+	std::vector<double> someTimes(times.begin(), times.begin() + std::min<size_t>(dates, 10));
+	const double* some = client.positions(subset, someTimes, count);
+	bool same = some != NULL && count == 3 * subset.size() * someTimes.size();
+	for (size_t b = 0; same && b < subset.size(); b++)
+		for (size_t t = 0; t < someTimes.size(); t++)
+			for (int c = 0; c < 3; c++)
+				same = same && some[(b * someTimes.size() + t) * 3 + c] == reference[(subset[b] * dates + t) * 3 + c];
+
+	const int smallRuns = 1000, largeRuns = 5;
+	std::vector<int> one = { 0 };
+	std::vector<double> oneTime = { 1.0 };
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int run = 0; run < smallRuns; run++)
+		client.positions(one, oneTime, count);
+	double smallMs = millisecondsSince(start) / smallRuns;
+	start = std::chrono::steady_clock::now();
+	for (int run = 0; run < largeRuns; run++)
+		client.positions(std::vector<int>(), times, count);
+	double largeMs = millisecondsSince(start) / largeRuns;
+
+	QueryStats stats;
+	if (!client.stats(stats))
+		return 1;
+	printf("Query server on %s: %zu bodies\n", socketPath, names.size());
+	printf("Round trip of 1 position: %.1f us; %zu bodies x %zu dates: %.2f ms, %.1f M positions/s\n",
+		smallMs * 1000.0, names.size(), dates, largeMs, names.size() * dates / largeMs / 1000.0);
+	printf("Server side: %llu requests, mean %.3f ms, max %.3f ms\n", (unsigned long long)stats.requests,
+		stats.totalMilliseconds / std::max<uint64_t>(stats.requests, 1), stats.maxMilliseconds);
+	printf("Subset request %s the full table\n", same ? "matches" : "DIFFERS from");
+	return same ? 0 : 1;
+}
+
+// Close approaches among the solar system scene and a synthetic main belt
+// catalog. The search is run again with half the interval, which has to find
+// the same approaches.
+static int benchApproaches(size_t asteroids, double years, double distance)
+{
+	BodyTable bodies;
+	if (!loadBodyTable("scenes/solarSystem.scene", bodies) || bodies.roots.empty())
+		return 1;
+
+	// Only the arrays the search reads are extended
+	std::mt19937 random(12345);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	int sun = bodies.roots[0];
+	for (size_t k = 0; k < asteroids; k++)
+	{
+		double a = 2.1 + 1.2 * uniform(random);
+		bodies.parent.push_back(sun);
+		bodies.subtreeEnd.push_back((int)bodies.size() + 1);
+		bodies.semiMajorAxis.push_back(a);
+		bodies.eccentricity.push_back(0.2 * uniform(random));
+		bodies.period.push_back(365.25 * a * std::sqrt(a));
+		bodies.meanMotion.push_back(2.0 * M_PI / bodies.period.back());
+		bodies.meanAnomaly0.push_back(2.0 * M_PI * uniform(random));
+		bodies.name.push_back("Asteroid " + std::to_string(k));
+	}
+	bodies.subtreeEnd[sun] = (int)bodies.size();
+
+	ApproachSearch search;
+	search.distance = distance;
+	search.end = 365.25 * years;
+	JobSystem jobs(JobSystem::defaultWorkerCount());
+	std::vector<CloseApproach> found, check;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t candidates = findCloseApproaches(bodies, search, found, &jobs);
+	double ms = millisecondsSince(start);
+
+	search.interval = 0.5 * approachInterval(bodies, search);
+	findCloseApproaches(bodies, search, check, &jobs);
+	bool same = check.size() == found.size();
+	for (size_t k = 0; same && k < found.size(); k++)
+		same = check[k].first == found[k].first && check[k].second == found[k].second &&
+			std::fabs(check[k].time - found[k].time) < 1e-6;
+
+	printf("Close approaches under %g AU among %zu bodies over %g years: %zu found, %zu candidate pairs, "
+		"%.0f ms on %u workers + caller\n", distance, bodies.size(), years, found.size(), candidates, ms,
+		jobs.workerCount());
+	for (size_t k = 0; k < std::min<size_t>(found.size(), 5); k++)
+		printf("  day %.4f: %s - %s, %.6f AU at %.4f AU/day\n", found[k].time, bodies.name[found[k].first].c_str(),
+			bodies.name[found[k].second].c_str(), found[k].distance, found[k].speed);
+	printf("Half the interval: %zu approaches, %s\n", check.size(), same ? "the same ones" : "DIFFERENT");
+	return same ? 0 : 1;
+}
+
+// Events of a scene seen from observer over the years after t = 0, written
+// to an event index that is then read back and searched
+static int findSceneEvents(double years, const char* observer, const char* scenePath, const char* outputPath)
+{
+	BodyTable bodies;
+	if (!loadBodyTable(scenePath, bodies))
+		return 1;
+	EventSearch search;
+	search.end = 365.25 * years;
+	search.observer = bodies.find(observer);
+	if (search.observer < 0)
+		printf("No body %s in %s, only eclipses are searched\n", observer, scenePath);
+
+	JobSystem jobs(JobSystem::defaultWorkerCount());
+	std::vector<EventRecord> events;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	findEvents(bodies, search, events, &jobs);
+	double ms = millisecondsSince(start);
+	if (!writeEventIndex(outputPath, bodies, search, events))
+		return 1;
+
+	size_t kinds[eventOpposition + 1] = {};
+	for (size_t k = 0; k < events.size(); k++)
+		kinds[events[k].kind]++;
+	printf("%zu events in %g years of %s in %.0f ms on %u workers + caller:", events.size(), years, scenePath, ms,
+		jobs.workerCount());
+	for (uint32_t kind = 0; kind <= eventOpposition; kind++)
+		printf(" %zu %s%s", kinds[kind], eventKindName(kind), kind < eventOpposition ? "," : "\n");
+
+	EventIndex index;
+	if (!index.open(outputPath) || index.count() != events.size())
+		return 1;
+	for (size_t k = index.next(0.0), shown = 0; k < index.count() && shown < 5; k = index.next(index.at(k).time), shown++)
+		printf("  day %.4f (%.4f to %.4f): %s\n", index.at(k).time, index.at(k).begin, index.at(k).end,
+			index.describe(k).c_str());
+
+	// Random jumps, as the viewer makes them
+	std::mt19937 random(12345);
+	std::uniform_real_distribution<double> day(search.begin, search.end);
+	const int lookups = 1000000;
+	size_t checksum = 0;
+	start = std::chrono::steady_clock::now();
+	for (int k = 0; k < lookups; k++)
+		checksum += index.next(day(random));
+	double lookupMs = millisecondsSince(start);
+	printf("Written to %s; %.0f ns per next-event lookup (%zu)\n", outputPath, lookupMs * 1e6 / lookups,
+		checksum % 10);
+	return 0;
+}
+
+// Transfer windows from one body of a scene to another over the years after
+// t = 0, next to the Hohmann transfer the cheapest one should come close to,
+// written as a PPM image
+static int porkchopScene(const char* from, const char* to, double years, size_t size, const char* scenePath,
+	const char* outputPath)
+{
+	BodyTable bodies;
+	if (!loadBodyTable(scenePath, bodies))
+		return 1;
+	int first = bodies.find(from), second = bodies.find(to);
+	if (first < 0 || second < 0) {
+		printf("No body %s or %s in %s\n", from, to, scenePath);
+		return 1;
+	}
+	PorkchopSearch search = porkchopWindow(bodies, first, second, 0.0, 365.25 * years);
+	search.departureCount = search.arrivalCount = size;
+
+	JobSystem jobs(JobSystem::defaultWorkerCount());
+	PorkchopGrid grid;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (!computePorkchop(bodies, first, second, search, grid, &jobs))
+		return 1;
+	double ms = millisecondsSince(start);
+	size_t solved = 0;
+	for (size_t k = 0; k < grid.deltaV.size(); k++)
+		solved += grid.deltaV[k] == grid.deltaV[k];
+	printf("%s to %s, %zu x %zu dates (%s): %zu transfers in %.0f ms on %u workers + caller, %.0f ns each\n", from, to,
+		size, size, simd::name(), solved, ms, jobs.workerCount(), ms * 1e6 / std::max<size_t>(1, solved));
+
+	size_t best = grid.best();
+	if (best >= grid.deltaV.size())
+		return 1;
+	size_t d = best / grid.arrivalCount, a = best % grid.arrivalCount;
+	printf("Cheapest: depart day %.1f, arrive day %.1f (%.1f days), C3 %.2f km^2/s^2, arrival %.2f km/s, total %.2f km/s\n",
+		grid.departure[d], grid.arrival[a], grid.flightTime(d, a), grid.c3[best], grid.arrivalSpeed[best], grid.deltaV[best]);
+
+	// Reference: the Hohmann transfer between circles of the two semi-major axes
+	double mu = bodies.semiMajorAxis[first] * bodies.semiMajorAxis[first] * bodies.semiMajorAxis[first] *
+		bodies.meanMotion[first] * bodies.meanMotion[first];
+	double r1 = bodies.semiMajorAxis[first], r2 = bodies.semiMajorAxis[second];
+	const double kmPerSecond = 149597870.7 / 86400.0;
+	double leave = std::sqrt(mu / r1) * std::fabs(std::sqrt(2.0 * r2 / (r1 + r2)) - 1.0) * kmPerSecond;
+	double arrive = std::sqrt(mu / r2) * std::fabs(1.0 - std::sqrt(2.0 * r1 / (r1 + r2))) * kmPerSecond;
+	printf("Hohmann between circular orbits: %.1f days, C3 %.2f km^2/s^2, arrival %.2f km/s, total %.2f km/s\n",
+		M_PI * std::sqrt(std::pow(0.5 * (r1 + r2), 3.0) / mu), leave * leave, arrive, leave + arrive);
+
+	std::vector<unsigned char> rgba;
+	porkchopImage(grid, grid.deltaV[best] + 10.0f, rgba);
+	FILE* image = fopen(outputPath, "wb");
+	if (image == NULL) {
+		printf("Cannot write %s\n", outputPath);
+		return 1;
+	}
+	// PPM rows run top to bottom: the latest arrival first
+	fprintf(image, "P6\n%zu %zu\n255\n", grid.departureCount, grid.arrivalCount);
+	for (size_t row = grid.arrivalCount; row-- > 0;)
+		for (size_t column = 0; column < grid.departureCount; column++)
+			fwrite(&rgba[(row * grid.departureCount + column) * 4], 1, 3, image);
+	fclose(image);
+	printf("Written to %s (departure across, arrival up, %.1f to %.1f km/s)\n", outputPath, grid.deltaV[best],
+		grid.deltaV[best] + 10.0f);
+	return 0;
+}
+
+int runTool(int argc, char** argv)
+{
+	if (strcmp(argv[1], "--bench-kepler") == 0)
+		return benchKepler(argc > 2 ? (size_t)atol(argv[2]) : 1000000);
+	if (strcmp(argv[1], "--bench-warp") == 0)
+		return benchWarp(argc > 2 ? atof(argv[2]) : 100.0);
+	if (strcmp(argv[1], "--bench-nbody") == 0)
+		return benchNBody(argc > 2 ? (size_t)atol(argv[2]) : 100000, argc > 3 ? atof(argv[3]) : 0.5);
+	if (strcmp(argv[1], "--bench-positions") == 0)
+		return benchPositions(argc > 2 ? (size_t)atol(argv[2]) : 100000, argc > 3 ? argv[3] : "scenes/solarSystem.scene");
+	if (strcmp(argv[1], "--bench-theory") == 0)
+		return benchTheories(argc > 2 ? argv[2] : "theory", argc > 3 ? atof(argv[3]) : 1e-6);
+	if (strcmp(argv[1], "--bench-culling") == 0)
+		return benchCulling(argc > 2 ? (size_t)atol(argv[2]) : 1000000);
+	if (strcmp(argv[1], "--check-determinism") == 0)
+		return checkDeterminism(argc > 2 ? atoi(argv[2]) : 20, argc > 3 ? (size_t)atol(argv[3]) : 20000);
+	if (strcmp(argv[1], "--find-approaches") == 0)
+		return benchApproaches(argc > 2 ? (size_t)atol(argv[2]) : 10000, argc > 3 ? atof(argv[3]) : 100.0,
+			argc > 4 ? atof(argv[4]) : 1e-3);
+	if (strcmp(argv[1], "--find-events") == 0)
+		return findSceneEvents(argc > 2 ? atof(argv[2]) : 100.0, argc > 3 ? argv[3] : "Terra",
+			argc > 4 ? argv[4] : "scenes/solarSystem.scene", argc > 5 ? argv[5] : "events.idx");
+	if (strcmp(argv[1], "--porkchop") == 0)
+		return porkchopScene(argc > 2 ? argv[2] : "Terra", argc > 3 ? argv[3] : "Marte", argc > 4 ? atof(argv[4]) : 2.0,
+			argc > 5 ? (size_t)atol(argv[5]) : 1000, argc > 6 ? argv[6] : "scenes/solarSystem.scene",
+			argc > 7 ? argv[7] : "porkchop.ppm");
+	if (strcmp(argv[1], "--serve") == 0)
+		return runQueryServer(argc > 2 ? argv[2] : "projeto.sock", argc > 3 ? argv[3] : "scenes/solarSystem.scene");
+	if (strcmp(argv[1], "--bench-query") == 0)
+		return benchQuery(argc > 2 ? argv[2] : "projeto.sock", argc > 3 ? (size_t)atol(argv[3]) : 10000);
+	if (strcmp(argv[1], "--fit-ephemeris") == 0 && argc > 2)
+		return fitEphemeris(argv[2], argc > 3 ? atof(argv[3]) : 100.0, argc > 4 && strcmp(argv[4], "nbody") == 0,
+			argc > 5 ? argv[5] : "scenes/solarSystem.scene");
+
+	printf("Unknown option %s\n", argv[1]);
+	printf("Usage: Projeto [scene] | --bench-kepler [bodies] | --bench-nbody [particles] [theta] | --bench-warp [years]\n"
+		"       | --bench-theory [directory] [tolerance] | --fit-ephemeris <file> [years] [kepler|nbody] [scene]\n"
+		"       | --check-determinism [steps] [particles] | --bench-positions [dates] [scene]\n"
+		"       | --bench-culling [spheres]\n"
+		"       | --serve [socket] [scene] | --bench-query [socket] [dates]\n"
+		"       | --find-approaches [asteroids] [years] [distance]\n"
+		"       | --find-events [years] [observer] [scene] [output]\n"
+		"       | --porkchop [from] [to] [years] [size] [scene] [output]\n");
+	return 1;
+}